@@ -4,6 +4,8 @@
 #include <iomanip>   // setw, setfill
 #include <fstream>   // fstream
 #include <chrono>    // perf timings
+#include <algorithm>  // sort
+#include <cstdlib>    // atoi
 
 // These inclusions required to set terminal mode.
 #include <termios.h>  // struct termios, tcgetattr(), tcsetattr()
@@ -59,6 +61,9 @@ string charReader(string prompt, bool *pQuit) {
 
     while (!done) {
         char c;
+        // Echo is flushed only when all pending input (e.g. a paste) is consumed, not per character.
+        if (pbuf->in_avail() <= 0)
+            std::cout.flush();
         if (pbuf->sgetc() == EOF)
             done = true;
         c = pbuf->sbumpc();
@@ -81,8 +86,8 @@ string charReader(string prompt, bool *pQuit) {
         case 0x08:
             if (inp.length() > 0) {
                 inp = inp.substr(0, inp.length() - 1);
-                std::cout << "\r" + prompt + inp + " " << std::flush;
-                std::cout << "\r" + prompt + inp << std::flush;
+                std::cout << "\r" + prompt + inp + " ";
+                std::cout << "\r" + prompt + inp;
             }
             break;
         case 0x1b:
@@ -94,11 +99,11 @@ string charReader(string prompt, bool *pQuit) {
                 inp += c;
                 if (c < 32) {
                     std::cout << "[0x" << std::setw(2) << std::setfill('0')
-                              << std::hex << int(c) << "]" << std::flush;
+                              << std::hex << int(c) << "]";
                 } else {
                     //  std::cout << "[0x" << std::setw(2) << std::setfill('0') <<
-                    //  std::hex << int(c) << "]" << std::flush;
-                    std::cout << c << std::flush;
+                    //  std::hex << int(c) << "]";
+                    std::cout << c;
                 }
             } else {
                 esc_string += c;
@@ -106,14 +111,14 @@ string charReader(string prompt, bool *pQuit) {
                     if (input_history.size() == input_history_stack + 1) {
                         input_history.push_back(inp);
                         inp = input_history[input_history_stack];
-                        cout << "\r" << prompt << inp << large_space << std::flush;
-                        cout << "\r" << prompt << inp << std::flush;
+                        cout << "\r" << prompt << inp << large_space;
+                        cout << "\r" << prompt << inp;
                     } else {
                         if (input_history_stack > 0) {
                             --input_history_stack;
                             inp = input_history[input_history_stack];
-                            cout << "\r" << prompt << inp << large_space << std::flush;
-                            cout << "\r" << prompt << inp << std::flush;
+                            cout << "\r" << prompt << inp << large_space;
+                            cout << "\r" << prompt << inp;
                         }
                     }
                     esc_mode = false;
@@ -122,8 +127,8 @@ string charReader(string prompt, bool *pQuit) {
                     if (input_history.size() > input_history_stack + 1) {
                         ++input_history_stack;
                         inp = input_history[input_history_stack];
-                        cout << "\r" << prompt << inp << large_space << std::flush;
-                        cout << "\r" << prompt << inp << std::flush;
+                        cout << "\r" << prompt << inp << large_space;
+                        cout << "\r" << prompt << inp;
                     }
                     esc_mode = false;
                     esc_string = "";
@@ -140,7 +145,7 @@ string charReader(string prompt, bool *pQuit) {
 }
 
 void quitInterpreter(IndraLink &il) {
-    printf("Quitting...\n");
+    std::cout << "Quitting..." << std::endl;
 }
 
 void repl(std::string &prompt, std::string &prompt2) {
@@ -198,9 +203,118 @@ void repl(std::string &prompt, std::string &prompt2) {
     }
 }
 
+void set_args(IndraLink &il, const vector<string> &args) {
+    // Script arguments are the global STRING_ARRAY $args.
+    IlAtom a;
+    a.t = inlnk::STRING_ARRAY;
+    a.vas = args;
+    il.symbols["args"] = a;
+}
+
+int run_script(const string &path, const vector<string> &args, int repeat) {
+    // Runs a script (or image) repeat times, each in a fresh interpreter. With repeat > 1 timing statistics
+    // of the runs are written to stderr. Returns the exit code: 0 ok, 1 error in script, 2 file not found.
+    vector<double> dts;
+    int exit_code = 0;
+    for (int r = 0; r < repeat; r++) {
+        IndraLink il;
+        vector<IlAtom> st;
+        set_args(il, args);
+        bool found;
+        auto start = std::chrono::steady_clock::now();
+        bool ok = il.load_file(path, &st, &found);
+        auto diff = std::chrono::steady_clock::now() - start;
+        if (!found) {
+            std::cerr << "indralink: cannot open " << path << std::endl;
+            return 2;
+        }
+        if (!ok) {
+            if (!st.empty() && st.back().t == inlnk::ERROR) il.out << st.back().str() << "\n";
+            il.out.flush();
+            exit_code = 1;
+        }
+        dts.push_back(std::chrono::duration<double, std::milli>(diff).count());
+    }
+    if (repeat > 1) {
+        std::sort(dts.begin(), dts.end());
+        double total = 0.0;
+        for (auto dt : dts) total += dt;
+        size_t n = dts.size();
+        double median = n % 2 ? dts[n / 2] : (dts[n / 2 - 1] + dts[n / 2]) / 2.0;
+        std::cout.flush();
+        std::cerr << repeat << " runs of " << path << ": min " << dts.front() << " ms, median " << median
+                  << " ms, mean " << total / n << " ms, max " << dts.back() << " ms, total " << total << " ms" << std::endl;
+    }
+    return exit_code;
+}
+
+int run_stdin(const vector<string> &args) {
+    // Reads statements from stdin and evaluates each as soon as it is complete (multi-line definitions,
+    // quotes and strings are collected first). No terminal handling, no timing output.
+    IndraLink il;
+    vector<IlAtom> st;
+    set_args(il, args);
+    int exit_code = 0;
+    string line, cmd;
+    while (std::getline(std::cin, line)) {
+        cmd += line;
+        cmd += "\n";
+        if (!il.is_complete(cmd)) continue;
+        if (!il.eval(il.parse(cmd), &st)) exit_code = 1;
+        cmd.clear();
+    }
+    if (cmd.find_first_not_of(" \t\r\n") != string::npos) {
+        if (!il.eval(il.parse(cmd), &st)) exit_code = 1;
+    }
+    il.out.flush();
+    return exit_code;
+}
+
+void usage() {
+    std::cerr << "usage: indralink                                  interactive REPL\n"
+              << "       indralink [--repeat N] script.il [args...]  run a script (or image), $args holds args\n"
+              << "       indralink - [args...]                      evaluate statements from stdin\n"
+              << "--repeat N runs the script N times and reports timing statistics on stderr." << std::endl;
+}
+
 int main(int argc, char *argv[]) {
     string prompt = "ℑℓ> ", prompt2 = "  > ";
-    repl(prompt, prompt2);
-    std::cout << "end-repl" << std::endl;
-    return 0;
+    // Unsynced streams: cin reads whatever input is available at once, cout is flushed explicitly.
+    std::ios::sync_with_stdio(false);
+    int repeat = 1;
+    int i = 1;
+    for (; i < argc; i++) {
+        string opt = argv[i];
+        if (opt == "--repeat" && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+            if (repeat < 1) {
+                usage();
+                return 2;
+            }
+        } else if (opt == "-h" || opt == "--help" || (opt.size() > 1 && opt[0] == '-')) {
+            usage();
+            return opt[1] == 'h' || opt == "--help" ? 0 : 2;
+        } else {
+            break;
+        }
+    }
+    if (i == argc) {
+        if (repeat != 1) {
+            usage();
+            return 2;
+        }
+        repl(prompt, prompt2);
+        std::cout << "end-repl" << std::endl;
+        return 0;
+    }
+    string script = argv[i];
+    vector<string> args(argv + i + 1, argv + argc);
+    if (script == "-") {
+        if (repeat != 1) {
+            std::cerr << "indralink: --repeat requires a script file" << std::endl;
+            return 2;
+        }
+        return run_stdin(args);
+    }
+    return run_script(script, args, repeat);
 }
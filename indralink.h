@@ -3,7 +3,35 @@
 #include <vector>
 #include <algorithm>
 #include <map>
+#include <set>
+#include <list>
+#include <unordered_map>
 #include <functional>
+#include <memory>
+#include <cmath>
+#include <limits>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <chrono>
+#include <cstdio>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define IL_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using std::cout;
 using std::endl;
@@ -11,12 +39,6 @@ using std::map;
 using std::string;
 using std::vector;
 
-/* Code bits and samples
-Integer square-root, from: https://en.wikipedia.org/wiki/Integer_square_root
-Takes integer and approximates best integer square root through iteration:
-: isqrt (n -- sqrt n) dup dup 2 / dup2 != while dup2 dup >sqrt / + 2 / dup sqrt < loop drop drop drop sqrt ;
-*/
-
 namespace inlnk {
 
 static string infSymbol = "∞";
@@ -32,6 +54,8 @@ enum ilAtomTypes {
     FLOAT_ARRAY,
     BOOL_ARRAY,
     STRING_ARRAY,
+    QUOTE,
+    ARRAY_VIEW,
     SYMBOL,
     COMMENT,
     DEF_WORD,
@@ -43,9 +67,13 @@ enum ilAtomTypes {
     IFUNC,
     FLOW_CONTROL,
     ERROR,
+    FILE_STREAM,  // runtime handles, not part of images
+    FUTURE,
+    CHANNEL,
+    GENERATOR,
 };
 
-void replaceAll(string &str, const string &from, const string &to) {
+inline void replaceAll(string &str, const string &from, const string &to) {
     // https://stackoverflow.com/questions/3418231/replace-part-of-a-string-with-another-string
     if (from.empty())
         return;
@@ -56,528 +84,4761 @@ void replaceAll(string &str, const string &from, const string &to) {
     }
 }
 
-class IlAtom {
-  public:
-    ilAtomTypes t;
+inline ilAtomTypes parse_number(const char *p, const char *end, int *pvi, double *pvf) {
+    // from_chars-style parser for the number literals of the language, INT: -?[0-9]+ and
+    // FLOAT: -?[0-9]*\.[0-9]*([eE]-?[0-9]+)? with at least one digit before or after the dot (and before it,
+    // if negative). Returns INT or FLOAT, or UNDEFINED if [p, end) isn't a number. FLOATs with up to 15
+    // significant digits and a decimal exponent within +-22 are converted exactly, others via strtod.
+    static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const char *s = p;
+    bool neg = false;
+    if (s < end && *s == '-') {
+        neg = true;
+        ++s;
+    }
+    uint64_t mant = 0;
+    int sig = 0;  // significant digits in mant (leading zeros don't count)
+    const char *d0 = s;
+    for (; s < end && *s >= '0' && *s <= '9'; ++s) {
+        mant = mant * 10 + (*s - '0');
+        if (sig || *s != '0') ++sig;
+    }
+    int n_int = s - d0;
+    if (s == end) {
+        if (n_int == 0) return UNDEFINED;
+        *pvi = (int)(neg ? 0 - mant : mant);
+        return INT;
+    }
+    if (*s != '.' || (neg && n_int == 0)) return UNDEFINED;
+    ++s;
+    const char *f0 = s;
+    for (; s < end && *s >= '0' && *s <= '9'; ++s) {
+        mant = mant * 10 + (*s - '0');
+        if (sig || *s != '0') ++sig;
+    }
+    int n_frac = s - f0;
+    if (n_int == 0 && n_frac == 0) return UNDEFINED;
+    int e10 = 0;
+    if (s < end) {
+        if (*s != 'e' && *s != 'E') return UNDEFINED;
+        ++s;
+        bool eneg = false;
+        if (s < end && *s == '-') {
+            eneg = true;
+            ++s;
+        }
+        const char *e0 = s;
+        for (; s < end && *s >= '0' && *s <= '9'; ++s)
+            if (e10 < 100000) e10 = e10 * 10 + (*s - '0');
+        if (s == e0 || s != end) return UNDEFINED;
+        if (eneg) e10 = -e10;
+    }
+    e10 -= n_frac;
+    if (sig <= 15 && e10 >= -22 && e10 <= 22) {
+        // mant < 2^53 and 10^|e10| are exact doubles, so a single rounding gives the correctly rounded result
+        double v = (double)mant;
+        v = e10 < 0 ? v / pow10[-e10] : v * pow10[e10];
+        *pvf = neg ? -v : v;
+    } else {
+        *pvf = strtod(string(p, end - p).c_str(), nullptr);
+    }
+    return FLOAT;
+}
+
+inline string unescape(const char *p, size_t len) {
+    // Resolves the escapes of string literals: \n is a newline, any other escaped char stands for itself.
+    string s;
+    s.reserve(len);
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] == '\\' && i + 1 < len) {
+            ++i;
+            s += p[i] == 'n' ? '\n' : p[i];
+        } else {
+            s += p[i];
+        }
+    }
+    return s;
+}
+
+struct IlToken {
+    // A token as a view into the source (pointer and length), the source must outlive the token.
+    // Number literals are classified and converted by the tokenizer.
+    const char *p;
+    size_t len;
+    ilAtomTypes num;  // INT or FLOAT for number literals, else UNDEFINED
     int vi;
     double vf;
-    string vs;
-    bool vb;
-    vector<int> shape;
-    vector<int> vai;
-    vector<double> vaf;
-    vector<string> vas;
-    vector<bool> vab;
-    string name;
-    std::function<void(vector<IlAtom> *)> vif;
-    int jump_address;
 
-    IlAtom() {
-        t = ERROR;
-        vs = "Not-Init";
+    string str() const {
+        return string(p, len);
     }
+};
 
-    string str() {
-        string ir;
-        switch (t) {
-        case INT:
-        case FLOAT:
-        case BOOL:
-            return vs;
-            break;
-        case STRING:
-            ir = '"' + vs + '"';
-            replaceAll(ir, "\n", "\\n");
-            return ir;
-            break;
-        case INT_ARRAY:
-            ir = "[ ";
-            for (auto i : vai) {
-                ir += std::to_string(i) + " ";
-            }
-            ir += "]";
-            return ir;
-            break;
-        case FLOAT_ARRAY:
-            ir = "[ ";
-            for (auto f : vaf) {
-                ir += std::to_string(f) + " ";
-            }
-            ir += "]";
-            return ir;
-            break;
-        case BOOL_ARRAY:
-            ir = "[ ";
-            for (auto b : vab) {
-                if (b)
-                    ir += "true ";
-                else
-                    ir += "false ";
-            }
-            ir += "]";
-            return ir;
-            break;
-        case STRING_ARRAY:
-            ir = "[ ";
-            for (auto s : vas) {
-                ir += '"' + s + '"' + " ";
-            }
-            ir += "]";
-            return ir;
-            break;
-        case IFUNC:
-        case FUNC:
-        case SHOW_FUNC:
-        case DELETE_FUNC:
-        case SYMBOL:
-        case STORE_SYMBOL:
-        case DELETE_SYMBOL:
-        case FLOW_CONTROL:
-        case DEF_WORD:
-        case COMMENT:
-            return vs;
-            break;
-        case ERROR:
-            return "\n [Error: " + vs + "] ";
-            break;
-        case UNDEFINED:
-            return "<UNDEFINED>";
+class IlThreadPool {
+    // Work-stealing thread pool: parallel_for distributes chunks round-robin over per-worker queues,
+    // workers take from the front of their own queue and steal from the back of others. The calling
+    // thread helps until all chunks of its call are done, so nested calls can't dead-lock.
+  public:
+    explicit IlThreadPool(size_t n_workers) {
+        stop = false;
+        pending = 0;
+        for (size_t i = 0; i < n_workers; i++) queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+        for (size_t i = 0; i < n_workers; i++) workers.push_back(std::thread([this, i]() { work(i); }));
+    }
+
+    ~IlThreadPool() {
+        {
+            std::lock_guard<std::mutex> lk(sleep_m);
+            stop = true;
+        }
+        sleep_cv.notify_all();
+        for (auto &w : workers) {
+            if (w.get_id() == std::this_thread::get_id())
+                w.detach();  // the last owner was released by a task of this pool
+            else
+                w.join();
         }
-        return "[UNEXPECTED TYPE]";
     }
-};
 
-class IndraLink {
-  public:
-    vector<IlAtom> stack;
-    map<string, IlAtom> symbols;
-    map<string, vector<IlAtom>> funcs;
-    map<string, std::function<void(vector<IlAtom> *)>> inbuilts;
-    vector<string> flow_control_words, def_words;
+    size_t size() {
+        return workers.size();
+    }
 
-    void math_2ops(vector<IlAtom> *pst, string ops2) {
-        size_t l = pst->size();
-        if (l < 2) {
-            IlAtom err;
-            err.t = ERROR;
-            err.vs = "Math-" + ops2 + "-Not-Enough-Operands";
-            pst->push_back(err);
+    void parallel_for(size_t n_chunks, const std::function<void(size_t)> &fn) {
+        // Runs fn(0) ... fn(n_chunks-1) concurrently and returns when all are done.
+        if (n_chunks == 0) return;
+        if (queues.size() == 0 || n_chunks == 1) {
+            for (size_t c = 0; c < n_chunks; c++) fn(c);
             return;
         }
-        ilAtomTypes t1, t2;
-        IlAtom res, op1, op2;
-        op2 = pst->back();
-        pst->pop_back();
-        op1 = pst->back();
-        pst->pop_back();
-        t2 = op2.t;
-        t1 = op1.t;
-
-        if ((t1 != INT && t1 != FLOAT) || (t2 != INT && t2 != FLOAT)) {
-            if (t1 == STRING && t2 == STRING && ops2 == "+") {
-                res.t = STRING;
-                res.vs = op1.vs + op2.vs;
-            } else if (t1 == STRING && t2 == INT && op2.vi >= 0 && ops2 == "*") {
-                res.t = STRING;
-                res.vs = "";
-                for (auto i = 0; i < op2.vi; i++)
-                    res.vs += op1.vs;
+        std::atomic<size_t> remaining(n_chunks);
+        std::mutex done_m;
+        std::condition_variable done_cv;
+        for (size_t c = 0; c < n_chunks; c++) {
+            WorkQueue &q = *queues[c % queues.size()];
+            std::lock_guard<std::mutex> lk(q.m);
+            q.tasks.push_back([&fn, c, &remaining, &done_m, &done_cv]() {
+                fn(c);
+                std::lock_guard<std::mutex> dlk(done_m);  // done_m and done_cv live until the caller got it
+                if (--remaining == 0) done_cv.notify_all();
+            });
+        }
+        {
+            std::lock_guard<std::mutex> lk(sleep_m);
+            pending += n_chunks;
+        }
+        sleep_cv.notify_all();
+        std::function<void()> task;
+        while (remaining > 0) {
+            if (steal(queues.size(), &task)) {
+                task();
             } else {
-                IlAtom err;
-                err.t = ERROR;
-                err.vs = "Math-" + ops2 + "-Wrong-Type-Operands";
-                pst->push_back(err);
-                return;
+                std::unique_lock<std::mutex> dlk(done_m);
+                done_cv.wait_for(dlk, std::chrono::milliseconds(1), [&remaining]() { return remaining == 0; });
             }
-            pst->push_back(res);
+        }
+        std::lock_guard<std::mutex> dlk(done_m);  // the last chunk has released done_m
+    }
+
+    void submit(std::function<void()> task) {
+        // Queues task without waiting for it, callers synchronize through their own state.
+        if (queues.size() == 0) {
+            task();
             return;
         }
+        {
+            WorkQueue &q = *queues[next_queue++ % queues.size()];
+            std::lock_guard<std::mutex> lk(q.m);
+            q.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lk(sleep_m);
+            pending++;
+        }
+        sleep_cv.notify_one();
+    }
 
-        if (t1 == INT && t2 == INT) {
-            int o1, o2;
-            o1 = op1.vi;
-            o2 = op2.vi;
-            res.t = INT;
-            if (ops2 == "+")
-                res.vi = o1 + o2;
-            else if (ops2 == "-")
-                res.vi = o1 - o2;
-            else if (ops2 == "*")
-                res.vi = o1 * o2;
-            else if (ops2 == "/") {
-                if (o2 == 0) {
-                    IlAtom err;
-                    err.t = ERROR;
-                    err.vs = "/-by-Zero";
-                    pst->push_back(err);
-                    return;
-                }
-                res.vi = o1 / o2;
-            } else if (ops2 == "%") {
-                if (o2 == 0) {
-                    IlAtom err;
-                    err.t = ERROR;
-                    err.vs = "/-by-Zero";
-                    pst->push_back(err);
-                    return;
-                }
-                res.vi = o1 % o2;
-            } else {
-                IlAtom err;
-                err.t = ERROR;
-                err.vs = "Math-" + ops2 + "Unknown op-code";
-                pst->push_back(err);
-                return;
-            }
-            res.vs = std::to_string(res.vi);
-        } else {
-            double o1, o2;
-            if (t1 == INT)
-                o1 = (double)op1.vi;
-            else
-                o1 = op1.vf;
-            if (t2 == INT)
-                o2 = (double)op2.vi;
-            else
-                o2 = op2.vf;
-            res.t = FLOAT;
-            if (ops2 == "+")
-                res.vf = o1 + o2;
-            else if (ops2 == "-")
-                res.vf = o1 - o2;
-            else if (ops2 == "*")
-                res.vf = o1 * o2;
-            else if (ops2 == "/") {
-                if (o2 == 0.0) {
-                    IlAtom err;
-                    err.t = ERROR;
-                    err.vs = "/-by-Zero";
-                    pst->push_back(err);
-                    return;
-                }
-                res.vf = o1 / o2;
+  private:
+    struct WorkQueue {
+        std::mutex m;
+        std::deque<std::function<void()>> tasks;
+    };
+    vector<std::unique_ptr<WorkQueue>> queues;
+    vector<std::thread> workers;
+    std::mutex sleep_m;
+    std::condition_variable sleep_cv;
+    size_t pending;  // queued tasks, guarded by sleep_m
+    bool stop;
+    std::atomic<size_t> next_queue{0};  // round-robin target of submit
+
+    bool take(size_t qi, bool front, std::function<void()> *ptask) {
+        WorkQueue &q = *queues[qi];
+        {
+            std::lock_guard<std::mutex> lk(q.m);
+            if (q.tasks.empty()) return false;
+            if (front) {
+                *ptask = std::move(q.tasks.front());
+                q.tasks.pop_front();
             } else {
-                IlAtom err;
-                err.t = ERROR;
-                err.vs = "Unknown math-2ops: " + ops2;
-                pst->push_back(err);
-                return;
+                *ptask = std::move(q.tasks.back());
+                q.tasks.pop_back();
             }
-            res.vs = std::to_string(res.vf);
         }
-        pst->push_back(res);
+        std::lock_guard<std::mutex> lk(sleep_m);
+        --pending;
+        return true;
     }
 
-    void
-    cmp_2ops(vector<IlAtom> *pst, string ops2) {
-        size_t l = pst->size();
-        if (l < 2) {
-            IlAtom err;
-            err.t = ERROR;
-            err.vs = "CMP-Not-Enough-Operands";
-            pst->push_back(err);
-            return;
+    bool steal(size_t self, std::function<void()> *ptask) {
+        for (size_t k = 0; k < queues.size(); k++) {
+            size_t qi = (self + 1 + k) % queues.size();
+            if (take(qi, false, ptask)) return true;
         }
-        ilAtomTypes t1, t2;
-        IlAtom res, op1, op2;
-        op2 = pst->back();
-        pst->pop_back();
-        op1 = pst->back();
-        pst->pop_back();
-        t2 = op2.t;
-        t1 = op1.t;
+        return false;
+    }
 
-        if ((t1 != INT && t1 != FLOAT) || (t2 != INT && t2 != FLOAT)) {
-            if (t1 == BOOL && t2 == BOOL) {
-                res.t = BOOL;
-                if (ops2 == "==") {
-                    res.vb = (op1.vb == op2.vb);
-                } else if (ops2 == "!=") {
-                    res.vb = (op1.vb != op2.vb);
-                } else {
-                    IlAtom err;
-                    err.t = ERROR;
-                    err.vs = "BOOL-Cmp-" + ops2 + "-Wrong-Type-Operands";
-                    pst->push_back(err);
-                    return;
-                }
-            } else if (t1 == STRING && t2 == STRING) {
-                res.t = BOOL;
-                if (ops2 == "==") {
-                    res.vb = (op1.vs == op2.vs);
-                } else if (ops2 == "!=") {
-                    res.vb = (op1.vs != op2.vs);
-                } else if (ops2 == ">=") {
-                    res.vb = (op1.vs >= op2.vs);
-                } else if (ops2 == "<=") {
-                    res.vb = (op1.vs <= op2.vs);
-                } else if (ops2 == "<") {
-                    res.vb = (op1.vs < op2.vs);
-                } else if (ops2 == ">") {
-                    res.vb = (op1.vs > op2.vs);
-                } else {
-                    IlAtom err;
-                    err.t = ERROR;
-                    err.vs = "BOOL-Cmp-" + ops2 + "-Wrong-Type-Operands";
-                    pst->push_back(err);
+    void work(size_t self) {
+        std::function<void()> task;
+        while (true) {
+            if (take(self, true, &task) || steal(self, &task)) {
+                task();
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(sleep_m);
+            sleep_cv.wait(lk, [this]() { return stop || pending > 0; });
+            if (stop) return;
+        }
+    }
+};
+
+inline uint64_t dbl_bits(double x) {
+    uint64_t u;
+    memcpy(&u, &x, sizeof(u));
+    return u;
+}
+
+inline double bits_dbl(uint64_t u) {
+    double x;
+    memcpy(&x, &u, sizeof(x));
+    return x;
+}
+
+/* Polynomial kernels for the array forms of exp, log, sin and cos. They are written without branches
+(selects on bit masks instead) so that the element loops over a block get vectorized by the compiler.
+Max. error measured against glibc over 2*10^6 random arguments per range: exp 1 ulp, log 2 ulp, sin and cos
+2 ulp for |x| <= 1e5 (larger arguments fall back to libm). */
+
+inline double poly_exp(double x) {
+    // exp(x) = 2^k * exp(r), k = round(x / ln2), |r| <= ln2 / 2, degree 13 Taylor polynomial. x must be
+    // within [-746, 710]. 2^k is applied in two factors, so that subnormal results are correct.
+    const double inv_ln2 = 1.44269504088896338700e+00;
+    const double ln2_hi = 6.93147180369123816490e-01, ln2_lo = 1.90821492927058770002e-10;
+    const double shift = 6755399441055744.0;  // 1.5 * 2^52, adding and subtracting rounds to integer
+    double kd = (x * inv_ln2 + shift) - shift;
+    double r = (x - kd * ln2_hi) - kd * ln2_lo;
+    double p = 1.0 / 6227020800.0;
+    p = p * r + 1.0 / 479001600.0;
+    p = p * r + 1.0 / 39916800.0;
+    p = p * r + 1.0 / 3628800.0;
+    p = p * r + 1.0 / 362880.0;
+    p = p * r + 1.0 / 40320.0;
+    p = p * r + 1.0 / 5040.0;
+    p = p * r + 1.0 / 720.0;
+    p = p * r + 1.0 / 120.0;
+    p = p * r + 1.0 / 24.0;
+    p = p * r + 1.0 / 6.0;
+    p = p * r + 0.5;
+    p = p * r + 1.0;
+    p = p * r + 1.0;
+    double k1 = (kd * 0.5 + shift) - shift, k2 = kd - k1;
+    double s1 = bits_dbl((dbl_bits(k1 + shift) + 1023) << 52), s2 = bits_dbl((dbl_bits(k2 + shift) + 1023) << 52);
+    return p * s1 * s2;
+}
+
+inline double poly_log(double x) {
+    // log(x) = e * ln2 + 2 atanh(f), x = m * 2^e, sqrt(1/2) <= m < sqrt(2), f = (m - 1) / (m + 1), |f| < 0.172.
+    // x must be a positive normal number.
+    const double ln2_hi = 6.93147180369123816490e-01, ln2_lo = 1.90821492927058770002e-10;
+    // Adding 1.0 - sqrt(1/2) to the bits carries into the exponent, iff the mantissa is >= sqrt(2).
+    uint64_t ix = dbl_bits(x) + (0x3ff0000000000000ULL - 0x3fe6a09e667f3bcdULL);
+    double e = bits_dbl(0x4330000000000000ULL | (ix >> 52)) - (4503599627370496.0 + 1023.0);  // 2^52 + e
+    double m = bits_dbl((ix & 0x000fffffffffffffULL) + 0x3fe6a09e667f3bcdULL);
+    double f = (m - 1.0) / (m + 1.0);
+    double f2 = f * f;
+    double p = 1.0 / 21.0;
+    p = p * f2 + 1.0 / 19.0;
+    p = p * f2 + 1.0 / 17.0;
+    p = p * f2 + 1.0 / 15.0;
+    p = p * f2 + 1.0 / 13.0;
+    p = p * f2 + 1.0 / 11.0;
+    p = p * f2 + 1.0 / 9.0;
+    p = p * f2 + 1.0 / 7.0;
+    p = p * f2 + 1.0 / 5.0;
+    p = p * f2 + 1.0 / 3.0;
+    return e * ln2_hi + ((2.0 * f + 2.0 * f * f2 * p) + e * ln2_lo);
+}
+
+inline void poly_sincos_reduced(double x, double *ps, double *pc, uint64_t *pq) {
+    // x = q * pi/2 + r, |r| <= pi/4, Cody-Waite reduction with a three part pi/2 (accurate for |x| <= 1e5),
+    // sin(r) and cos(r) by degree 15 and 16 Taylor polynomials. The low bits of *pq hold q.
+    const double two_over_pi = 6.36619772367581382433e-01;
+    const double pio2_1 = 1.57079632673412561417e+00, pio2_2 = 6.07710050630396597660e-11, pio2_3 = 2.02226624879595063154e-21;
+    const double shift = 6755399441055744.0;
+    double kq = x * two_over_pi + shift;
+    *pq = dbl_bits(kq);
+    double kd = kq - shift;
+    double r = ((x - kd * pio2_1) - kd * pio2_2) - kd * pio2_3;
+    double r2 = r * r;
+    double s = -1.0 / 1307674368000.0;
+    s = s * r2 + 1.0 / 6227020800.0;
+    s = s * r2 - 1.0 / 39916800.0;
+    s = s * r2 + 1.0 / 362880.0;
+    s = s * r2 - 1.0 / 5040.0;
+    s = s * r2 + 1.0 / 120.0;
+    s = s * r2 - 1.0 / 6.0;
+    *ps = r + r * r2 * s;
+    double c = 1.0 / 20922789888000.0;
+    c = c * r2 - 1.0 / 87178291200.0;
+    c = c * r2 + 1.0 / 479001600.0;
+    c = c * r2 - 1.0 / 3628800.0;
+    c = c * r2 + 1.0 / 40320.0;
+    c = c * r2 - 1.0 / 720.0;
+    c = c * r2 + 1.0 / 24.0;
+    *pc = 1.0 - 0.5 * r2 + r2 * r2 * c;
+}
+
+inline double poly_sin(double x) {
+    double s, c;
+    uint64_t q;
+    poly_sincos_reduced(x, &s, &c, &q);
+    uint64_t sel = 0 - (q & 1);  // odd quadrants: cos(r)
+    return bits_dbl(((dbl_bits(c) & sel) | (dbl_bits(s) & ~sel)) ^ ((q & 2) << 62));
+}
+
+inline double poly_cos(double x) {
+    double s, c;
+    uint64_t q;
+    poly_sincos_reduced(x, &s, &c, &q);
+    uint64_t sel = 0 - (q & 1);  // odd quadrants: sin(r)
+    return bits_dbl(((dbl_bits(s) & sel) | (dbl_bits(c) & ~sel)) ^ (((q + 1) & 2) << 62));
+}
+
+inline void vec_exp(const double *x, double *y, size_t len) {
+    for (size_t k = 0; k < len; k++) y[k] = x[k] < -746.0 ? -746.0 : (x[k] > 710.0 ? 710.0 : x[k]);  // keeps NaN
+    for (size_t k = 0; k < len; k++) y[k] = poly_exp(y[k]);
+}
+
+inline void vec_log(const double *x, double *y, size_t len) {
+    for (size_t k = 0; k < len; k++) y[k] = poly_log(x[k]);
+    for (size_t k = 0; k < len; k++)
+        if (!(x[k] >= 2.2250738585072014e-308 && x[k] <= 1.7976931348623157e308)) y[k] = std::log(x[k]);  // subnormal, 0, < 0, inf, NaN
+}
+
+inline void vec_sin(const double *x, double *y, size_t len) {
+    for (size_t k = 0; k < len; k++) y[k] = poly_sin(x[k]);
+    for (size_t k = 0; k < len; k++)
+        if (std::fabs(x[k]) > 1e5) y[k] = std::sin(x[k]);
+}
+
+inline void vec_cos(const double *x, double *y, size_t len) {
+    for (size_t k = 0; k < len; k++) y[k] = poly_cos(x[k]);
+    for (size_t k = 0; k < len; k++)
+        if (std::fabs(x[k]) > 1e5) y[k] = std::cos(x[k]);
+}
+
+class IlHostBuffer {
+    // Guard of host memory that is bound into scripts without copying (IndraLink::bind_array). The host calls
+    // release() before the memory becomes invalid (between evaluations), afterwards accesses are errors.
+  public:
+    std::atomic<bool> released;
+    bool writable;                // scripts may store into the memory
+    std::shared_ptr<void> owner;  // optional, keeps the host memory alive while scripts reference it
+
+    IlHostBuffer(bool writable, std::shared_ptr<void> owner) : released(false), writable(writable), owner(owner) {
+    }
+
+    void release() {
+        released = true;
+    }
+};
+
+class IlArrayExpr {
+    // Lazily evaluated element-wise array expression, held by ARRAY_VIEW atoms: a typed source buffer
+    // and a chain of pending steps. Evaluation is fused: all steps run block-wise in one pass over the source.
+  public:
+    enum DType { I32,
+                 F64,
+                 U8,
+                 I8,
+                 U16,
+                 I16,
+                 F32 };
+    enum Op { ADD,
+              SUB,
+              MUL,
+              DIV,
+              MOD,
+              EQ,
+              NE,
+              GE,
+              LE,
+              LT,
+              GT,
+              AND,
+              OR,
+              POW,
+              ATAN2,
+              MIN2,
+              MAX2,
+              CLAMP,  // CLAMP and all following ops take no array or scalar operand
+              SQRT,
+              ISQRT,
+              ABS,
+              FLOOR,
+              CEIL,
+              ROUND,
+              EXP,
+              LOG,
+              SIN,
+              COS };
+    enum Status { OK,
+                  DIV_BY_ZERO,
+                  DOMAIN_ERROR,
+                  HOST_RELEASED };
+    struct Step {
+        Op op;
+        bool int_op;  // INT semantics for DIV (truncation)
+        bool rev;     // operand is the left-hand side
+        double sc, sc2;
+        std::shared_ptr<IlArrayExpr> arg;  // array operand, nullptr: scalar operand sc
+    };
+    static const size_t block_size = 256;
+    static const size_t chunk_size = 16384;  // elements per concurrent work unit, 128k of doubles fit into L2
+
+    const void *data;
+    size_t n;
+    DType dtype;
+    std::shared_ptr<void> owner;         // keeps data alive
+    std::shared_ptr<IlHostBuffer> host;  // guard of data in host memory, nullptr otherwise
+    vector<Step> steps;
+    ilAtomTypes t;  // result type: INT_ARRAY, FLOAT_ARRAY or BOOL_ARRAY
+
+    IlArrayExpr() {
+        data = nullptr;
+        n = 0;
+        dtype = F64;
+        t = FLOAT_ARRAY;
+    }
+
+    static size_t dtype_size(DType dtype) {
+        switch (dtype) {
+        case U8:
+        case I8:
+            return 1;
+        case U16:
+        case I16:
+            return 2;
+        case I32:
+        case F32:
+            return 4;
+        default:
+            return 8;
+        }
+    }
+
+    static bool dtype_from_str(const string &s, DType *pdtype) {
+        static const char *names[] = {"i32", "f64", "u8", "i8", "u16", "i16", "f32"};
+        for (int i = 0; i < 7; i++) {
+            if (s == names[i]) {
+                *pdtype = (DType)i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static ilAtomTypes dtype_array_type(DType dtype) {
+        return dtype == F32 || dtype == F64 ? FLOAT_ARRAY : INT_ARRAY;
+    }
+
+    template <typename T>
+    static void load_block(const void *data, size_t start, size_t len, double *out) {
+        const T *p = (const T *)data + start;
+        for (size_t k = 0; k < len; k++) out[k] = p[k];
+    }
+
+    template <typename T>
+    static void store_block(const double *x, size_t len, void *dst) {
+        // Converts to T, integer types saturate (NaN becomes 0).
+        T *p = (T *)dst;
+        if (std::numeric_limits<T>::is_integer) {
+            const double lo = (double)std::numeric_limits<T>::min(), hi = (double)std::numeric_limits<T>::max();
+            for (size_t k = 0; k < len; k++) p[k] = x[k] != x[k] ? 0 : (T)(x[k] < lo ? lo : (x[k] > hi ? hi : x[k]));
+        } else {
+            for (size_t k = 0; k < len; k++) p[k] = (T)x[k];
+        }
+    }
+
+    static int int_elem(double x) {
+        // INT result of an element, computed in double: saturates to the int range (NaN becomes 0), so that
+        // overflowing products or sums are well defined.
+        const double lo = (double)std::numeric_limits<int>::min(), hi = (double)std::numeric_limits<int>::max();
+        return x != x ? 0 : (int)(x < lo ? lo : (x > hi ? hi : x));
+    }
+
+    static void store_block(DType dtype, const double *x, size_t len, void *dst) {
+        switch (dtype) {
+        case I32:
+            store_block<int32_t>(x, len, dst);
+            break;
+        case F64:
+            store_block<double>(x, len, dst);
+            break;
+        case U8:
+            store_block<uint8_t>(x, len, dst);
+            break;
+        case I8:
+            store_block<int8_t>(x, len, dst);
+            break;
+        case U16:
+            store_block<uint16_t>(x, len, dst);
+            break;
+        case I16:
+            store_block<int16_t>(x, len, dst);
+            break;
+        case F32:
+            store_block<float>(x, len, dst);
+            break;
+        }
+    }
+
+    static string status_str(Status status) {
+        switch (status) {
+        case DIV_BY_ZERO:
+            return "/-by-Zero";
+        case DOMAIN_ERROR:
+            return "Math-domain-error";
+        case HOST_RELEASED:
+            return "Host-buffer-released";
+        default:
+            return "OK";
+        }
+    }
+
+    Status eval_block(size_t start, size_t len, double *out) const {
+        // Evaluates elements [start, start+len), len <= block_size.
+        if (host && host->released) return HOST_RELEASED;
+        switch (dtype) {
+        case I32:
+            load_block<int32_t>(data, start, len, out);
+            break;
+        case F64:
+            load_block<double>(data, start, len, out);
+            break;
+        case U8:
+            load_block<uint8_t>(data, start, len, out);
+            break;
+        case I8:
+            load_block<int8_t>(data, start, len, out);
+            break;
+        case U16:
+            load_block<uint16_t>(data, start, len, out);
+            break;
+        case I16:
+            load_block<int16_t>(data, start, len, out);
+            break;
+        case F32:
+            load_block<float>(data, start, len, out);
+            break;
+        }
+        double tmp[block_size];
+        for (const auto &st : steps) {
+            const double *b = tmp;
+            if (st.op >= CLAMP) {
+                // no operand
+            } else if (st.arg) {
+                Status status = st.arg->eval_block(start, len, tmp);
+                if (status != OK) return status;
+            } else {
+                for (size_t k = 0; k < len; k++) tmp[k] = st.sc;
+            }
+            if (st.rev) {
+                // operand on the left: swap, so that out holds the left-hand side
+                for (size_t k = 0; k < len; k++) std::swap(out[k], tmp[k]);
+            }
+            switch (st.op) {
+            case ADD:
+                for (size_t k = 0; k < len; k++) out[k] += b[k];
+                break;
+            case SUB:
+                for (size_t k = 0; k < len; k++) out[k] -= b[k];
+                break;
+            case MUL:
+                for (size_t k = 0; k < len; k++) out[k] *= b[k];
+                break;
+            case DIV:
+                for (size_t k = 0; k < len; k++)
+                    if (b[k] == 0.0) return DIV_BY_ZERO;
+                if (st.int_op)
+                    for (size_t k = 0; k < len; k++) out[k] = std::trunc(out[k] / b[k]);
+                else
+                    for (size_t k = 0; k < len; k++) out[k] /= b[k];
+                break;
+            case MOD:
+                for (size_t k = 0; k < len; k++)
+                    if (b[k] == 0.0) return DIV_BY_ZERO;
+                for (size_t k = 0; k < len; k++) out[k] = std::fmod(out[k], b[k]);
+                break;
+            case EQ:
+                for (size_t k = 0; k < len; k++) out[k] = out[k] == b[k];
+                break;
+            case NE:
+                for (size_t k = 0; k < len; k++) out[k] = out[k] != b[k];
+                break;
+            case GE:
+                for (size_t k = 0; k < len; k++) out[k] = out[k] >= b[k];
+                break;
+            case LE:
+                for (size_t k = 0; k < len; k++) out[k] = out[k] <= b[k];
+                break;
+            case LT:
+                for (size_t k = 0; k < len; k++) out[k] = out[k] < b[k];
+                break;
+            case GT:
+                for (size_t k = 0; k < len; k++) out[k] = out[k] > b[k];
+                break;
+            case AND:
+                for (size_t k = 0; k < len; k++) out[k] = (out[k] != 0.0) && (b[k] != 0.0);
+                break;
+            case OR:
+                for (size_t k = 0; k < len; k++) out[k] = (out[k] != 0.0) || (b[k] != 0.0);
+                break;
+            case POW:
+                for (size_t k = 0; k < len; k++) out[k] = std::pow(out[k], b[k]);
+                break;
+            case ATAN2:
+                for (size_t k = 0; k < len; k++) out[k] = std::atan2(out[k], b[k]);
+                break;
+            case MIN2:
+                for (size_t k = 0; k < len; k++) out[k] = b[k] < out[k] ? b[k] : out[k];
+                break;
+            case MAX2:
+                for (size_t k = 0; k < len; k++) out[k] = b[k] > out[k] ? b[k] : out[k];
+                break;
+            case CLAMP:
+                for (size_t k = 0; k < len; k++) out[k] = out[k] < st.sc ? st.sc : (out[k] > st.sc2 ? st.sc2 : out[k]);
+                break;
+            case SQRT:
+                for (size_t k = 0; k < len; k++) out[k] = std::sqrt(out[k]);
+                break;
+            case ISQRT:
+                for (size_t k = 0; k < len; k++)
+                    if (out[k] < 0.0) return DOMAIN_ERROR;
+                for (size_t k = 0; k < len; k++) out[k] = std::floor(std::sqrt(out[k]));
+                break;
+            case ABS:
+                for (size_t k = 0; k < len; k++) out[k] = std::fabs(out[k]);
+                break;
+            case FLOOR:
+                for (size_t k = 0; k < len; k++) out[k] = std::floor(out[k]);
+                break;
+            case CEIL:
+                for (size_t k = 0; k < len; k++) out[k] = std::ceil(out[k]);
+                break;
+            case ROUND:
+                for (size_t k = 0; k < len; k++) out[k] = std::round(out[k]);
+                break;
+            case EXP:
+            case LOG:
+            case SIN:
+            case COS:
+                for (size_t k = 0; k < len; k++) tmp[k] = out[k];
+                math_block(st.op, tmp, out, len);
+                break;
+            }
+        }
+        return OK;
+    }
+
+    static void math_block(Op op, const double *x, double *y, size_t len) {
+        // exp, log, sin, cos of a block. sin and cos use the vectorized polynomial kernels. exp and log only when
+        // compiled for AVX2 (e.g. with -march=native): with SSE2 only, glibc's table based exp and log are faster.
+        switch (op) {
+#ifdef __AVX2__
+        case EXP:
+            vec_exp(x, y, len);
+            break;
+        case LOG:
+            vec_log(x, y, len);
+            break;
+#else
+        case EXP:
+            for (size_t k = 0; k < len; k++) y[k] = std::exp(x[k]);
+            break;
+        case LOG:
+            for (size_t k = 0; k < len; k++) y[k] = std::log(x[k]);
+            break;
+#endif
+        case SIN:
+            vec_sin(x, y, len);
+            break;
+        default:
+            vec_cos(x, y, len);
+            break;
+        }
+    }
+
+    Status at(size_t i, double *pv) const {
+        return eval_block(i, 1, pv);
+    }
+
+    Status materialize(vector<int> *pvi, vector<double> *pvf, vector<bool> *pvb, IlThreadPool *pool = nullptr) const {
+        // Writes the evaluated expression into the vector that corresponds to the result type t.
+        // With a pool, chunks of chunk_size elements are evaluated concurrently.
+        vector<unsigned char> vb;
+        switch (t) {
+        case INT_ARRAY:
+            pvi->resize(n);
+            break;
+        case FLOAT_ARRAY:
+            pvf->resize(n);
+            break;
+        default:
+            vb.resize(n);
+            break;
+        }
+        size_t cs = pool ? chunk_size : n;
+        size_t n_chunks = cs ? (n + cs - 1) / cs : 0;
+        std::atomic<int> status(OK);
+        auto chunk = [&](size_t c) {
+            double buf[block_size];
+            size_t end = (c + 1) * cs < n ? (c + 1) * cs : n;
+            for (size_t start = c * cs; start < end; start += block_size) {
+                size_t len = end - start < block_size ? end - start : block_size;
+                Status st = eval_block(start, len, buf);
+                if (st != OK) {
+                    status = st;
                     return;
                 }
-            } else {
+                switch (t) {
+                case INT_ARRAY:
+                    for (size_t k = 0; k < len; k++) (*pvi)[start + k] = int_elem(buf[k]);
+                    break;
+                case FLOAT_ARRAY:
+                    for (size_t k = 0; k < len; k++) (*pvf)[start + k] = buf[k];
+                    break;
+                default:
+                    for (size_t k = 0; k < len; k++) vb[start + k] = buf[k] != 0.0;
+                    break;
+                }
+            }
+        };
+        if (pool)
+            pool->parallel_for(n_chunks, chunk);
+        else
+            for (size_t c = 0; c < n_chunks; c++) chunk(c);
+        if (t == BOOL_ARRAY) pvb->assign(vb.begin(), vb.end());
+        return (Status)status.load();
+    }
+
+    Status store(void *dst, DType dst_dtype, IlThreadPool *pool = nullptr) const {
+        // Writes the n evaluated elements into dst, converted to dst_dtype. Blocks are read before they are
+        // written, so dst may be the source of the expression. On error dst may be partially written.
+        size_t esz = dtype_size(dst_dtype);
+        size_t cs = pool ? chunk_size : n;
+        size_t n_chunks = cs ? (n + cs - 1) / cs : 0;
+        std::atomic<int> status(OK);
+        auto chunk = [&](size_t c) {
+            double buf[block_size];
+            size_t end = (c + 1) * cs < n ? (c + 1) * cs : n;
+            for (size_t start = c * cs; start < end; start += block_size) {
+                size_t len = end - start < block_size ? end - start : block_size;
+                Status st = eval_block(start, len, buf);
+                if (st != OK) {
+                    status = st;
+                    return;
+                }
+                store_block(dst_dtype, buf, len, (char *)dst + start * esz);
+            }
+        };
+        if (pool)
+            pool->parallel_for(n_chunks, chunk);
+        else
+            for (size_t c = 0; c < n_chunks; c++) chunk(c);
+        return (Status)status.load();
+    }
+
+    Status sum(long long *psi, double *psf, bool *psb, IlThreadPool *pool = nullptr) const {
+        // Fused reduction without materializing: INT sum, FLOAT sum or BOOL all. Without a pool FLOATs are
+        // added in element order, with a pool per chunk (so the last digits may differ).
+        size_t cs = pool ? chunk_size : n;
+        size_t n_chunks = cs ? (n + cs - 1) / cs : 0;
+        vector<long long> si(n_chunks, 0);
+        vector<double> sf(n_chunks, 0.0);
+        vector<unsigned char> sb(n_chunks, 1);
+        std::atomic<int> status(OK);
+        auto chunk = [&](size_t c) {
+            double buf[block_size];
+            size_t end = (c + 1) * cs < n ? (c + 1) * cs : n;
+            for (size_t start = c * cs; start < end; start += block_size) {
+                size_t len = end - start < block_size ? end - start : block_size;
+                Status st = eval_block(start, len, buf);
+                if (st != OK) {
+                    status = st;
+                    return;
+                }
+                switch (t) {
+                case INT_ARRAY:
+                    for (size_t k = 0; k < len; k++) si[c] += int_elem(buf[k]);
+                    break;
+                case FLOAT_ARRAY:
+                    for (size_t k = 0; k < len; k++) sf[c] += buf[k];
+                    break;
+                default:
+                    for (size_t k = 0; k < len; k++)
+                        if (buf[k] == 0.0) sb[c] = 0;
+                    break;
+                }
+            }
+        };
+        if (pool)
+            pool->parallel_for(n_chunks, chunk);
+        else
+            for (size_t c = 0; c < n_chunks; c++) chunk(c);
+        *psi = 0;
+        *psf = 0.0;
+        *psb = true;
+        for (size_t c = 0; c < n_chunks; c++) {
+            *psi += si[c];
+            *psf += sf[c];
+            if (!sb[c]) *psb = false;
+        }
+        return (Status)status.load();
+    }
+
+    string str() const {
+        vector<int> vi;
+        vector<double> vf;
+        vector<bool> vb;
+        Status status = materialize(&vi, &vf, &vb);
+        if (status != OK) return "\n [Error: " + status_str(status) + "] ";
+        string ir = "[ ";
+        switch (t) {
+        case INT_ARRAY:
+            for (auto i : vi) ir += std::to_string(i) + " ";
+            break;
+        case FLOAT_ARRAY:
+            for (auto f : vf) ir += std::to_string(f) + " ";
+            break;
+        default:
+            for (auto b : vb) ir += b ? "true " : "false ";
+            break;
+        }
+        ir += "]";
+        return ir;
+    }
+};
+
+template <int N>
+void matmul_small(const double *a, const double *b, double *c) {
+    // Fully unrolled kernel for tiny square matrices (N = 2, 3, 4).
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++) {
+            double s = 0.0;
+            for (int k = 0; k < N; k++) s += a[i * N + k] * b[k * N + j];
+            c[i * N + j] = s;
+        }
+}
+
+inline void matmul_rows(const double *a, const double *b, double *c, int i0, int i1, int n, int p) {
+    // C[i0..i1) += A[i0..i1) * B, cache-blocked, the inner loop runs along rows of B and C and vectorizes.
+    const int bi = 32, bk = 128, bj = 512;
+    for (int ii = i0; ii < i1; ii += bi) {
+        int ie = ii + bi < i1 ? ii + bi : i1;
+        for (int kk = 0; kk < n; kk += bk) {
+            int ke = kk + bk < n ? kk + bk : n;
+            for (int jj = 0; jj < p; jj += bj) {
+                int je = jj + bj < p ? jj + bj : p;
+                for (int i = ii; i < ie; i++) {
+                    double *ci = c + (size_t)i * p;
+                    for (int k = kk; k < ke; k++) {
+                        double aik = a[(size_t)i * n + k];
+                        const double *bk_row = b + (size_t)k * p;
+                        for (int j = jj; j < je; j++) ci[j] += aik * bk_row[j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+inline void matmul(const double *a, const double *b, double *c, int m, int n, int p, IlThreadPool *pool = nullptr) {
+    // C = A * B, A: m x n, B: n x p, C: m x p, all row-major.
+    if (m == n && n == p && m >= 2 && m <= 4) {
+        switch (m) {
+        case 2:
+            matmul_small<2>(a, b, c);
+            return;
+        case 3:
+            matmul_small<3>(a, b, c);
+            return;
+        default:
+            matmul_small<4>(a, b, c);
+            return;
+        }
+    }
+    for (size_t i = 0; i < (size_t)m * p; i++) c[i] = 0.0;
+    const int rows = 32;
+    int n_chunks = (m + rows - 1) / rows;
+    if (pool) {
+        pool->parallel_for(n_chunks, [&](size_t ch) {
+            int i0 = (int)ch * rows;
+            matmul_rows(a, b, c, i0, i0 + rows < m ? i0 + rows : m, n, p);
+        });
+    } else {
+        matmul_rows(a, b, c, 0, m, n, p);
+    }
+}
+
+inline void transpose(const double *a, double *t, int m, int n) {
+    // T = A^T, A: m x n, T: n x m, in 32 x 32 tiles to keep reads and writes cache local.
+    const int tile = 32;
+    for (int ii = 0; ii < m; ii += tile) {
+        int ie = ii + tile < m ? ii + tile : m;
+        for (int jj = 0; jj < n; jj += tile) {
+            int je = jj + tile < n ? jj + tile : n;
+            for (int i = ii; i < ie; i++)
+                for (int j = jj; j < je; j++) t[(size_t)j * m + i] = a[(size_t)i * n + j];
+        }
+    }
+}
+
+inline void matvec(const double *a, const double *x, double *y, int m, int n) {
+    // y = A * x, A: m x n. Four partial sums per row allow vectorization without reassociating a single sum.
+    for (int i = 0; i < m; i++) {
+        const double *ai = a + (size_t)i * n;
+        double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+        int k = 0;
+        for (; k + 4 <= n; k += 4) {
+            s0 += ai[k] * x[k];
+            s1 += ai[k + 1] * x[k + 1];
+            s2 += ai[k + 2] * x[k + 2];
+            s3 += ai[k + 3] * x[k + 3];
+        }
+        for (; k < n; k++) s0 += ai[k] * x[k];
+        y[i] = (s0 + s1) + (s2 + s3);
+    }
+}
+
+inline void outer(const double *x, const double *y, double *c, int m, int n) {
+    // C = x * y^T, C: m x n.
+    for (int i = 0; i < m; i++) {
+        double xi = x[i];
+        double *ci = c + (size_t)i * n;
+        for (int j = 0; j < n; j++) ci[j] = xi * y[j];
+    }
+}
+
+class IlFileStream {
+    // Sequential reader with a fixed size buffer, yields lines (without line end) or chunks of chunk_size bytes.
+    // Memory use is independent of the file size. The file is closed at its end or on destruction.
+  public:
+    static const size_t buffer_size = 65536;
+    size_t chunk_size;  // 0: lines
+    size_t csv_rows;    // > 0: CSV records per chunk
+    char csv_delim;
+    vector<string> csv_names;
+
+    IlFileStream() : chunk_size(0), csv_rows(0), csv_delim(','), fp(nullptr), pos(0), len(0) {
+    }
+    ~IlFileStream() {
+        close();
+    }
+    IlFileStream(const IlFileStream &) = delete;
+    IlFileStream &operator=(const IlFileStream &) = delete;
+
+    bool open(const string &path, size_t chunk) {
+        close();
+        fp = fopen(path.c_str(), "rb");
+        if (!fp) return false;
+        chunk_size = chunk;
+        buf.resize(buffer_size);
+        pos = len = 0;
+        return true;
+    }
+
+    void close() {
+        if (fp) fclose(fp);
+        fp = nullptr;
+        pos = len = 0;
+    }
+
+    bool next_line(string *pl) {
+        // The last line needs no line end, "\r\n" line ends are accepted.
+        pl->clear();
+        bool any = false;
+        while (pos < len || fill()) {
+            any = true;
+            const char *s = buf.data() + pos;
+            const char *e = (const char *)memchr(s, '\n', len - pos);
+            if (e) {
+                pl->append(s, e - s);
+                pos += e - s + 1;
+                if (!pl->empty() && pl->back() == '\r') pl->pop_back();
+                return true;
+            }
+            pl->append(s, len - pos);
+            pos = len;
+        }
+        return any;
+    }
+
+    bool next_records(size_t n, string *ptext) {
+        // Up to n CSV records, a record continues on the next line while it has an open quote.
+        ptext->clear();
+        string line;
+        size_t quotes = 0;
+        while (n > 0 && next_line(&line)) {
+            *ptext += line;
+            *ptext += '\n';
+            quotes += std::count(line.begin(), line.end(), '"');
+            if (quotes % 2 == 0) --n;
+        }
+        return !ptext->empty();
+    }
+
+    bool next_chunk(vector<int> *pv) {
+        // Bytes as INTs 0..255, the last chunk may be shorter.
+        pv->clear();
+        while (pv->size() < chunk_size && (pos < len || fill())) {
+            size_t k = chunk_size - pv->size() < len - pos ? chunk_size - pv->size() : len - pos;
+            const unsigned char *s = (const unsigned char *)buf.data() + pos;
+            pv->insert(pv->end(), s, s + k);
+            pos += k;
+        }
+        return !pv->empty();
+    }
+
+  private:
+    FILE *fp;
+    vector<char> buf;
+    size_t pos, len;
+
+    bool fill() {
+        if (!fp) return false;
+        len = fread(buf.data(), 1, buf.size(), fp);
+        pos = 0;
+        if (len == 0) close();
+        return len > 0;
+    }
+};
+
+class IlAtom;
+class IndraLink;
+typedef std::function<void(IndraLink *, vector<IlAtom> *)> IlInbuilt;  // called with the executing context
+
+class IlFuture;
+class IlChannel;
+class IlGenerator;
+
+class IlAtom {
+  public:
+    ilAtomTypes t;
+    int vi;
+    double vf;
+    string vs;
+    bool vb;
+    vector<int> shape;
+    vector<int> vai;
+    vector<double> vaf;
+    vector<string> vas;
+    vector<bool> vab;
+    string name;
+    IlInbuilt vif;
+    std::shared_ptr<vector<IlAtom>> vq;  // parsed body of a QUOTE { ... }
+    std::shared_ptr<IlArrayExpr> vx;     // pending expression of an ARRAY_VIEW
+    std::shared_ptr<IlFileStream> vfs;   // open file of a FILE_STREAM
+    std::shared_ptr<IlFuture> vfu;       // spawned task of a FUTURE
+    std::shared_ptr<IlChannel> vch;      // queue of a CHANNEL
+    std::shared_ptr<IlGenerator> vgen;   // suspended function of a GENERATOR
+    int jump_address;
+
+    IlAtom() {
+        t = ERROR;
+        vs = "Not-Init";
+    }
+
+    string str() const {
+        string ir;
+        switch (t) {
+        case INT:
+        case FLOAT:
+        case BOOL:
+            return vs;
+            break;
+        case STRING:
+            ir = '"' + vs + '"';
+            replaceAll(ir, "\n", "\\n");
+            return ir;
+            break;
+        case INT_ARRAY:
+            ir = "[ ";
+            for (auto i : vai) {
+                ir += std::to_string(i) + " ";
+            }
+            ir += "]";
+            return ir;
+            break;
+        case FLOAT_ARRAY:
+            ir = "[ ";
+            for (auto f : vaf) {
+                ir += std::to_string(f) + " ";
+            }
+            ir += "]";
+            return ir;
+            break;
+        case BOOL_ARRAY:
+            ir = "[ ";
+            for (auto b : vab) {
+                if (b)
+                    ir += "true ";
+                else
+                    ir += "false ";
+            }
+            ir += "]";
+            return ir;
+            break;
+        case STRING_ARRAY:
+            ir = "[ ";
+            for (auto s : vas) {
+                ir += '"' + s + '"' + " ";
+            }
+            ir += "]";
+            return ir;
+            break;
+        case ARRAY_VIEW:
+            return vx->str();
+            break;
+        case QUOTE:
+        case IFUNC:
+        case FUNC:
+        case SHOW_FUNC:
+        case DELETE_FUNC:
+        case SYMBOL:
+        case STORE_SYMBOL:
+        case DELETE_SYMBOL:
+        case FLOW_CONTROL:
+        case DEF_WORD:
+        case COMMENT:
+            return vs;
+            break;
+        case FILE_STREAM:
+            return "<file-stream: " + vs + ">";
+            break;
+        case FUTURE:
+            return "<future>";
+            break;
+        case CHANNEL:
+            return "<channel>";
+            break;
+        case GENERATOR:
+            return "<generator>";
+            break;
+        case ERROR:
+            return "\n [Error: " + vs + "] ";
+            break;
+        case UNDEFINED:
+            return "<UNDEFINED>";
+        }
+        return "[UNEXPECTED TYPE]";
+    }
+};
+
+inline const char *csv_scan(const char *p, const char *end, char delim) {
+    // First delim, '\n', '\r' or '"' in [p, end), 16 bytes per step with SSE2.
+#ifdef __SSE2__
+    const __m128i vd = _mm_set1_epi8(delim), vn = _mm_set1_epi8('\n'), vr = _mm_set1_epi8('\r'), vq = _mm_set1_epi8('"');
+    while (end - p >= 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)p);
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, vd), _mm_cmpeq_epi8(x, vn)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(x, vr), _mm_cmpeq_epi8(x, vq)));
+        int mask = _mm_movemask_epi8(m);
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    for (; p < end; ++p)
+        if (*p == delim || *p == '\n' || *p == '\r' || *p == '"') return p;
+    return end;
+}
+
+class IlCsvReader {
+    // CSV (RFC 4180: quoted fields with "" escapes, \n or \r\n row ends, blank lines are skipped) into one typed
+    // array per column. Column types are inferred: INT, FLOAT if a cell is a FLOAT or out of INT range, BOOL for
+    // true/false, STRING otherwise or if a cell is quoted. Empty cells are NaN in numeric columns (an INT column
+    // becomes FLOAT). A column that turns out to be STRING after numeric or BOOL cells is re-read as text in a
+    // second pass.
+  public:
+    char delim;
+    vector<string> names;
+    vector<IlAtom> cols;
+    size_t rows;
+    string err;
+
+    explicit IlCsvReader(char delim) : delim(delim), rows(0), est_rows(0) {
+    }
+
+    bool read_header(const char **pp, const char *end) {
+        // Column names from the first non-blank row.
+        names.clear();
+        while (*pp < end && (**pp == '\n' || **pp == '\r')) ++*pp;
+        return scan_row(pp, end, [this](size_t col, const char *s, size_t len, bool quoted) {
+            names.emplace_back(s, len);
+            return true;
+        });
+    }
+
+    bool read(const char *p, const char *end) {
+        // Reads all rows of [p, end) into cols, names must be set.
+        size_t n_cols = names.size();
+        cols.assign(n_cols, IlAtom());
+        state.assign(n_cols, ColState());
+        rows = 0;
+        size_t sample = end - p < 65536 ? end - p : 65536;
+        size_t sample_rows = std::count(p, p + sample, '\n');
+        est_rows = sample_rows ? (size_t)((double)(end - p) / sample * sample_rows * 1.05) + 1 : 0;
+        if (!scan(p, end, false)) return false;
+        bool restring = false;
+        for (auto &st : state) restring = restring || st.restring;
+        if (restring && !scan(p, end, true)) return false;
+        for (size_t c = 0; c < n_cols; c++) {
+            ColState &st = state[c];
+            IlAtom &col = cols[c];
+            switch (st.t) {
+            case INT:
+                col.t = INT_ARRAY;
+                break;
+            case FLOAT:
+                col.t = FLOAT_ARRAY;
+                break;
+            case BOOL:
+                col.t = BOOL_ARRAY;
+                break;
+            case STRING:
+                col.t = STRING_ARRAY;
+                break;
+            default:  // only empty cells
+                col.t = STRING_ARRAY;
+                col.vas.assign(st.pending_empty, "");
+                break;
+            }
+            col.vs = names[c];
+        }
+        return true;
+    }
+
+  private:
+    struct ColState {
+        ilAtomTypes t;
+        size_t pending_empty;  // leading empty cells of a column without type yet
+        bool restring;         // STRING after cells of another type, text is collected by the second pass
+
+        ColState() : t(UNDEFINED), pending_empty(0), restring(false) {
+        }
+    };
+    vector<ColState> state;
+    string quoted_text;
+    size_t est_rows;  // estimated from the first 64k, for reserving the columns
+
+    template <typename F>
+    bool scan_row(const char **pp, const char *end, F cell) {
+        // Calls cell(col, text, len, quoted) for each field of the row at *pp and moves *pp behind its end.
+        const char *p = *pp;
+        size_t col = 0;
+        while (true) {
+            const char *s, *e;
+            bool quoted = false;
+            if (p < end && *p == '"') {
+                quoted = true;
+                quoted_text.clear();
+                ++p;
+                while (true) {
+                    const char *q = (const char *)memchr(p, '"', end - p);
+                    if (!q) {
+                        err = "Csv-unterminated-quote in row " + std::to_string(rows + 1);
+                        return false;
+                    }
+                    quoted_text.append(p, q - p);
+                    p = q + 1;
+                    if (p < end && *p == '"') {
+                        quoted_text += '"';
+                        ++p;
+                    } else {
+                        break;
+                    }
+                }
+                s = quoted_text.data();
+                e = s + quoted_text.size();
+                if (p < end && *p != delim && *p != '\n' && *p != '\r') {
+                    err = "Csv-text-after-quote in row " + std::to_string(rows + 1);
+                    return false;
+                }
+            } else {
+                s = p;
+                p = csv_scan(p, end, delim);
+                while (p < end && *p == '"') p = csv_scan(p + 1, end, delim);  // quote inside a field is text
+                e = p;
+            }
+            if (!cell(col, s, e - s, quoted)) return false;
+            ++col;
+            if (p < end && *p == delim) {
+                ++p;
+                continue;
+            }
+            if (p < end && *p == '\r') ++p;
+            if (p < end && *p == '\n') ++p;
+            break;
+        }
+        *pp = p;
+        return true;
+    }
+
+    bool scan(const char *p, const char *end, bool restring_pass) {
+        size_t n_cols = names.size();
+        rows = 0;
+        while (p < end) {
+            if (*p == '\n' || *p == '\r') {
+                ++p;
+                continue;
+            }
+            size_t n = 0;
+            bool ok = scan_row(&p, end, [&](size_t col, const char *s, size_t len, bool quoted) {
+                if (col >= n_cols) {
+                    err = "Csv-too-many-fields in row " + std::to_string(rows + 1);
+                    return false;
+                }
+                ++n;
+                if (restring_pass) {
+                    if (state[col].restring) cols[col].vas.emplace_back(s, len);
+                } else {
+                    add_cell(col, s, len, quoted);
+                }
+                return true;
+            });
+            if (!ok) return false;
+            for (; n < n_cols; n++)
+                if (restring_pass) {
+                    if (state[n].restring) cols[n].vas.emplace_back();
+                } else {
+                    add_cell(n, "", 0, false);
+                }
+            ++rows;
+        }
+        if (restring_pass)
+            for (auto &st : state) st.restring = false;
+        return true;
+    }
+
+    void to_string_col(size_t col) {
+        ColState &st = state[col];
+        st.t = STRING;
+        st.restring = true;
+        cols[col].vai.clear();
+        cols[col].vaf.clear();
+        cols[col].vab.clear();
+    }
+
+    void add_cell(size_t col, const char *s, size_t len, bool quoted) {
+        ColState &st = state[col];
+        IlAtom &c = cols[col];
+        if (st.t == STRING) {
+            if (!st.restring) c.vas.emplace_back(s, len);
+            return;
+        }
+        if (quoted && st.t != UNDEFINED) {
+            // Quoted fields are text ("123" is not a number)
+            to_string_col(col);
+            return;
+        }
+        const char *ts = s, *te = s + len;
+        while (ts < te && (*ts == ' ' || *ts == '\t')) ++ts;
+        while (te > ts && (te[-1] == ' ' || te[-1] == '\t')) --te;
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+        if (ts == te) {
+            switch (st.t) {
+            case UNDEFINED:
+                ++st.pending_empty;
+                break;
+            case INT:
+                c.vaf.assign(c.vai.begin(), c.vai.end());
+                c.vai.clear();
+                c.vaf.push_back(nan);
+                st.t = FLOAT;
+                break;
+            case FLOAT:
+                c.vaf.push_back(nan);
+                break;
+            default:
+                to_string_col(col);
+                break;
+            }
+            return;
+        }
+        int i = 0;
+        double f = 0.0;
+        ilAtomTypes nt = parse_number(ts, te, &i, &f);
+        if (nt == INT && te - ts > 9) {
+            // may exceed INT range, then the cell is a FLOAT
+            const char *d = ts + (*ts == '-');
+            long long ll = 0;
+            for (const char *q = d; q < te && ll <= std::numeric_limits<int>::max(); q++) ll = ll * 10 + (*q - '0');
+            if (ll > std::numeric_limits<int>::max() + (long long)(d != ts)) {
+                nt = FLOAT;
+                f = strtod(string(ts, te - ts).c_str(), nullptr);
+            }
+        }
+        if (nt == INT) f = i;
+        bool vb = false;
+        if (nt == UNDEFINED) {
+            if (te - ts == 4 && !memcmp(ts, "true", 4)) {
+                nt = BOOL;
+                vb = true;
+            } else if (te - ts == 5 && !memcmp(ts, "false", 5)) {
+                nt = BOOL;
+            } else {
+                nt = STRING;
+            }
+        }
+        if (st.t == UNDEFINED) {
+            if (nt == STRING || quoted) {
+                c.vas.reserve(est_rows);
+                c.vas.assign(st.pending_empty, "");
+                c.vas.emplace_back(s, len);
+                st.t = STRING;
+                return;
+            }
+            if (nt == BOOL && st.pending_empty) {
+                to_string_col(col);
+                return;
+            }
+            st.t = nt == INT && st.pending_empty ? FLOAT : nt;
+            if (st.t == INT) c.vai.reserve(est_rows);
+            if (st.t == FLOAT) {
+                c.vaf.reserve(est_rows);
+                c.vaf.assign(st.pending_empty, nan);
+            }
+            if (st.t == BOOL) c.vab.reserve(est_rows);
+        }
+        switch (st.t) {
+        case INT:
+            if (nt == INT) {
+                c.vai.push_back(i);
+            } else if (nt == FLOAT) {
+                c.vaf.assign(c.vai.begin(), c.vai.end());
+                c.vai.clear();
+                c.vaf.push_back(f);
+                st.t = FLOAT;
+            } else {
+                to_string_col(col);
+            }
+            break;
+        case FLOAT:
+            if (nt == INT || nt == FLOAT)
+                c.vaf.push_back(f);
+            else
+                to_string_col(col);
+            break;
+        case BOOL:
+            if (nt == BOOL)
+                c.vab.push_back(vb);
+            else
+                to_string_col(col);
+            break;
+        default:
+            break;
+        }
+    }
+};
+
+class IlMappedFile {
+    // Read-only contents of a whole file: mmap'd where available (pages are faulted in on access),
+    // read into a buffer otherwise.
+  public:
+    const char *data;
+    size_t size;
+
+    IlMappedFile() : data(nullptr), size(0), mapped(false) {
+    }
+    ~IlMappedFile() {
+        close();
+    }
+    IlMappedFile(const IlMappedFile &) = delete;
+    IlMappedFile &operator=(const IlMappedFile &) = delete;
+
+    bool open(const string &path) {
+        close();
+#ifdef IL_HAVE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+        size = st.st_size;
+        if (size > 0) {
+            void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                data = (const char *)p;
+                mapped = true;
+            }
+        }
+        ::close(fd);
+        if (mapped || size == 0) return true;
+#endif
+        FILE *fp = fopen(path.c_str(), "rb");
+        if (!fp) return false;
+        buf.clear();
+        char chunk[65536];
+        size_t nb;
+        while ((nb = fread(chunk, 1, sizeof(chunk), fp)) > 0) buf.insert(buf.end(), chunk, chunk + nb);
+        fclose(fp);
+        data = buf.data();
+        size = buf.size();
+        return true;
+    }
+
+    void close() {
+#ifdef IL_HAVE_MMAP
+        if (mapped) munmap((void *)data, size);
+#endif
+        mapped = false;
+        buf.clear();
+        data = nullptr;
+        size = 0;
+    }
+
+  private:
+    bool mapped;
+    vector<char> buf;
+};
+
+struct IlImageHeader {
+    // Binary image layout: header, name table (per name uint32 length and bytes, padded to 8 bytes),
+    // constant pool (array payloads, 8 byte aligned), records. Integers are in host byte order.
+    char magic[4];  // "ILBI"
+    uint32_t version;
+    uint32_t byte_order;  // 0x01020304 as written by the host
+    uint32_t n_names;
+    uint32_t n_records;
+    uint32_t kind;  // il_image_library, il_image_snapshot or il_image_delta
+    uint64_t names_size;
+    uint64_t pool_size;
+};
+
+struct IlImageAtom {
+    // Fixed size record of one atom. A function is a DEF_WORD record with the function name and the
+    // number of atoms of its body, the body records follow. A QUOTE record is followed by n records of its body.
+    // A global is a STORE_SYMBOL record with its name, followed by the record of its value. DELETE_FUNC and
+    // DELETE_SYMBOL records name functions and globals deleted since the previous snapshot.
+    uint8_t t;
+    uint8_t vb;
+    uint8_t pad[2];
+    int32_t vi;
+    uint32_t vs;  // name table index of the atom text
+    uint32_t name;
+    uint32_t n;  // array length or number of body records
+    uint32_t reserved;
+    uint64_t data;  // bits of a FLOAT, or constant pool offset of an array payload
+};
+
+static const uint32_t il_image_version = 1;
+static const uint32_t il_image_library = 0;   // functions
+static const uint32_t il_image_snapshot = 1;  // functions and globals, replaces the interpreter state
+static const uint32_t il_image_delta = 2;     // functions and globals changed since the previous snapshot
+
+class IlImageWriter {
+  public:
+    vector<string> names;
+    map<string, uint32_t> name_index;
+    string pool;
+    vector<IlImageAtom> records;
+    uint32_t kind;
+
+    IlImageWriter() : kind(il_image_library) {
+    }
+
+    uint32_t intern(const string &s) {
+        auto it = name_index.find(s);
+        if (it != name_index.end()) return it->second;
+        uint32_t idx = names.size();
+        names.push_back(s);
+        name_index[s] = idx;
+        return idx;
+    }
+
+    uint64_t pool_add(const void *p, size_t n) {
+        uint64_t off = pool.size();
+        pool.append((const char *)p, n);
+        pool.append((8 - pool.size() % 8) % 8, '\0');
+        return off;
+    }
+
+    static bool truncate_file(const string &path, long size) {
+        // Cuts path back to size bytes, without ftruncate by copying the first size bytes to a replacement.
+#ifdef IL_HAVE_MMAP
+        return truncate(path.c_str(), size) == 0;
+#else
+        string tmp = path + ".tmp";
+        FILE *in = fopen(path.c_str(), "rb");
+        FILE *out = in ? fopen(tmp.c_str(), "wb") : nullptr;
+        bool ok = out != nullptr;
+        char buf[65536];
+        for (long left = size; ok && left > 0;) {
+            size_t n = fread(buf, 1, left < (long)sizeof(buf) ? left : sizeof(buf), in);
+            ok = n > 0 && fwrite(buf, 1, n, out) == n;
+            left -= n;
+        }
+        if (in) fclose(in);
+        if (out && fclose(out) != 0) ok = false;
+        if (ok) ok = remove(path.c_str()) == 0 && rename(tmp.c_str(), path.c_str()) == 0;
+        if (!ok) remove(tmp.c_str());
+        return ok;
+#endif
+    }
+
+    bool write(const string &path, string *perr, bool append = false) {
+        // Writes to a temporary file that replaces path when complete, an interrupted write leaves the old image.
+        // With append the image is added to the end of path, a failed append is cut off again, so that later
+        // images aren't hidden behind a torn one (readers stop at an incomplete image).
+        string names_tab;
+        for (const auto &s : names) {
+            uint32_t len = s.size();
+            names_tab.append((const char *)&len, sizeof(len));
+            names_tab += s;
+        }
+        names_tab.append((8 - names_tab.size() % 8) % 8, '\0');
+        IlImageHeader hdr;
+        memcpy(hdr.magic, "ILBI", 4);
+        hdr.version = il_image_version;
+        hdr.byte_order = 0x01020304;
+        hdr.n_names = names.size();
+        hdr.n_records = records.size();
+        hdr.kind = kind;
+        hdr.names_size = names_tab.size();
+        hdr.pool_size = pool.size();
+        string tmp = append ? path : path + ".tmp";
+        FILE *fp = fopen(tmp.c_str(), append ? "ab" : "wb");
+        if (!fp) {
+            *perr = "Cannot-write-image: " + path;
+            return false;
+        }
+        long size = 0;
+        if (append && (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0)) {
+            fclose(fp);
+            *perr = "Cannot-write-image: " + path;
+            return false;
+        }
+        bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 && fwrite(names_tab.data(), 1, names_tab.size(), fp) == names_tab.size() &&
+                  fwrite(pool.data(), 1, pool.size(), fp) == pool.size() &&
+                  fwrite(records.data(), sizeof(IlImageAtom), records.size(), fp) == records.size();
+        if (fclose(fp) != 0) ok = false;
+        if (!ok || (!append && rename(tmp.c_str(), path.c_str()) != 0)) {
+            if (!append) remove(tmp.c_str());
+            if (append && !truncate_file(path, size))
+                *perr = "Image-append-failed-and-left-incomplete: " + path;
+            else
+                *perr = "Cannot-write-image: " + path;
+            return false;
+        }
+        return true;
+    }
+};
+
+class IlImageReader {
+  public:
+    vector<string> names;
+    const char *pool;
+    uint64_t pool_size;
+    const char *records;
+    uint32_t n_records;
+    uint32_t next;  // index of the next record
+    uint32_t kind;
+    uint64_t image_size;  // total size, a further image may follow
+
+    IlImageReader() : pool(nullptr), pool_size(0), records(nullptr), n_records(0), next(0), kind(il_image_library), image_size(0) {
+    }
+
+    static bool is_image(const char *p, size_t n) {
+        return n >= 4 && !memcmp(p, "ILBI", 4);
+    }
+
+    bool open(const char *p, size_t n, string *perr) {
+        // Validates the header and all section sizes and reads the name table, records are read on demand.
+        IlImageHeader hdr;
+        if (!is_image(p, n) || n < sizeof(hdr)) {
+            *perr = "Not-an-image";
+            return false;
+        }
+        memcpy(&hdr, p, sizeof(hdr));
+        if (hdr.byte_order != 0x01020304) {
+            *perr = "Image-byte-order-mismatch";
+            return false;
+        }
+        if (hdr.version != il_image_version) {
+            *perr = "Image-version-unsupported: " + std::to_string(hdr.version);
+            return false;
+        }
+        uint64_t avail = n - sizeof(hdr);
+        if (hdr.names_size > avail || hdr.pool_size > avail - hdr.names_size ||
+            (uint64_t)hdr.n_records * sizeof(IlImageAtom) > avail - hdr.names_size - hdr.pool_size ||
+            (uint64_t)hdr.n_names * sizeof(uint32_t) > hdr.names_size) {
+            *perr = "Image-truncated";
+            return false;
+        }
+        const char *np = p + sizeof(hdr), *ne = np + hdr.names_size;
+        names.clear();
+        names.reserve(hdr.n_names);
+        for (uint32_t i = 0; i < hdr.n_names; i++) {
+            uint32_t len;
+            if (ne - np < (ptrdiff_t)sizeof(len)) {
+                *perr = "Image-corrupt-names";
+                return false;
+            }
+            memcpy(&len, np, sizeof(len));
+            np += sizeof(len);
+            if ((uint64_t)(ne - np) < len) {
+                *perr = "Image-corrupt-names";
+                return false;
+            }
+            names.emplace_back(np, len);
+            np += len;
+        }
+        pool = ne;
+        pool_size = hdr.pool_size;
+        records = pool + pool_size;
+        n_records = hdr.n_records;
+        next = 0;
+        kind = hdr.kind;
+        image_size = sizeof(hdr) + hdr.names_size + hdr.pool_size + (uint64_t)hdr.n_records * sizeof(IlImageAtom);
+        return true;
+    }
+
+    bool read(IlImageAtom *pr) {
+        if (next >= n_records) return false;
+        memcpy(pr, records + (size_t)next * sizeof(IlImageAtom), sizeof(IlImageAtom));
+        ++next;
+        return pr->vs < names.size() && pr->name < names.size();
+    }
+
+    const char *pool_data(const IlImageAtom &r, size_t elem_size) {
+        // Payload of an array record, nullptr if it exceeds the pool.
+        if (r.data > pool_size || (uint64_t)r.n * elem_size > pool_size - r.data) return nullptr;
+        return pool + r.data;
+    }
+};
+
+struct IlArrayFileHeader {
+    // Header of a binary array file, the elements follow at data_offset: little-endian, row-major.
+    char magic[4];  // "ILAR"
+    uint32_t version;
+    char dtype[4];  // "u8", "i8", "u16", "i16", "i32", "f32" or "f64", zero padded
+    uint32_t ndim;  // number of used shape entries, 1..8
+    uint64_t shape[8];
+    uint64_t data_offset;
+    char pad[40];
+};
+
+static const uint32_t il_array_file_version = 1;
+
+class IlOutputSink {
+    // Destination of the interpreter output, write() receives buffered text, flush() is called when the
+    // text should reach the device. Embedders derive their own (ring buffer, UART, log, ...).
+  public:
+    virtual ~IlOutputSink() {}
+    virtual void write(const char *data, size_t len) = 0;
+    virtual void flush() {}
+};
+
+class IlStreamSink : public IlOutputSink {
+  public:
+    std::ostream &os;
+    explicit IlStreamSink(std::ostream &os) : os(os) {}
+    void write(const char *data, size_t len) override {
+        os.write(data, len);
+    }
+    void flush() override {
+        os.flush();
+    }
+};
+
+class IlStringSink : public IlOutputSink {
+  public:
+    string text;  // captured output
+    void write(const char *data, size_t len) override {
+        text.append(data, len);
+    }
+};
+
+class IlLockedSink : public IlOutputSink {
+    // Serializes the output of several interpreters (e.g. scheduler workers) into one sink.
+    std::shared_ptr<IlOutputSink> sink;
+    std::mutex m;
+
+  public:
+    explicit IlLockedSink(std::shared_ptr<IlOutputSink> sink) : sink(sink) {}
+    void write(const char *data, size_t len) override {
+        std::lock_guard<std::mutex> lk(m);
+        sink->write(data, len);
+    }
+    void flush() override {
+        std::lock_guard<std::mutex> lk(m);
+        sink->flush();
+    }
+};
+
+enum IlFlushPolicy {
+    il_flush_eval,    // when eval returns (and when the buffer is full)
+    il_flush_line,    // after each write that contains a newline
+    il_flush_always,  // after each write
+};
+
+class IlOutput {
+    // Buffers the output of print, ss, listvars etc. and passes it on to the sink according to policy.
+    std::shared_ptr<IlOutputSink> sink;
+    string buf;
+
+  public:
+    IlFlushPolicy policy;
+    size_t capacity;  // buffered bytes that are passed to the sink (without a flush) in any case
+
+    IlOutput() : sink(std::make_shared<IlStreamSink>(cout)), policy(il_flush_eval), capacity(4096) {}
+
+    void set_sink(std::shared_ptr<IlOutputSink> new_sink) {
+        // nullptr restores the default sink, cout.
+        flush();
+        sink = new_sink ? new_sink : std::make_shared<IlStreamSink>(cout);
+    }
+
+    std::shared_ptr<IlOutputSink> get_sink() {
+        return sink;
+    }
+
+    void write(const char *data, size_t len) {
+        buf.append(data, len);
+        if (policy == il_flush_always || (policy == il_flush_line && memchr(data, '\n', len))) {
+            flush();
+        } else if (buf.size() >= capacity) {
+            sink->write(buf.data(), buf.size());
+            buf.clear();
+        }
+    }
+
+    IlOutput &operator<<(const string &s) {
+        write(s.data(), s.size());
+        return *this;
+    }
+
+    IlOutput &operator<<(const char *s) {
+        write(s, strlen(s));
+        return *this;
+    }
+
+    void flush() {
+        if (!buf.empty()) {
+            sink->write(buf.data(), buf.size());
+            buf.clear();
+        }
+        sink->flush();
+    }
+};
+
+struct IlImageContents {
+    map<string, vector<IlAtom>> funcs;
+    map<string, IlAtom> symbols;
+    vector<string> deleted_funcs, deleted_symbols;
+};
+
+class IlLocals {
+    // Local variables of a frame: a small table that is searched linearly. Cleared entries keep their name
+    // and string capacity for reuse, so stores into locals of a recycled table don't allocate.
+  public:
+    typedef std::pair<string, IlAtom> Entry;
+
+    IlLocals() : n(0) {
+    }
+
+    IlAtom *find(const string &name) {
+        for (size_t i = 0; i < n; i++) {
+            if (entries[i].first == name) return &entries[i].second;
+        }
+        return nullptr;
+    }
+
+    IlAtom &operator[](const string &name) {
+        if (IlAtom *pa = find(name)) return *pa;
+        if (n == entries.size()) entries.emplace_back();
+        entries[n].first = name;
+        return entries[n++].second;
+    }
+
+    void erase(const string &name) {
+        for (size_t i = 0; i < n; i++) {
+            if (entries[i].first == name) {
+                std::swap(entries[i], entries[n - 1]);
+                release(&entries[--n].second);
+                return;
+            }
+        }
+    }
+
+    void clear() {
+        for (size_t i = 0; i < n; i++) release(&entries[i].second);
+        n = 0;
+    }
+
+    void reserve(size_t size) {
+        entries.reserve(size);
+    }
+
+    size_t size() const {
+        return n;
+    }
+
+    vector<Entry>::const_iterator begin() const {
+        return entries.begin();
+    }
+
+    vector<Entry>::const_iterator end() const {
+        return entries.begin() + n;
+    }
+
+  private:
+    vector<Entry> entries;  // [0, n) are in use
+    size_t n;
+
+    static void release(IlAtom *pa) {
+        // Frees what the value holds, except for the capacity of its strings.
+        pa->t = UNDEFINED;
+        vector<int>().swap(pa->shape);
+        vector<int>().swap(pa->vai);
+        vector<double>().swap(pa->vaf);
+        vector<string>().swap(pa->vas);
+        vector<bool>().swap(pa->vab);
+        pa->vif = nullptr;
+        pa->vq.reset();
+        pa->vx.reset();
+        pa->vfs.reset();
+        pa->vfu.reset();
+        pa->vch.reset();
+        pa->vgen.reset();
+    }
+};
+
+struct IlFrame {
+    // One level of a running evaluation: compiled code, position, locals and the innermost loop kind of
+    // the evaluated code, a called function or an evaluated quote or string.
+    std::shared_ptr<const vector<IlAtom>> owner;  // keeps code alive, unless it belongs to the caller of exec
+    const vector<IlAtom> *code;
+    size_t pc;
+    IlLocals locals;
+    IlLocals *ext_locals;  // the locals of the caller of exec, instead of locals
+    string last_loop;
+    size_t end;  // the frame is done when pc reaches end, the size of code except for a pfor iteration
+
+    explicit IlFrame(std::shared_ptr<const vector<IlAtom>> code) : owner(code), code(code.get()), pc(0), ext_locals(nullptr), end(code->size()) {}
+    IlFrame(const vector<IlAtom> *code, IlLocals *ext_locals) : code(code), pc(0), ext_locals(ext_locals), end(code->size()) {}
+
+    IlLocals &symbols() {
+        return ext_locals ? *ext_locals : locals;
+    }
+};
+
+enum IlRunStatus {
+    il_run_done,
+    il_run_suspended,  // the cycle budget ran out, resume with IndraLink::eval_resume
+    il_run_error,
+};
+
+enum IlSuspendRequest {
+    il_no_suspend,
+    il_suspend_yield,  // yield: back into the ready queue
+    il_suspend_sleep,  // sleep: ready again at IndraLink::wake_at
+    il_suspend_wait,   // wait: ready again when woken by the host (IlScheduler::wake)
+};
+
+class IlFuture {
+    // Result of a spawned task. The task runs once, on a pool worker or in the first join that finds it not
+    // yet started, joins of a running task wait for it.
+  public:
+    std::function<void(IlFuture *)> body;  // runs the task, sets stack, ok and output
+    vector<IlAtom> stack;                  // the values the task left, or its error
+    bool ok;
+
+    IlFuture() : ok(false), state(pending) {}
+
+    void run() {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            if (state != pending) return;
+            state = running;
+        }
+        body(this);
+        body = nullptr;  // releases the context of the task
+        {
+            std::lock_guard<std::mutex> lk(m);
+            state = done;
+        }
+        cv.notify_all();
+    }
+
+    void wait() {
+        run();
+        std::unique_lock<std::mutex> lk(m);
+        cv.wait(lk, [this]() { return state == done; });
+    }
+
+    void set_output(string *ptext) {
+        std::lock_guard<std::mutex> lk(m);
+        output.swap(*ptext);
+    }
+
+    string take_output() {
+        // What the task printed, returned once.
+        std::lock_guard<std::mutex> lk(m);
+        string text;
+        text.swap(output);
+        return text;
+    }
+
+  private:
+    std::mutex m;
+    std::condition_variable cv;
+    enum { pending, running, done } state;
+    string output;
+};
+
+class IlChannel {
+    // Bounded multi-producer multi-consumer queue of atoms for message passing between contexts on different
+    // threads and the host. Lock-free ring buffer with a sequence number per cell (D. Vyukov): a producer
+    // claims a cell by a CAS on tail, a consumer by a CAS on head. Blocking send and recv spin, then yield,
+    // then sleep briefly.
+  public:
+    explicit IlChannel(size_t capacity) : is_closed(false) {
+        size_t n = 1;
+        while (n < capacity) n <<= 1;
+        mask = n - 1;
+        cells.reset(new Cell[n]);
+        for (size_t i = 0; i < n; i++) cells[i].seq.store(i, std::memory_order_relaxed);
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+    size_t size() const {
+        // Number of queued atoms, approximate while other threads use the channel.
+        size_t t = tail.load(std::memory_order_acquire), h = head.load(std::memory_order_acquire);
+        return t > h ? t - h : 0;
+    }
+
+    bool try_send(IlAtom a) {
+        // Queues a, false if the channel is full or closed.
+        if (is_closed.load(std::memory_order_acquire)) return false;
+        size_t pos = tail.load(std::memory_order_relaxed);
+        Cell *pc;
+        while (true) {
+            pc = &cells[pos & mask];
+            size_t seq = pc->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+        pc->value = std::move(a);
+        pc->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_recv(IlAtom *pa) {
+        // Takes the oldest atom, false if the channel is empty.
+        size_t pos = head.load(std::memory_order_relaxed);
+        Cell *pc;
+        while (true) {
+            pc = &cells[pos & mask];
+            size_t seq = pc->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+        *pa = std::move(pc->value);
+        pc->value = IlAtom();  // releases payloads that weren't moved, e.g. of a QUOTE
+        pc->seq.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool send(const IlAtom &a) {
+        // Waits while the channel is full, false if it is closed.
+        for (unsigned n = 0; !try_send(a); n++) {
+            if (closed()) return false;
+            backoff(n);
+        }
+        return true;
+    }
+
+    bool recv(IlAtom *pa) {
+        // Waits while the channel is empty, false if it is closed and empty.
+        for (unsigned n = 0; !try_recv(pa); n++) {
+            if (closed()) return try_recv(pa);  // sent before the close
+            backoff(n);
+        }
+        return true;
+    }
+
+    size_t recv_batch(vector<IlAtom> *pv, size_t max_n) {
+        // Waits for at least one atom (unless closed), then appends up to max_n queued atoms to pv.
+        IlAtom a;
+        if (max_n == 0 || !recv(&a)) return 0;
+        pv->push_back(std::move(a));
+        size_t n = 1;
+        while (n < max_n && try_recv(&a)) {
+            pv->push_back(std::move(a));
+            ++n;
+        }
+        return n;
+    }
+
+    void close() {
+        // Ends sending, receivers get the queued atoms and then fail instead of waiting.
+        is_closed.store(true, std::memory_order_release);
+    }
+
+    bool closed() const {
+        return is_closed.load(std::memory_order_acquire);
+    }
+
+  private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        IlAtom value;
+    };
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    char pad0[64];
+    std::atomic<size_t> head;
+    char pad1[64];
+    std::atomic<size_t> tail;
+    char pad2[64];
+    std::atomic<bool> is_closed;
+
+    static void backoff(unsigned n) {
+        if (n < 64) {
+#ifdef __SSE2__
+            _mm_pause();
+#endif
+        } else if (n < 128) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+};
+
+inline IlAtom channel_atom(std::shared_ptr<IlChannel> ch) {
+    // CHANNEL atom of ch, e.g. for IndraLink::symbols or the initial stack of a task.
+    IlAtom a;
+    a.t = CHANNEL;
+    a.vs = "channel";
+    a.vch = ch;
+    return a;
+}
+
+// IlDType<T>::value: element type of host buffers of T (IndraLink::bind_array).
+template <typename T>
+struct IlDType;
+template <>
+struct IlDType<int32_t> {
+    static const IlArrayExpr::DType value = IlArrayExpr::I32;
+};
+template <>
+struct IlDType<double> {
+    static const IlArrayExpr::DType value = IlArrayExpr::F64;
+};
+template <>
+struct IlDType<uint8_t> {
+    static const IlArrayExpr::DType value = IlArrayExpr::U8;
+};
+template <>
+struct IlDType<int8_t> {
+    static const IlArrayExpr::DType value = IlArrayExpr::I8;
+};
+template <>
+struct IlDType<uint16_t> {
+    static const IlArrayExpr::DType value = IlArrayExpr::U16;
+};
+template <>
+struct IlDType<int16_t> {
+    static const IlArrayExpr::DType value = IlArrayExpr::I16;
+};
+template <>
+struct IlDType<float> {
+    static const IlArrayExpr::DType value = IlArrayExpr::F32;
+};
+
+inline IlAtom host_array_atom(std::shared_ptr<IlHostBuffer> buf, const void *data, size_t n, IlArrayExpr::DType dtype, const vector<int> &shape = vector<int>()) {
+    // ARRAY_VIEW atom on n elements of dtype at data in host memory, guarded by buf. Nothing is copied.
+    auto x = std::make_shared<IlArrayExpr>();
+    x->data = data;
+    x->n = n;
+    x->dtype = dtype;
+    x->t = IlArrayExpr::dtype_array_type(dtype);
+    x->host = buf;
+    IlAtom a;
+    a.t = ARRAY_VIEW;
+    a.vx = x;
+    a.shape = shape;
+    return a;
+}
+
+inline bool is_host_target(const IlAtom &a) {
+    // True for a view on writable host memory that is still bound, stores into it write the memory.
+    return a.t == ARRAY_VIEW && a.vx->steps.empty() && a.vx->host && a.vx->host->writable && !a.vx->host->released;
+}
+
+// Typed host functions (IndraLink::def, il_inbuilt): IlArg<T> takes a parameter of type T from an atom,
+// IlRet<T> makes the atom of a result of type T. Parameters: int, double (also from INT), bool, string,
+// vector<int>, vector<double> (also from INT_ARRAY), vector<bool>, vector<string> and IlAtom (any value).
+// Results: the same types (an IlAtom can be an ERROR) or void.
+template <typename T>
+struct IlArg;
+
+template <>
+struct IlArg<int> {
+    static bool accepts(const IlAtom &a) { return a.t == INT; }
+    static bool exact(const IlAtom &a) { return a.t == INT; }
+    static int take(IlAtom &a) { return a.vi; }
+    static const char *type_name() { return "INT"; }
+};
+
+template <>
+struct IlArg<double> {
+    static bool accepts(const IlAtom &a) { return a.t == FLOAT || a.t == INT; }
+    static bool exact(const IlAtom &a) { return a.t == FLOAT; }
+    static double take(IlAtom &a) { return a.t == FLOAT ? a.vf : (double)a.vi; }
+    static const char *type_name() { return "FLOAT"; }
+};
+
+template <>
+struct IlArg<bool> {
+    static bool accepts(const IlAtom &a) { return a.t == BOOL; }
+    static bool exact(const IlAtom &a) { return a.t == BOOL; }
+    static bool take(IlAtom &a) { return a.vb; }
+    static const char *type_name() { return "BOOL"; }
+};
+
+template <>
+struct IlArg<string> {
+    static bool accepts(const IlAtom &a) { return a.t == STRING; }
+    static bool exact(const IlAtom &a) { return a.t == STRING; }
+    static string take(IlAtom &a) { return std::move(a.vs); }
+    static const char *type_name() { return "STRING"; }
+};
+
+template <>
+struct IlArg<vector<int>> {
+    static bool accepts(const IlAtom &a) { return a.t == INT_ARRAY; }
+    static bool exact(const IlAtom &a) { return a.t == INT_ARRAY; }
+    static vector<int> take(IlAtom &a) { return std::move(a.vai); }
+    static const char *type_name() { return "INT_ARRAY"; }
+};
+
+template <>
+struct IlArg<vector<double>> {
+    static bool accepts(const IlAtom &a) { return a.t == FLOAT_ARRAY || a.t == INT_ARRAY; }
+    static bool exact(const IlAtom &a) { return a.t == FLOAT_ARRAY; }
+    static vector<double> take(IlAtom &a) { return a.t == FLOAT_ARRAY ? std::move(a.vaf) : vector<double>(a.vai.begin(), a.vai.end()); }
+    static const char *type_name() { return "FLOAT_ARRAY"; }
+};
+
+template <>
+struct IlArg<vector<bool>> {
+    static bool accepts(const IlAtom &a) { return a.t == BOOL_ARRAY; }
+    static bool exact(const IlAtom &a) { return a.t == BOOL_ARRAY; }
+    static vector<bool> take(IlAtom &a) { return std::move(a.vab); }
+    static const char *type_name() { return "BOOL_ARRAY"; }
+};
+
+template <>
+struct IlArg<vector<string>> {
+    static bool accepts(const IlAtom &a) { return a.t == STRING_ARRAY; }
+    static bool exact(const IlAtom &a) { return a.t == STRING_ARRAY; }
+    static vector<string> take(IlAtom &a) { return std::move(a.vas); }
+    static const char *type_name() { return "STRING_ARRAY"; }
+};
+
+template <>
+struct IlArg<IlAtom> {
+    static bool accepts(const IlAtom &a) { return true; }
+    static bool exact(const IlAtom &a) { return false; }
+    static IlAtom take(IlAtom &a) { return std::move(a); }
+    static const char *type_name() { return "any"; }
+};
+
+template <typename T>
+struct IlRet;
+
+template <>
+struct IlRet<int> {
+    static IlAtom make(int v) {
+        IlAtom a;
+        a.t = INT;
+        a.vi = v;
+        a.vs = std::to_string(v);
+        return a;
+    }
+};
+
+template <>
+struct IlRet<double> {
+    static IlAtom make(double v) {
+        IlAtom a;
+        a.t = FLOAT;
+        a.vf = v;
+        a.vs = std::to_string(v);
+        return a;
+    }
+};
+
+template <>
+struct IlRet<bool> {
+    static IlAtom make(bool v) {
+        IlAtom a;
+        a.t = BOOL;
+        a.vb = v;
+        a.vs = v ? "true" : "false";
+        return a;
+    }
+};
+
+template <>
+struct IlRet<string> {
+    static IlAtom make(string v) {
+        IlAtom a;
+        a.t = STRING;
+        a.vs = std::move(v);
+        return a;
+    }
+};
+
+template <>
+struct IlRet<vector<int>> {
+    static IlAtom make(vector<int> v) {
+        IlAtom a;
+        a.t = INT_ARRAY;
+        a.vai = std::move(v);
+        return a;
+    }
+};
+
+template <>
+struct IlRet<vector<double>> {
+    static IlAtom make(vector<double> v) {
+        IlAtom a;
+        a.t = FLOAT_ARRAY;
+        a.vaf = std::move(v);
+        return a;
+    }
+};
+
+template <>
+struct IlRet<vector<bool>> {
+    static IlAtom make(vector<bool> v) {
+        IlAtom a;
+        a.t = BOOL_ARRAY;
+        a.vab = std::move(v);
+        return a;
+    }
+};
+
+template <>
+struct IlRet<vector<string>> {
+    static IlAtom make(vector<string> v) {
+        IlAtom a;
+        a.t = STRING_ARRAY;
+        a.vas = std::move(v);
+        return a;
+    }
+};
+
+template <>
+struct IlRet<IlAtom> {
+    static IlAtom make(IlAtom v) { return v; }
+};
+
+template <size_t... I>
+struct IlIndices {};
+
+template <size_t N, size_t... I>
+struct IlMakeIndices : IlMakeIndices<N - 1, N - 1, I...> {};
+
+template <size_t... I>
+struct IlMakeIndices<0, I...> {
+    typedef IlIndices<I...> type;
+};
+
+template <typename R>
+struct IlInvoke {
+    template <typename F, typename... T>
+    static void call(F &f, size_t base, vector<IlAtom> *pst, T &&...args) {
+        IlAtom res = IlRet<typename std::decay<R>::type>::make(f(std::forward<T>(args)...));
+        pst->resize(base);
+        pst->push_back(std::move(res));
+    }
+};
+
+template <>
+struct IlInvoke<void> {
+    template <typename F, typename... T>
+    static void call(F &f, size_t base, vector<IlAtom> *pst, T &&...args) {
+        f(std::forward<T>(args)...);
+        pst->resize(base);
+    }
+};
+
+template <typename R, typename... A>
+struct IlSignature {
+    static const size_t arity = sizeof...(A);
+
+    template <typename F>
+    static bool call(F &f, vector<IlAtom> *pst, bool exact) {
+        return call_at(f, pst, exact, typename IlMakeIndices<sizeof...(A)>::type());
+    }
+
+    template <typename F, size_t... I>
+    static bool call_at(F &f, vector<IlAtom> *pst, bool exact, IlIndices<I...>) {
+        // Checks the types of the arguments on the stack, calls f with them (moved) and replaces them by the
+        // result. false (stack unchanged) if the types don't match, with exact also if one would be converted
+        // (INT for double) or is taken as IlAtom.
+        if (pst->size() < sizeof...(A)) return false;
+        size_t base = pst->size() - sizeof...(A);
+        bool match[] = {true, (exact ? IlArg<typename std::decay<A>::type>::exact((*pst)[base + I])
+                                     : IlArg<typename std::decay<A>::type>::accepts((*pst)[base + I]))...};
+        for (bool m : match) {
+            if (!m) return false;
+        }
+        IlInvoke<R>::call(f, base, pst, IlArg<typename std::decay<A>::type>::take((*pst)[base + I])...);
+        return true;
+    }
+
+    static string signature() {
+        const char *names[] = {"", IlArg<typename std::decay<A>::type>::type_name()...};
+        string sig;
+        for (size_t i = 1; i <= sizeof...(A); i++) sig += string(i > 1 ? ", " : "") + names[i];
+        return sig;
+    }
+};
+
+template <typename F>
+struct IlFnTraits : IlFnTraits<decltype(&F::operator())> {};  // lambdas and function objects
+
+template <typename R, typename... A>
+struct IlFnTraits<R (*)(A...)> : IlSignature<R, A...> {};
+
+template <typename R, typename C, typename... A>
+struct IlFnTraits<R (C::*)(A...) const> : IlSignature<R, A...> {};
+
+template <typename R, typename C, typename... A>
+struct IlFnTraits<R (C::*)(A...)> : IlSignature<R, A...> {};
+
+struct IlNativeOverload {
+    std::function<bool(vector<IlAtom> *, bool)> call;  // false if the arguments on the stack don't match (exactly)
+    size_t arity;
+    string signature;
+};
+
+struct IlNativeSet {
+    // The overloads of a typed host function, tried in order, first for an exact match of the argument types,
+    // then with conversions. Then the inbuilt it replaced (if any).
+    vector<IlNativeOverload> overloads;
+    IlInbuilt fallback;
+};
+
+template <typename F>
+IlNativeOverload il_native_overload(F f) {
+    IlNativeOverload ov;
+    ov.call = [f](vector<IlAtom> *pst, bool exact) mutable { return IlFnTraits<F>::call(f, pst, exact); };
+    ov.arity = IlFnTraits<F>::arity;
+    ov.signature = IlFnTraits<F>::signature();
+    return ov;
+}
+
+inline bool il_force_views(IndraLink *il, vector<IlAtom> *pst, size_t depth);
+
+inline IlInbuilt il_native_inbuilt(const string &name, std::shared_ptr<const IlNativeSet> ns) {
+    // The inbuilt that dispatches to the overloads of ns by the types on the stack.
+    size_t min_arity = std::numeric_limits<size_t>::max(), max_arity = 0;
+    for (const auto &ov : ns->overloads) {
+        min_arity = std::min(min_arity, ov.arity);
+        max_arity = std::max(max_arity, ov.arity);
+    }
+    return [name, ns, min_arity, max_arity](IndraLink *il, vector<IlAtom> *pst) {
+        if (!il_force_views(il, pst, max_arity)) return;  // lazy array arguments, beyond those run() forces
+        for (const auto &ov : ns->overloads)
+            if (ov.call(pst, true)) return;
+        for (const auto &ov : ns->overloads)
+            if (ov.call(pst, false)) return;
+        if (ns->fallback) {
+            ns->fallback(il, pst);
+            return;
+        }
+        IlAtom err;
+        err.t = ERROR;
+        if (pst->size() < min_arity) {
+            err.vs = "Stack-Underflow " + name;
+        } else {
+            err.vs = name + " requires ";
+            for (size_t i = 0; i < ns->overloads.size(); i++) err.vs += (i ? " or " : "") + ns->overloads[i].signature;
+        }
+        pst->push_back(err);
+    };
+}
+
+template <typename F>
+IlInbuilt il_inbuilt(const string &name, F f) {
+    // Inbuilt for the typed function f: its arguments are taken from the stack by the parameter types of
+    // f (the last parameter from the top of the stack), the result is pushed.
+    auto ns = std::make_shared<IlNativeSet>();
+    ns->overloads.push_back(il_native_overload(f));
+    return il_native_inbuilt(name, ns);
+}
+
+class IlContinuation {
+    // A resumable evaluation: all of its state is in the frames, the data stack is passed to each resume.
+  public:
+    vector<IlFrame> frames;  // innermost last, empty when done
+    bool generator;          // the frames of an IlGenerator, yield suspends the run
+    size_t stack_low;        // of a generator: lowest stack size after an instruction, see start_generator
+    bool retry;              // set by an inbuilt that suspends to be run again, see IndraLink::suspend_for_retry
+    vector<IlLocals> spare;  // locals of popped frames, reused by pushed frames
+
+    IlContinuation() : generator(false), stack_low(0), retry(false) {}
+
+    bool done() const {
+        return frames.empty();
+    }
+
+    void push(std::shared_ptr<const vector<IlAtom>> code) {
+        frames.push_back(IlFrame(code));
+        if (!spare.empty()) {
+            std::swap(frames.back().locals, spare.back());
+            spare.pop_back();
+        }
+    }
+
+    void pop() {
+        IlLocals &locals = frames.back().locals;
+        locals.clear();
+        spare.push_back(IlLocals());
+        std::swap(spare.back(), locals);
+        frames.pop_back();
+    }
+
+    void clear() {
+        while (!frames.empty()) pop();
+    }
+
+    void reserve(size_t depth, size_t n_locals) {
+        // Storage for depth frames with n_locals locals each.
+        frames.reserve(depth);
+        spare.reserve(depth);
+        while (spare.size() < depth) {
+            spare.push_back(IlLocals());
+            spare.back().reserve(n_locals);
+        }
+    }
+};
+
+class IlFunction {
+    // Handle of a compiled script function, see IndraLink::function. It keeps the version of the function
+    // it was made from, until it is made again.
+  public:
+    string name;
+    std::shared_ptr<const vector<IlAtom>> code;  // nullptr: no such function
+
+    explicit operator bool() const {
+        return code != nullptr;
+    }
+};
+
+class IlExecContext {
+    // Reusable state for IndraLink::call: the data stack, the frames and their locals keep their storage
+    // from call to call, so that steady state calls don't allocate.
+  public:
+    vector<IlAtom> stack;
+    IlContinuation k;
+
+    explicit IlExecContext(size_t stack_size = 64, size_t depth = 16, size_t n_locals = 8) {
+        stack.reserve(stack_size);
+        k.reserve(depth, n_locals);
+    }
+};
+
+class IlGenerator {
+    // A generator function called before 'for', resumed by the loop up to its next yield for each value.
+  public:
+    IlContinuation k;
+    vector<IlAtom> stack;  // private stack of the generator, a yielded value is on top
+    bool ready;            // the value on top hasn't been taken yet
+
+    IlGenerator() : ready(false) {
+        k.generator = true;
+    }
+};
+
+class IlLibrary {
+    // Functions and inbuilts of a script library, immutable once published: any number of IndraLink
+    // contexts, also on different threads, can use one library concurrently. See IndraLink::make_library.
+  public:
+    map<string, vector<IlAtom>> funcs;
+    map<string, IlInbuilt> inbuilts;
+    std::set<string> late_bound;  // see IndraLink::late_bound
+};
+
+class IlLibrarySlot {
+    // The current version of a library: publish() replaces it atomically, contexts fetch it with get() (e.g.
+    // per request), a context keeps the version it got until it fetches again.
+    std::shared_ptr<const IlLibrary> lib;
+
+  public:
+    std::shared_ptr<const IlLibrary> get() const {
+        return std::atomic_load(&lib);
+    }
+
+    void publish(std::shared_ptr<const IlLibrary> new_lib) {
+        std::atomic_store(&lib, new_lib);
+    }
+};
+
+class IndraLink {
+  public:
+    vector<IlAtom> stack;
+    map<string, IlAtom> symbols;
+    map<string, vector<IlAtom>> funcs;
+    map<string, IlInbuilt> inbuilts;
+    std::shared_ptr<const IlLibrary> library;  // shared functions and inbuilts, looked up after funcs and inbuilts
+    vector<string> flow_control_words, def_words;
+    vector<string> view_inbuilts;  // inbuilts that accept ARRAY_VIEW operands without forcing them
+    bool lazy_arrays;
+    bool host_arrays;  // set by bind_array, globals may be views on writable host memory
+    vector<string> pure_inbuilts;  // inbuilts that only work on the stack, allowed in concurrently run quotes
+    unsigned int threads;          // < 2: serial execution
+    size_t par_threshold;          // minimum number of array elements for concurrent execution
+    std::shared_ptr<IlThreadPool> pool;
+    static const size_t quote_chunk_size = 1024;
+    bool track_changes;  // set by snapshot and restore, changes are recorded for snapshotinc
+    std::set<string> changed_funcs, changed_symbols;
+    IlOutput out;  // all output of the interpreter, see set_sink and policy
+    int eval_depth;  // nesting of eval (function calls), output is flushed when the outermost eval returns
+    size_t eval_cache_capacity;  // max. number of entries in the cache of compiled eval strings, 0: no caching
+    size_t eval_cache_hits, eval_cache_misses;
+    std::list<std::pair<string, std::shared_ptr<const vector<IlAtom>>>> eval_cache;  // most recently used first
+    std::unordered_map<string, decltype(eval_cache)::iterator> eval_cache_index;
+    bool parse_reads_globals;  // set by parse if an array literal referenced a global, such code isn't cached
+    map<string, std::shared_ptr<const vector<IlAtom>>> compiled_funcs;  // compiled function bodies, see func_code
+    std::set<string> late_bound;  // inbuilt names shadowed by a function or replaced by def, see bind_names
+    bool cooperative;                          // run as a task by an IlScheduler: yield, sleep and wait suspend the task
+    IlSuspendRequest suspend_request;          // set by yield, sleep and wait of a task, read by the scheduler
+    IlContinuation *retry_run;                 // the run with a budget whose inbuilt is running, nullptr in nested runs
+    std::deque<std::weak_ptr<IlFuture>> deferred_tasks;  // spawned with threads < 2, not yet run
+    std::chrono::steady_clock::time_point wake_at;  // end of a sleep
+    const map<string, IlAtom> *global_view;  // read-only globals of a spawned task or pfor iteration, instead of symbols
+    std::shared_ptr<const map<string, IlAtom>> globals_snapshot;  // copy of symbols for spawn, until globals change
+    IlContinuation eval_k;                                            // frames of the outermost eval, reused
+    std::shared_ptr<vector<IlAtom>> eval_buf;                         // compiled code of the outermost eval, reused
+    std::shared_ptr<const IlLibrary> task_library;  // make_library() for spawn and pfor, until functions change
+    map<string, std::shared_ptr<const IlNativeSet>> natives;  // typed host functions, see def
+
+    void math_2ops(vector<IlAtom> *pst, string ops2) {
+        size_t l = pst->size();
+        if (l < 2) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Math-" + ops2 + "-Not-Enough-Operands";
+            pst->push_back(err);
+            return;
+        }
+        ilAtomTypes t1, t2;
+        IlAtom res, op1, op2;
+        op2 = pst->back();
+        pst->pop_back();
+        op1 = pst->back();
+        pst->pop_back();
+        t2 = op2.t;
+        t1 = op1.t;
+        if (is_numeric_array(op1) || is_numeric_array(op2)) {
+            array_2ops(pst, op1, op2, ops2);
+            return;
+        }
+
+        if ((t1 != INT && t1 != FLOAT) || (t2 != INT && t2 != FLOAT)) {
+            if (t1 == STRING && t2 == STRING && ops2 == "+") {
+                res.t = STRING;
+                res.vs = op1.vs + op2.vs;
+            } else if (t1 == STRING && t2 == INT && op2.vi >= 0 && ops2 == "*") {
+                res.t = STRING;
+                res.vs = "";
+                for (auto i = 0; i < op2.vi; i++)
+                    res.vs += op1.vs;
+            } else {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "Math-" + ops2 + "-Wrong-Type-Operands";
+                pst->push_back(err);
+                return;
+            }
+            pst->push_back(res);
+            return;
+        }
+
+        if (t1 == INT && t2 == INT) {
+            int o1, o2;
+            o1 = op1.vi;
+            o2 = op2.vi;
+            res.t = INT;
+            if (ops2 == "+")
+                res.vi = o1 + o2;
+            else if (ops2 == "-")
+                res.vi = o1 - o2;
+            else if (ops2 == "*")
+                res.vi = o1 * o2;
+            else if (ops2 == "/") {
+                if (o2 == 0) {
+                    IlAtom err;
+                    err.t = ERROR;
+                    err.vs = "/-by-Zero";
+                    pst->push_back(err);
+                    return;
+                }
+                res.vi = o1 / o2;
+            } else if (ops2 == "%") {
+                if (o2 == 0) {
+                    IlAtom err;
+                    err.t = ERROR;
+                    err.vs = "/-by-Zero";
+                    pst->push_back(err);
+                    return;
+                }
+                res.vi = o1 % o2;
+            } else {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "Math-" + ops2 + "Unknown op-code";
+                pst->push_back(err);
+                return;
+            }
+            res.vs = std::to_string(res.vi);
+        } else {
+            double o1, o2;
+            if (t1 == INT)
+                o1 = (double)op1.vi;
+            else
+                o1 = op1.vf;
+            if (t2 == INT)
+                o2 = (double)op2.vi;
+            else
+                o2 = op2.vf;
+            res.t = FLOAT;
+            if (ops2 == "+")
+                res.vf = o1 + o2;
+            else if (ops2 == "-")
+                res.vf = o1 - o2;
+            else if (ops2 == "*")
+                res.vf = o1 * o2;
+            else if (ops2 == "/") {
+                if (o2 == 0.0) {
+                    IlAtom err;
+                    err.t = ERROR;
+                    err.vs = "/-by-Zero";
+                    pst->push_back(err);
+                    return;
+                }
+                res.vf = o1 / o2;
+            } else {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "Unknown math-2ops: " + ops2;
+                pst->push_back(err);
+                return;
+            }
+            res.vs = std::to_string(res.vf);
+        }
+        pst->push_back(res);
+    }
+
+    void
+    cmp_2ops(vector<IlAtom> *pst, string ops2) {
+        size_t l = pst->size();
+        if (l < 2) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "CMP-Not-Enough-Operands";
+            pst->push_back(err);
+            return;
+        }
+        ilAtomTypes t1, t2;
+        IlAtom res, op1, op2;
+        op2 = pst->back();
+        pst->pop_back();
+        op1 = pst->back();
+        pst->pop_back();
+        t2 = op2.t;
+        t1 = op1.t;
+        if (is_numeric_array(op1) || is_numeric_array(op2)) {
+            array_2ops(pst, op1, op2, ops2);
+            return;
+        }
+
+        if ((t1 != INT && t1 != FLOAT) || (t2 != INT && t2 != FLOAT)) {
+            if (t1 == BOOL && t2 == BOOL) {
+                res.t = BOOL;
+                if (ops2 == "==") {
+                    res.vb = (op1.vb == op2.vb);
+                } else if (ops2 == "!=") {
+                    res.vb = (op1.vb != op2.vb);
+                } else {
+                    IlAtom err;
+                    err.t = ERROR;
+                    err.vs = "BOOL-Cmp-" + ops2 + "-Wrong-Type-Operands";
+                    pst->push_back(err);
+                    return;
+                }
+            } else if (t1 == STRING && t2 == STRING) {
+                res.t = BOOL;
+                if (ops2 == "==") {
+                    res.vb = (op1.vs == op2.vs);
+                } else if (ops2 == "!=") {
+                    res.vb = (op1.vs != op2.vs);
+                } else if (ops2 == ">=") {
+                    res.vb = (op1.vs >= op2.vs);
+                } else if (ops2 == "<=") {
+                    res.vb = (op1.vs <= op2.vs);
+                } else if (ops2 == "<") {
+                    res.vb = (op1.vs < op2.vs);
+                } else if (ops2 == ">") {
+                    res.vb = (op1.vs > op2.vs);
+                } else {
+                    IlAtom err;
+                    err.t = ERROR;
+                    err.vs = "BOOL-Cmp-" + ops2 + "-Wrong-Type-Operands";
+                    pst->push_back(err);
+                    return;
+                }
+            } else {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "Math-" + ops2 + "-Wrong-Type-Operands";
+                pst->push_back(err);
+                return;
+            }
+        } else {
+            if (t1 == INT && t2 == INT) {
+                res.t = BOOL;
+                if (ops2 == "==") {
+                    res.vb = (op1.vi == op2.vi);
+                } else if (ops2 == "!=") {
+                    res.vb = (op1.vi != op2.vi);
+                } else if (ops2 == ">=") {
+                    res.vb = (op1.vi >= op2.vi);
+                } else if (ops2 == "<=") {
+                    res.vb = (op1.vi <= op2.vi);
+                } else if (ops2 == "<") {
+                    res.vb = (op1.vi < op2.vi);
+                } else if (ops2 == ">") {
+                    res.vb = (op1.vi > op2.vi);
+                } else {
+                    IlAtom err;
+                    err.t = ERROR;
+                    err.vs = "INT-Cmp-" + ops2 + "-Wrong-Type-Operands";
+                    pst->push_back(err);
+                    return;
+                }
+            } else {
+                res.t = BOOL;
+                double o1, o2;
+                if (op1.t == INT)
+                    o1 = op1.vi;
+                else
+                    o1 = op1.vf;
+                if (op2.t == INT)
+                    o2 = op2.vi;
+                else
+                    o2 = op2.vf;
+                if (ops2 == "==") {
+                    res.vb = (o1 == o2);
+                } else if (ops2 == "!=") {
+                    res.vb = (o1 != o2);
+                } else if (ops2 == ">=") {
+                    res.vb = (o1 >= o2);
+                } else if (ops2 == "<=") {
+                    res.vb = (o1 <= o2);
+                } else if (ops2 == "<") {
+                    res.vb = (o1 < o2);
+                } else if (ops2 == ">") {
+                    res.vb = (o1 > o2);
+                } else {
+                    IlAtom err;
+                    err.t = ERROR;
+                    err.vs = "FLOAT-Cmp-" + ops2 + "-Wrong-Type-Operands";
+                    pst->push_back(err);
+                    return;
+                }
+            }
+        }
+        if (res.vb)
+            res.vs = "true";
+        else
+            res.vs = "false";
+        pst->push_back(res);
+    }
+
+    void bool_2ops(vector<IlAtom> *pst, string ops2) {
+        size_t l = pst->size();
+        if (l < 2) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Bool-Not-Enough-Operands";
+            pst->push_back(err);
+            return;
+        }
+        ilAtomTypes t1, t2;
+        IlAtom res, op1, op2;
+        op2 = pst->back();
+        pst->pop_back();
+        op1 = pst->back();
+        pst->pop_back();
+        t2 = op2.t;
+        t1 = op1.t;
+        if (is_numeric_array(op1) || is_numeric_array(op2)) {
+            array_2ops(pst, op1, op2, ops2);
+            return;
+        }
+
+        if ((t1 != INT && t1 != BOOL) || (t2 != INT && t2 != BOOL)) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Bool-requires-int-or-bool-Operands";
+            pst->push_back(err);
+            return;
+        }
+        bool b1, b2;
+        if (t1 == BOOL)
+            b1 = op1.vb;
+        else {
+            if (op1.vi == 0)
+                b1 = false;
+            else
+                b1 = true;
+        }
+        if (t2 == BOOL)
+            b2 = op2.vb;
+        else {
+            if (op2.vi == 0)
+                b2 = false;
+            else
+                b2 = true;
+        }
+        res.t = BOOL;
+        if (ops2 == "and")
+            res.vb = (b1 && b2);
+        else if (ops2 == "or")
+            res.vb = (b1 || b2);
+        if (res.vb)
+            res.vs = "true";
+        else
+            res.vs = "false";
+        pst->push_back(res);
+    }
+
+    bool is_numeric_array(const IlAtom &a) {
+        return a.t == INT_ARRAY || a.t == FLOAT_ARRAY || a.t == BOOL_ARRAY || a.t == ARRAY_VIEW;
+    }
+
+    ilAtomTypes numeric_elem_type(const IlAtom &a) {
+        // Element type of a numeric array, or type of a numeric scalar, UNDEFINED otherwise.
+        ilAtomTypes t = a.t;
+        if (t == ARRAY_VIEW) t = a.vx->t;
+        switch (t) {
+        case INT:
+        case INT_ARRAY:
+            return INT;
+        case FLOAT:
+        case FLOAT_ARRAY:
+            return FLOAT;
+        case BOOL:
+        case BOOL_ARRAY:
+            return BOOL;
+        default:
+            return UNDEFINED;
+        }
+    }
+
+    double numeric_value(const IlAtom &a) {
+        if (a.t == INT) return (double)a.vi;
+        if (a.t == BOOL) return a.vb ? 1.0 : 0.0;
+        return a.vf;
+    }
+
+    size_t numeric_array_size(const IlAtom &a) {
+        if (a.t == ARRAY_VIEW) return a.vx->n;
+        return array_size(a);
+    }
+
+    std::shared_ptr<IlArrayExpr> to_expr(IlAtom &a) {
+        // Wraps a numeric array into an expression, the array payload is moved, not copied.
+        if (a.t == ARRAY_VIEW) return a.vx;
+        auto x = std::make_shared<IlArrayExpr>();
+        x->t = a.t;
+        if (a.t == FLOAT_ARRAY) {
+            auto pv = std::make_shared<vector<double>>(std::move(a.vaf));
+            x->data = pv->data();
+            x->n = pv->size();
+            x->dtype = IlArrayExpr::F64;
+            x->owner = pv;
+        } else {
+            std::shared_ptr<vector<int>> pv;
+            if (a.t == INT_ARRAY)
+                pv = std::make_shared<vector<int>>(std::move(a.vai));
+            else
+                pv = std::make_shared<vector<int>>(a.vab.begin(), a.vab.end());
+            x->data = pv->data();
+            x->n = pv->size();
+            x->dtype = IlArrayExpr::I32;
+            x->owner = pv;
+        }
+        return x;
+    }
+
+    bool force_view(IlAtom *pa) {
+        // Materializes an ARRAY_VIEW into a plain array, on evaluation error the atom becomes an ERROR.
+        if (pa->t != ARRAY_VIEW) return true;
+        std::shared_ptr<IlArrayExpr> x = pa->vx;
+        pa->vx.reset();
+        IlArrayExpr::Status status = x->materialize(&pa->vai, &pa->vaf, &pa->vab, par_pool(x->n));
+        if (status != IlArrayExpr::OK) {
+            pa->t = ERROR;
+            pa->vs = IlArrayExpr::status_str(status);
+            return false;
+        }
+        pa->t = x->t;
+        return true;
+    }
+
+    bool has_views(vector<IlAtom> *pst, size_t depth = 3) {
+        size_t l = pst->size();
+        for (size_t i = l > depth ? l - depth : 0; i < l; i++)
+            if ((*pst)[i].t == ARRAY_VIEW) return true;
+        return false;
+    }
+
+    bool force_views(vector<IlAtom> *pst, size_t depth = 3) {
+        // Materializes the ARRAY_VIEWs within the topmost depth stack entries.
+        size_t l = pst->size();
+        for (size_t i = l > depth ? l - depth : 0; i < l; i++) {
+            if (!force_view(&(*pst)[i])) {
+                IlAtom err = (*pst)[i];
+                pst->erase(pst->begin() + i);
+                pst->push_back(err);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool store_host_array(const IlAtom &dst, IlAtom *pa) {
+        // Evaluates the numeric array *pa into the host memory of the view dst, converted to its dtype.
+        // On error *pa becomes the ERROR.
+        size_t n = dst.vx->n;
+        if (!is_numeric_array(*pa) || numeric_array_size(*pa) != n) {
+            pa->t = ERROR;
+            pa->vs = "Host-array-store-requires-numeric-array-of-size " + std::to_string(n);
+            return false;
+        }
+        if (pa->t == ARRAY_VIEW && pa->vx == dst.vx) return true;
+        std::shared_ptr<IlArrayExpr> x = to_expr(*pa);
+        IlArrayExpr::Status status = x->store((void *)dst.vx->data, dst.vx->dtype, par_pool(n));
+        if (status != IlArrayExpr::OK) {
+            pa->t = ERROR;
+            pa->vs = IlArrayExpr::status_str(status);
+            return false;
+        }
+        return true;
+    }
+
+    bool is_view_inbuilt(const string &name) {
+        if (std::find(view_inbuilts.begin(), view_inbuilts.end(), name) == view_inbuilts.end()) return false;
+        return true;
+    }
+
+    void array_2ops(vector<IlAtom> *pst, IlAtom &op1, IlAtom &op2, string ops2) {
+        // Element-wise math, compare and bool ops with at least one array operand, result is a lazy ARRAY_VIEW.
+        IlArrayExpr::Op op;
+        int kind = 0;  // 0: math, 1: compare, 2: bool
+        if (ops2 == "+")
+            op = IlArrayExpr::ADD;
+        else if (ops2 == "-")
+            op = IlArrayExpr::SUB;
+        else if (ops2 == "*")
+            op = IlArrayExpr::MUL;
+        else if (ops2 == "/")
+            op = IlArrayExpr::DIV;
+        else if (ops2 == "%")
+            op = IlArrayExpr::MOD;
+        else if (ops2 == "pow")
+            op = IlArrayExpr::POW;
+        else if (ops2 == "atan2")
+            op = IlArrayExpr::ATAN2;
+        else if (ops2 == "min2")
+            op = IlArrayExpr::MIN2;
+        else if (ops2 == "max2")
+            op = IlArrayExpr::MAX2;
+        else {
+            kind = 1;
+            if (ops2 == "==")
+                op = IlArrayExpr::EQ;
+            else if (ops2 == "!=")
+                op = IlArrayExpr::NE;
+            else if (ops2 == ">=")
+                op = IlArrayExpr::GE;
+            else if (ops2 == "<=")
+                op = IlArrayExpr::LE;
+            else if (ops2 == "<")
+                op = IlArrayExpr::LT;
+            else if (ops2 == ">")
+                op = IlArrayExpr::GT;
+            else {
+                kind = 2;
+                if (ops2 == "and")
+                    op = IlArrayExpr::AND;
+                else
+                    op = IlArrayExpr::OR;
+            }
+        }
+        ilAtomTypes e1 = numeric_elem_type(op1), e2 = numeric_elem_type(op2);
+        bool bad = (e1 == UNDEFINED || e2 == UNDEFINED);
+        if (kind == 0)
+            bad = bad || e1 == BOOL || e2 == BOOL || (op == IlArrayExpr::MOD && (e1 != INT || e2 != INT));
+        else if (kind == 1)
+            bad = bad || ((e1 == BOOL) != (e2 == BOOL)) || (e1 == BOOL && op != IlArrayExpr::EQ && op != IlArrayExpr::NE);
+        else
+            bad = bad || e1 == FLOAT || e2 == FLOAT;
+        if (bad) {
+            IlAtom err;
+            err.t = ERROR;
+            if (kind == 2)
+                err.vs = "Bool-requires-int-or-bool-Operands";
+            else
+                err.vs = "Math-" + ops2 + "-Wrong-Type-Operands";
+            pst->push_back(err);
+            return;
+        }
+        bool a1 = is_numeric_array(op1), a2 = is_numeric_array(op2);
+        if (a1 && a2 && numeric_array_size(op1) != numeric_array_size(op2)) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Array-size-mismatch-on-" + ops2;
+            pst->push_back(err);
+            return;
+        }
+        IlAtom &base = a1 ? op1 : op2;
+        IlAtom &other = a1 ? op2 : op1;
+        IlArrayExpr::Step st;
+        st.op = op;
+        st.int_op = (e1 == INT && e2 == INT && op != IlArrayExpr::POW && op != IlArrayExpr::ATAN2);
+        st.rev = !a1;
+        st.sc = 0.0;
+        st.sc2 = 0.0;
+        if (a1 && a2) {
+            st.arg = to_expr(other);
+        } else {
+            st.sc = numeric_value(other);
+            if ((op == IlArrayExpr::DIV || op == IlArrayExpr::MOD) && a1 && st.sc == 0.0) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "/-by-Zero";
+                pst->push_back(err);
+                return;
+            }
+        }
+        IlAtom res;
+        res.t = ARRAY_VIEW;
+        res.vx = std::make_shared<IlArrayExpr>(*to_expr(base));
+        res.vx->steps.push_back(st);
+        if (kind == 0)
+            res.vx->t = st.int_op ? INT_ARRAY : FLOAT_ARRAY;
+        else
+            res.vx->t = BOOL_ARRAY;
+        if (!lazy_arrays) force_view(&res);
+        pst->push_back(res);
+    }
+
+    void clamp(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 3) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow clamp";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom r1, r2, r3, res;
+        r3 = pst->back();
+        pst->pop_back();
+        r2 = pst->back();
+        pst->pop_back();
+        r1 = pst->back();
+        pst->pop_back();
+        ilAtomTypes e1 = numeric_elem_type(r1);
+        if ((r2.t != INT && r2.t != FLOAT) || (r3.t != INT && r3.t != FLOAT) || (e1 != INT && e1 != FLOAT)) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Clamp requires INT or FLOAT (or array of those) and INT or FLOAT bounds";
+            pst->push_back(err);
+            return;
+        }
+        bool int_op = (e1 == INT && r2.t == INT && r3.t == INT);
+        double lo = numeric_value(r2), hi = numeric_value(r3);
+        if (is_numeric_array(r1)) {
+            IlArrayExpr::Step st;
+            st.op = IlArrayExpr::CLAMP;
+            st.int_op = int_op;
+            st.rev = false;
+            st.sc = lo;
+            st.sc2 = hi;
+            res.t = ARRAY_VIEW;
+            res.vx = std::make_shared<IlArrayExpr>(*to_expr(r1));
+            res.vx->steps.push_back(st);
+            res.vx->t = int_op ? INT_ARRAY : FLOAT_ARRAY;
+            if (!lazy_arrays) force_view(&res);
+        } else {
+            double v = numeric_value(r1);
+            v = v < lo ? lo : (v > hi ? hi : v);
+            if (int_op) {
+                res.t = INT;
+                res.vi = IlArrayExpr::int_elem(v);
+                res.vs = std::to_string(res.vi);
+            } else {
+                res.t = FLOAT;
+                res.vf = v;
+                res.vs = std::to_string(res.vf);
+            }
+        }
+        pst->push_back(res);
+    }
+
+    void math_1ops(vector<IlAtom> *pst, string ops1) {
+        // Math functions of one INT or FLOAT argument, arrays are evaluated element-wise as lazy ARRAY_VIEW.
+        size_t l = pst->size();
+        if (l < 1) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow " + ops1;
+            pst->push_back(err);
+            return;
+        }
+        IlAtom r1, res;
+        r1 = pst->back();
+        pst->pop_back();
+        ilAtomTypes e1 = numeric_elem_type(r1);
+        if ((e1 != INT && e1 != FLOAT) || (ops1 == "isqrt" && e1 != INT)) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Math-" + ops1 + "-Wrong-Type-Operand";
+            pst->push_back(err);
+            return;
+        }
+        IlArrayExpr::Op op;
+        ilAtomTypes rt = FLOAT;
+        if (ops1 == "sqrt") {
+            op = IlArrayExpr::SQRT;
+        } else if (ops1 == "isqrt") {
+            op = IlArrayExpr::ISQRT;
+            rt = INT;
+        } else if (ops1 == "abs") {
+            op = IlArrayExpr::ABS;
+            rt = e1;
+        } else if (ops1 == "floor") {
+            op = IlArrayExpr::FLOOR;
+            rt = INT;
+        } else if (ops1 == "ceil") {
+            op = IlArrayExpr::CEIL;
+            rt = INT;
+        } else if (ops1 == "round") {
+            op = IlArrayExpr::ROUND;
+            rt = INT;
+        } else if (ops1 == "exp") {
+            op = IlArrayExpr::EXP;
+        } else if (ops1 == "log") {
+            op = IlArrayExpr::LOG;
+        } else if (ops1 == "sin") {
+            op = IlArrayExpr::SIN;
+        } else {
+            op = IlArrayExpr::COS;
+        }
+        if (is_numeric_array(r1)) {
+            IlArrayExpr::Step st;
+            st.op = op;
+            st.int_op = (rt == INT);
+            st.rev = false;
+            st.sc = 0.0;
+            st.sc2 = 0.0;
+            res.t = ARRAY_VIEW;
+            res.vx = std::make_shared<IlArrayExpr>(*to_expr(r1));
+            res.vx->steps.push_back(st);
+            res.vx->t = rt == INT ? INT_ARRAY : FLOAT_ARRAY;
+            if (!lazy_arrays) force_view(&res);
+            pst->push_back(res);
+            return;
+        }
+        double v = numeric_value(r1);
+        switch (op) {
+        case IlArrayExpr::SQRT:
+            v = std::sqrt(v);
+            break;
+        case IlArrayExpr::ISQRT:
+            if (v < 0.0) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "Math-domain-error";
+                pst->push_back(err);
+                return;
+            }
+            v = std::floor(std::sqrt(v));
+            break;
+        case IlArrayExpr::ABS:
+            v = std::fabs(v);
+            break;
+        case IlArrayExpr::FLOOR:
+            v = std::floor(v);
+            break;
+        case IlArrayExpr::CEIL:
+            v = std::ceil(v);
+            break;
+        case IlArrayExpr::ROUND:
+            v = std::round(v);
+            break;
+        case IlArrayExpr::EXP:
+            v = std::exp(v);
+            break;
+        case IlArrayExpr::LOG:
+            v = std::log(v);
+            break;
+        case IlArrayExpr::SIN:
+            v = std::sin(v);
+            break;
+        default:
+            v = std::cos(v);
+            break;
+        }
+        if (rt == INT) {
+            res.t = INT;
+            res.vi = IlArrayExpr::int_elem(v);
+            res.vs = std::to_string(res.vi);
+        } else {
+            res.t = FLOAT;
+            res.vf = v;
+            res.vs = std::to_string(res.vf);
+        }
+        pst->push_back(res);
+    }
+
+    void math_2fns(vector<IlAtom> *pst, string ops2) {
+        // pow, atan2, min2 and max2, arrays are evaluated element-wise as lazy ARRAY_VIEW.
+        size_t l = pst->size();
+        if (l < 2) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow " + ops2;
+            pst->push_back(err);
+            return;
+        }
+        IlAtom r1, r2, res;
+        r2 = pst->back();
+        pst->pop_back();
+        r1 = pst->back();
+        pst->pop_back();
+        if (is_numeric_array(r1) || is_numeric_array(r2)) {
+            array_2ops(pst, r1, r2, ops2);
+            return;
+        }
+        if ((r1.t != INT && r1.t != FLOAT) || (r2.t != INT && r2.t != FLOAT)) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Math-" + ops2 + "-Wrong-Type-Operands";
+            pst->push_back(err);
+            return;
+        }
+        double o1 = numeric_value(r1), o2 = numeric_value(r2), v;
+        if (ops2 == "pow")
+            v = std::pow(o1, o2);
+        else if (ops2 == "atan2")
+            v = std::atan2(o1, o2);
+        else if (ops2 == "min2")
+            v = o2 < o1 ? o2 : o1;
+        else
+            v = o2 > o1 ? o2 : o1;
+        if (r1.t == INT && r2.t == INT && (ops2 == "min2" || ops2 == "max2")) {
+            res.t = INT;
+            res.vi = IlArrayExpr::int_elem(v);
+            res.vs = std::to_string(res.vi);
+        } else {
+            res.t = FLOAT;
+            res.vf = v;
+            res.vs = std::to_string(res.vf);
+        }
+        pst->push_back(res);
+    }
+
+    void lazy_mode(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 1) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow lazy";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom r1 = pst->back();
+        pst->pop_back();
+        if (r1.t != BOOL && r1.t != INT) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "lazy requires BOOL or INT";
+            pst->push_back(err);
+            return;
+        }
+        if (r1.t == BOOL)
+            lazy_arrays = r1.vb;
+        else
+            lazy_arrays = (r1.vi != 0);
+    }
+
+    IlThreadPool *par_pool(size_t n) {
+        // Returns the thread pool, if work on n elements should be split over threads, else nullptr.
+        if (n < par_threshold) return nullptr;
+        return task_pool();
+    }
+
+    IlThreadPool *task_pool() {
+        // The thread pool for spawn and pfor, nullptr if threads < 2.
+        if (threads < 2) return nullptr;
+        if (!pool) pool = std::make_shared<IlThreadPool>(threads - 1);
+        return pool.get();
+    }
+
+    void set_threads(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 1) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow threads";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom r1 = pst->back();
+        pst->pop_back();
+        if (r1.t != INT || r1.vi < 0) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "threads requires INT >= 0 (0: number of cores)";
+            pst->push_back(err);
+            return;
+        }
+        if (r1.vi == 0)
+            threads = std::thread::hardware_concurrency();
+        else
+            threads = r1.vi;
+        pool.reset();
+    }
+
+    void set_par_threshold(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 1) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow parthreshold";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom r1 = pst->back();
+        pst->pop_back();
+        if (r1.t != INT || r1.vi < 0) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "parthreshold requires INT >= 0";
+            pst->push_back(err);
+            return;
+        }
+        par_threshold = r1.vi;
+    }
+
+    bool is_pure_inbuilt(const string &name) {
+        if (std::find(pure_inbuilts.begin(), pure_inbuilts.end(), name) == pure_inbuilts.end()) return false;
+        return true;
+    }
+
+    bool is_pure_code(const vector<IlAtom> &code) {
+        // Code that only works on the stack and its own locals, it can run concurrently on the thread pool.
+        for (const auto &ila : code) {
+            switch (ila.t) {
+            case INT:
+            case FLOAT:
+            case BOOL:
+            case STRING:
+            case INT_ARRAY:
+            case FLOAT_ARRAY:
+            case BOOL_ARRAY:
+            case STRING_ARRAY:
+            case QUOTE:
+            case COMMENT:
+            case FLOW_CONTROL:
+                break;
+            case IFUNC:
+                if (!is_pure_inbuilt(ila.vs)) return false;
+                break;
+            case SYMBOL:
+                if (is_func(ila.name)) return false;
+                break;
+            case STORE_SYMBOL:
+                if (ila.name[0] == '$' || globals().find(ila.name) != globals().end()) return false;
+                break;
+            default:
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool quote_results_par(vector<IlAtom> &code, const IlAtom &arr, vector<IlAtom> *pres, IlAtom *perr, string count_err, IlThreadPool *pool) {
+        // Runs pure code for each element of arr on its own stack, concurrently in chunks. Each run must leave
+        // one value that is stored in (*pres)[i]. On failure perr is set to the first error in element order.
+        size_t n = array_size(arr);
+        size_t cs = quote_chunk_size;
+        size_t n_chunks = (n + cs - 1) / cs;
+        vector<IlAtom> errs(n_chunks);
+        vector<unsigned char> failed(n_chunks, 0);
+        pres->resize(n);
+        IlContinuation *outer = retry_run;  // hidden here, so that the runs on the pool don't write it
+        retry_run = nullptr;
+        pool->parallel_for(n_chunks, [&](size_t c) {
+            vector<IlAtom> qst;
+            IlLocals quote_symbols;
+            size_t end = (c + 1) * cs < n ? (c + 1) * cs : n;
+            for (size_t i = c * cs; i < end; i++) {
+                qst.clear();
+                qst.push_back(array_element(arr, i));
+                if (!exec(code, &qst, quote_symbols)) {
+                    if (qst.size() > 0) errs[c] = qst.back();
+                    failed[c] = 1;
+                    return;
+                }
+                if (qst.size() != 1) {
+                    errs[c].t = ERROR;
+                    errs[c].vs = count_err;
+                    failed[c] = 1;
+                    return;
+                }
+                (*pres)[i] = qst.back();
+            }
+        });
+        retry_run = outer;
+        for (size_t c = 0; c < n_chunks; c++) {
+            if (failed[c]) {
+                *perr = errs[c];
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool float_data(IlAtom &a, vector<double> *pv) {
+        // Moves the payload of a FLOAT_ARRAY into pv, INT_ARRAYs are converted.
+        if (a.t == FLOAT_ARRAY) {
+            pv->swap(a.vaf);
+            return true;
+        }
+        if (a.t == INT_ARRAY) {
+            pv->assign(a.vai.begin(), a.vai.end());
+            return true;
+        }
+        return false;
+    }
+
+    void array_matmul(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 5) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow matmul";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom ra, rb, rm, rn, rp, res;
+        rp = pst->back();
+        pst->pop_back();
+        rn = pst->back();
+        pst->pop_back();
+        rm = pst->back();
+        pst->pop_back();
+        rb = pst->back();
+        pst->pop_back();
+        ra = pst->back();
+        pst->pop_back();
+        vector<double> a, b;
+        if (rm.t != INT || rn.t != INT || rp.t != INT || rm.vi < 0 || rn.vi < 0 || rp.vi < 0 || !float_data(ra, &a) || !float_data(rb, &b)) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Matmul requires FLOAT (or INT) arrays A, B and INT dimensions m, n, p";
+            pst->push_back(err);
+            return;
+        }
+        int m = rm.vi, n = rn.vi, p = rp.vi;
+        if (a.size() != (size_t)m * n || b.size() != (size_t)n * p) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Matmul-dimension-mismatch";
+            pst->push_back(err);
+            return;
+        }
+        res.t = FLOAT_ARRAY;
+        res.vaf.resize((size_t)m * p);
+        res.shape = {m, p};
+        matmul(a.data(), b.data(), res.vaf.data(), m, n, p, par_pool((size_t)m * p));
+        pst->push_back(res);
+    }
+
+    void array_transpose(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 3) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow transpose";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom ra, rm, rn, res;
+        rn = pst->back();
+        pst->pop_back();
+        rm = pst->back();
+        pst->pop_back();
+        ra = pst->back();
+        pst->pop_back();
+        vector<double> a;
+        if (rm.t != INT || rn.t != INT || rm.vi < 0 || rn.vi < 0 || !float_data(ra, &a)) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Transpose requires FLOAT (or INT) array A and INT dimensions m, n";
+            pst->push_back(err);
+            return;
+        }
+        int m = rm.vi, n = rn.vi;
+        if (a.size() != (size_t)m * n) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Transpose-dimension-mismatch";
+            pst->push_back(err);
+            return;
+        }
+        res.t = FLOAT_ARRAY;
+        res.vaf.resize((size_t)m * n);
+        res.shape = {n, m};
+        transpose(a.data(), res.vaf.data(), m, n);
+        pst->push_back(res);
+    }
+
+    void array_matvec(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 4) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow matvec";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom ra, rx, rm, rn, res;
+        rn = pst->back();
+        pst->pop_back();
+        rm = pst->back();
+        pst->pop_back();
+        rx = pst->back();
+        pst->pop_back();
+        ra = pst->back();
+        pst->pop_back();
+        vector<double> a, x;
+        if (rm.t != INT || rn.t != INT || rm.vi < 0 || rn.vi < 0 || !float_data(ra, &a) || !float_data(rx, &x)) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Matvec requires FLOAT (or INT) arrays A, x and INT dimensions m, n";
+            pst->push_back(err);
+            return;
+        }
+        int m = rm.vi, n = rn.vi;
+        if (a.size() != (size_t)m * n || x.size() != (size_t)n) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Matvec-dimension-mismatch";
+            pst->push_back(err);
+            return;
+        }
+        res.t = FLOAT_ARRAY;
+        res.vaf.resize(m);
+        matvec(a.data(), x.data(), res.vaf.data(), m, n);
+        pst->push_back(res);
+    }
+
+    void array_outer(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 2) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow outer";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom rx, ry, res;
+        ry = pst->back();
+        pst->pop_back();
+        rx = pst->back();
+        pst->pop_back();
+        vector<double> x, y;
+        if (!float_data(rx, &x) || !float_data(ry, &y)) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Outer requires two FLOAT (or INT) arrays";
+            pst->push_back(err);
+            return;
+        }
+        int m = x.size(), n = y.size();
+        res.t = FLOAT_ARRAY;
+        res.vaf.resize((size_t)m * n);
+        res.shape = {m, n};
+        outer(x.data(), y.data(), res.vaf.data(), m, n);
+        pst->push_back(res);
+    }
+
+    bool host_little_endian() {
+        uint16_t one = 1;
+        unsigned char c;
+        memcpy(&c, &one, 1);
+        return c == 1;
+    }
+
+    bool map_array(const string &path, const string &dtype_name, IlAtom *pa, string *perr) {
+        // Maps a binary array file read-only as an ARRAY_VIEW on the mapped data, nothing is copied.
+        // With an empty dtype_name the file has an IlArrayFileHeader, else it is raw data of that dtype.
+        if (!host_little_endian()) {
+            *perr = "Array-files-require-little-endian-host";
+            return false;
+        }
+        auto f = std::make_shared<IlMappedFile>();
+        if (!f->open(path)) {
+            *perr = "Cannot-open-array-file: " + path;
+            return false;
+        }
+        IlArrayExpr::DType dtype;
+        size_t off = 0, n = 1, esz;
+        vector<int> shape;
+        if (dtype_name == "") {
+            IlArrayFileHeader hdr;
+            if (f->size < sizeof(hdr) || memcmp(f->data, "ILAR", 4)) {
+                *perr = "Not-an-array-file: " + path;
+                return false;
+            }
+            memcpy(&hdr, f->data, sizeof(hdr));
+            if (hdr.version != il_array_file_version || !IlArrayExpr::dtype_from_str(string(hdr.dtype, strnlen(hdr.dtype, 4)), &dtype) ||
+                hdr.ndim < 1 || hdr.ndim > 8 || hdr.data_offset < sizeof(hdr) || hdr.data_offset > f->size ||
+                hdr.data_offset % IlArrayExpr::dtype_size(dtype)) {
+                *perr = "Array-file-corrupt: " + path;
+                return false;
+            }
+            esz = IlArrayExpr::dtype_size(dtype);
+            off = hdr.data_offset;
+            for (uint32_t i = 0; i < hdr.ndim; i++) {
+                if (hdr.shape[i] > (uint64_t)std::numeric_limits<int>::max() || (hdr.shape[i] && n > (f->size - off) / esz / hdr.shape[i])) {
+                    *perr = "Array-file-truncated: " + path;
+                    return false;
+                }
+                n *= hdr.shape[i];
+                shape.push_back(hdr.shape[i]);
+            }
+        } else {
+            if (!IlArrayExpr::dtype_from_str(dtype_name, &dtype)) {
+                *perr = "Unknown-dtype: " + dtype_name;
+                return false;
+            }
+            esz = IlArrayExpr::dtype_size(dtype);
+            if (f->size % esz) {
+                *perr = "Array-file-size-not-a-multiple-of-dtype: " + path;
+                return false;
+            }
+            n = f->size / esz;
+        }
+        auto x = std::make_shared<IlArrayExpr>();
+        x->data = f->data + off;
+        x->n = n;
+        x->dtype = dtype;
+        x->t = IlArrayExpr::dtype_array_type(dtype);
+        x->owner = f;
+        pa->t = ARRAY_VIEW;
+        pa->vx = x;
+        pa->shape = shape;
+        return true;
+    }
+
+    bool save_array(IlAtom &a, const string &path, const string &dtype_name, string *perr) {
+        // Streams a numeric array into a binary array file, converted to dtype. Pending expressions are
+        // evaluated block-wise while writing, without creating the array.
+        IlArrayExpr::DType dtype;
+        if (!is_numeric_array(a)) {
+            *perr = "Savearray-requires-INT-FLOAT-or-BOOL-array";
+            return false;
+        }
+        if (!IlArrayExpr::dtype_from_str(dtype_name, &dtype)) {
+            *perr = "Unknown-dtype: " + dtype_name;
+            return false;
+        }
+        if (!host_little_endian()) {
+            *perr = "Array-files-require-little-endian-host";
+            return false;
+        }
+        vector<int> shape = a.shape;
+        std::shared_ptr<IlArrayExpr> x = to_expr(a);
+        size_t n = 1;
+        for (auto d : shape) n *= d;
+        if (shape.empty() || shape.size() > 8 || n != x->n) shape = {(int)x->n};
+        IlArrayFileHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, "ILAR", 4);
+        hdr.version = il_array_file_version;
+        memcpy(hdr.dtype, dtype_name.data(), dtype_name.size());
+        hdr.ndim = shape.size();
+        for (size_t i = 0; i < shape.size(); i++) hdr.shape[i] = shape[i];
+        hdr.data_offset = sizeof(hdr);
+        string tmp = path + ".tmp";
+        FILE *fp = fopen(tmp.c_str(), "wb");
+        if (!fp) {
+            *perr = "Cannot-write-array-file: " + path;
+            return false;
+        }
+        bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+        size_t esz = IlArrayExpr::dtype_size(dtype);
+        vector<char> out(IlArrayExpr::chunk_size * esz);
+        double buf[IlArrayExpr::block_size];
+        IlArrayExpr::Status status = IlArrayExpr::OK;
+        for (size_t start = 0; ok && status == IlArrayExpr::OK && start < x->n; start += IlArrayExpr::chunk_size) {
+            size_t end = start + IlArrayExpr::chunk_size < x->n ? start + IlArrayExpr::chunk_size : x->n;
+            for (size_t bs = start; bs < end && status == IlArrayExpr::OK; bs += IlArrayExpr::block_size) {
+                size_t len = end - bs < IlArrayExpr::block_size ? end - bs : IlArrayExpr::block_size;
+                status = x->eval_block(bs, len, buf);
+                IlArrayExpr::store_block(dtype, buf, len, out.data() + (bs - start) * esz);
+            }
+            if (status == IlArrayExpr::OK) ok = fwrite(out.data(), esz, end - start, fp) == end - start;
+        }
+        if (fclose(fp) != 0) ok = false;
+        if (!ok || status != IlArrayExpr::OK || rename(tmp.c_str(), path.c_str()) != 0) {
+            remove(tmp.c_str());
+            *perr = status != IlArrayExpr::OK ? IlArrayExpr::status_str(status) : "Cannot-write-array-file: " + path;
+            return false;
+        }
+        return true;
+    }
+
+    void array_mapfile(vector<IlAtom> *pst, bool raw) {
+        // "file" mapfile -> array shape, "file" "dtype" mapraw -> array
+        size_t l = pst->size();
+        if (l < (raw ? 2 : 1)) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = raw ? "Stack-Underflow mapraw" : "Stack-Underflow mapfile";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom rd, rf, res;
+        rd.t = STRING;
+        rd.vs = "";
+        if (raw) {
+            rd = pst->back();
+            pst->pop_back();
+        }
+        rf = pst->back();
+        pst->pop_back();
+        string err_msg;
+        if (rf.t != STRING || rd.t != STRING) {
+            err_msg = raw ? "Mapraw requires STRING filename and dtype" : "Mapfile requires STRING filename";
+        } else if (map_array(rf.vs, rd.vs, &res, &err_msg)) {
+            pst->push_back(res);
+            if (!raw) {
+                IlAtom shape;
+                shape.t = INT_ARRAY;
+                shape.vai = res.shape;
+                pst->push_back(shape);
+            }
+            return;
+        }
+        IlAtom err;
+        err.t = ERROR;
+        err.vs = err_msg;
+        pst->push_back(err);
+    }
+
+    void array_save(vector<IlAtom> *pst) {
+        // array "file" "dtype" savearray
+        size_t l = pst->size();
+        if (l < 3) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow savearray";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom ra, rf, rd;
+        rd = pst->back();
+        pst->pop_back();
+        rf = pst->back();
+        pst->pop_back();
+        ra = pst->back();
+        pst->pop_back();
+        string err_msg;
+        if (rf.t != STRING || rd.t != STRING) {
+            err_msg = "Savearray requires array, STRING filename and dtype";
+        } else if (save_array(ra, rf.vs, rd.vs, &err_msg)) {
+            return;
+        }
+        IlAtom err;
+        err.t = ERROR;
+        err.vs = err_msg;
+        pst->push_back(err);
+    }
+
+    void dup(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 1) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow dup";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom res = pst->back();
+        pst->push_back(res);
+    }
+
+    void dup2(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 2) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow dup2";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom res2 = pst->back();
+        pst->pop_back();
+        IlAtom res = pst->back();
+        pst->push_back(res2);
+        pst->push_back(res);
+        pst->push_back(res2);
+    }
+
+    void swap(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 2) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow swap";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom res2 = pst->back();
+        pst->pop_back();
+        IlAtom res = pst->back();
+        pst->pop_back();
+        pst->push_back(res2);
+        pst->push_back(res);
+    }
+
+    void drop(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 1) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow drop";
+            pst->push_back(err);
+            return;
+        }
+        pst->pop_back();
+    }
+
+    void range(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 2) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow range";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom r1, r2;
+        r2 = pst->back();
+        pst->pop_back();
+        r1 = pst->back();
+        pst->pop_back();
+        if (r1.t != INT || r2.t != INT) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Range required 2 INT args";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom r;
+        r.t = INT_ARRAY;
+        if (r1.vi <= r2.vi) {
+            for (auto i = r1.vi; i <= r2.vi; i++)
+                r.vai.push_back(i);
+        } else {
+            for (auto i = r1.vi; i >= r2.vi; i--)
+                r.vai.push_back(i);
+        }
+        pst->push_back(r);
+    }
+
+    void array_append(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 2) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow append";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom r1, r2;
+        r2 = pst->back();
+        pst->pop_back();
+        r1 = pst->back();
+        pst->pop_back();
+        if (r1.t == INT_ARRAY && r2.t == INT) {
+            r1.vai.push_back(r2.vi);
+            pst->push_back(r1);
+        } else if (r1.t == FLOAT_ARRAY && r2.t == FLOAT) {
+            r1.vaf.push_back(r2.vf);
+            pst->push_back(r1);
+        } else if (r1.t == BOOL_ARRAY && r2.t == BOOL) {
+            r1.vab.push_back(r2.vb);
+            pst->push_back(r1);
+        } else if (r1.t == STRING_ARRAY && r2.t == STRING) {
+            r1.vas.push_back(r2.vs);
+            pst->push_back(r1);
+        } else {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Append requires array and element of same type: INT, FLOAT, STRING, or BOOL";
+            pst->push_back(err);
+            return;
+        }
+        return;
+    }
+
+    void array_remove(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 2) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow remove";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom r1, r2;
+        r2 = pst->back();
+        pst->pop_back();
+        r1 = pst->back();
+        pst->pop_back();
+        if (r1.t == INT_ARRAY && r2.t == INT) {
+            if (r2.vi >= r1.vai.size() || r2.vi < 0) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "Index-out-of-range-on-remove";
+                pst->push_back(err);
+                return;
+            }
+            r1.vai.erase(r1.vai.begin() + r2.vi);
+            pst->push_back(r1);
+        } else if (r1.t == FLOAT_ARRAY && r2.t == INT) {
+            if (r2.vi >= r1.vaf.size() || r2.vi < 0) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "Index-out-of-range-on-remove";
+                pst->push_back(err);
+                return;
+            }
+            r1.vaf.erase(r1.vaf.begin() + r2.vi);
+            pst->push_back(r1);
+        } else if (r1.t == BOOL_ARRAY && r2.t == INT) {
+            if (r2.vi >= r1.vab.size() || r2.vi < 0) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "Index-out-of-range-on-remove";
+                pst->push_back(err);
+                return;
+            }
+            r1.vab.erase(r1.vab.begin() + r2.vi);
+            pst->push_back(r1);
+        } else if (r1.t == STRING_ARRAY && r2.t == INT) {
+            if (r2.vi >= r1.vas.size() || r2.vi < 0) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "Index-out-of-range-on-remove";
+                pst->push_back(err);
+                return;
+            }
+            r1.vas.erase(r1.vas.begin() + r2.vi);
+            pst->push_back(r1);
+        } else {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Remove requires array of type: INT, FLOAT, STRING, or BOOL and an Index of type INT";
+            pst->push_back(err);
+            return;
+        }
+        return;
+    }
+
+    void array_erase(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 1) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow remove";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom r1;
+        r1 = pst->back();
+        pst->pop_back();
+        if (r1.t == INT_ARRAY) {
+            r1.vai.clear();
+            pst->push_back(r1);
+        } else if (r1.t == FLOAT_ARRAY) {
+            r1.vaf.clear();
+            pst->push_back(r1);
+        } else if (r1.t == BOOL_ARRAY) {
+            r1.vab.clear();
+            pst->push_back(r1);
+        } else if (r1.t == STRING_ARRAY) {
+            r1.vas.clear();
+            pst->push_back(r1);
+        } else {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Erase requires array of type: INT, FLOAT, STRING, or BOOL";
+            pst->push_back(err);
+            return;
+        }
+        return;
+    }
+
+    void array_update(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 3) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow update";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom r1, r2, r3;
+        r3 = pst->back();
+        pst->pop_back();
+        r2 = pst->back();
+        pst->pop_back();
+        r1 = pst->back();
+        pst->pop_back();
+        if (is_host_target(r1) && !global_view && r2.t == INT && (r3.t == INT || r3.t == FLOAT || r3.t == BOOL)) {
+            // writable host memory is updated in place
+            if (r2.vi >= r1.vx->n || r2.vi < 0) {
                 IlAtom err;
                 err.t = ERROR;
-                err.vs = "Math-" + ops2 + "-Wrong-Type-Operands";
+                err.vs = "Index-out-of-range-on-update";
+                pst->push_back(err);
+                return;
+            }
+            double v = numeric_value(r3);
+            IlArrayExpr::store_block(r1.vx->dtype, &v, 1, (char *)r1.vx->data + r2.vi * IlArrayExpr::dtype_size(r1.vx->dtype));
+            pst->push_back(r1);
+            return;
+        }
+        if (!force_view(&r1) || !force_view(&r2) || !force_view(&r3)) {
+            IlAtom err = r1.t == ERROR ? r1 : (r2.t == ERROR ? r2 : r3);
+            pst->push_back(err);
+            return;
+        }
+        if (r1.t == INT_ARRAY && r2.t == INT && r3.t == INT) {
+            if (r2.vi >= r1.vai.size() || r2.vi < 0) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "Index-out-of-range-on-update";
+                pst->push_back(err);
+                return;
+            }
+            r1.vai[r2.vi] = r3.vi;
+            pst->push_back(r1);
+        } else if (r1.t == FLOAT_ARRAY && r2.t == INT && r3.t == FLOAT) {
+            if (r2.vi >= r1.vaf.size() || r2.vi < 0) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "Index-out-of-range-on-update";
+                pst->push_back(err);
+                return;
+            }
+            r1.vaf[r2.vi] = r3.vf;
+            pst->push_back(r1);
+        } else if (r1.t == BOOL_ARRAY && r2.t == INT && r3.t == BOOL) {
+            if (r2.vi >= r1.vab.size() || r2.vi < 0) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "Index-out-of-range-on-update";
+                pst->push_back(err);
+                return;
+            }
+            r1.vab[r2.vi] = r3.vb;
+            pst->push_back(r1);
+        } else if (r1.t == STRING_ARRAY && r2.t == INT && r3.t == STRING) {
+            if (r2.vi >= r1.vas.size() || r2.vi < 0) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "Index-out-of-range-on-update";
                 pst->push_back(err);
                 return;
             }
+            r1.vas[r2.vi] = r3.vs;
+            pst->push_back(r1);
         } else {
-            if (t1 == INT && t2 == INT) {
-                res.t = BOOL;
-                if (ops2 == "==") {
-                    res.vb = (op1.vi == op2.vi);
-                } else if (ops2 == "!=") {
-                    res.vb = (op1.vi != op2.vi);
-                } else if (ops2 == ">=") {
-                    res.vb = (op1.vi >= op2.vi);
-                } else if (ops2 == "<=") {
-                    res.vb = (op1.vi <= op2.vi);
-                } else if (ops2 == "<") {
-                    res.vb = (op1.vi < op2.vi);
-                } else if (ops2 == ">") {
-                    res.vb = (op1.vi > op2.vi);
-                } else {
-                    IlAtom err;
-                    err.t = ERROR;
-                    err.vs = "INT-Cmp-" + ops2 + "-Wrong-Type-Operands";
-                    pst->push_back(err);
-                    return;
-                }
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Update requires array of type: INT, FLOAT, STRING, or BOOL and an Index of type INT, and a Value of same type as the array.";
+            pst->push_back(err);
+            return;
+        }
+        return;
+    }
+
+    void array_index(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 2) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow index";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom r1, r2, res;
+        r2 = pst->back();
+        pst->pop_back();
+        r1 = pst->back();
+        pst->pop_back();
+        if (r1.t == ARRAY_VIEW && r2.t == INT) {
+            double v;
+            if (r2.vi >= r1.vx->n || r2.vi < 0) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "Index-out-of-range-on-index";
+                pst->push_back(err);
+                return;
+            }
+            IlArrayExpr::Status status = r1.vx->at(r2.vi, &v);
+            if (status != IlArrayExpr::OK) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = IlArrayExpr::status_str(status);
+                pst->push_back(err);
+                return;
+            }
+            if (r1.vx->t == INT_ARRAY) {
+                res.t = INT;
+                res.vi = IlArrayExpr::int_elem(v);
+                res.vs = std::to_string(res.vi);
+            } else if (r1.vx->t == FLOAT_ARRAY) {
+                res.t = FLOAT;
+                res.vf = v;
+                res.vs = std::to_string(res.vf);
             } else {
                 res.t = BOOL;
-                double o1, o2;
-                if (op1.t == INT)
-                    o1 = op1.vi;
-                else
-                    o1 = op1.vf;
-                if (op2.t == INT)
-                    o2 = op2.vi;
-                else
-                    o2 = op2.vf;
-                if (ops2 == "==") {
-                    res.vb = (o1 == o2);
-                } else if (ops2 == "!=") {
-                    res.vb = (o1 != o2);
-                } else if (ops2 == ">=") {
-                    res.vb = (o1 >= o2);
-                } else if (ops2 == "<=") {
-                    res.vb = (o1 <= o2);
-                } else if (ops2 == "<") {
-                    res.vb = (o1 < o2);
-                } else if (ops2 == ">") {
-                    res.vb = (o1 > o2);
-                } else {
-                    IlAtom err;
-                    err.t = ERROR;
-                    err.vs = "FLOAT-Cmp-" + ops2 + "-Wrong-Type-Operands";
-                    pst->push_back(err);
-                    return;
-                }
+                res.vb = (v != 0.0);
+                res.vs = res.vb ? "true" : "false";
+            }
+            pst->push_back(res);
+        } else if (r1.t == INT_ARRAY && r2.t == INT) {
+            if (r2.vi >= r1.vai.size() || r2.vi < 0) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "Index-out-of-range-on-index";
+                pst->push_back(err);
+                return;
+            }
+            res.t = INT;
+            res.vi = r1.vai[r2.vi];
+            res.vs = std::to_string(res.vi);
+            pst->push_back(res);
+        } else if (r1.t == FLOAT_ARRAY && r2.t == INT) {
+            if (r2.vi >= r1.vaf.size() || r2.vi < 0) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "Index-out-of-range-on-index";
+                pst->push_back(err);
+                return;
+            }
+            res.t = FLOAT;
+            res.vf = r1.vaf[r2.vi];
+            res.vs = std::to_string(res.vf);
+            pst->push_back(res);
+        } else if (r1.t == BOOL_ARRAY && r2.t == INT) {
+            if (r2.vi >= r1.vab.size() || r2.vi < 0) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "Index-out-of-range-on-index";
+                pst->push_back(err);
+                return;
+            }
+            res.t = BOOL;
+            res.vb = r1.vab[r2.vi];
+            if (res.vb)
+                res.vs = "true";
+            else
+                res.vs = "false";
+            pst->push_back(res);
+        } else if (r1.t == STRING_ARRAY && r2.t == INT) {
+            if (r2.vi >= r1.vas.size() || r2.vi < 0) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "Index-out-of-range-on-index";
+                pst->push_back(err);
+                return;
+            }
+            res.t = STRING;
+            res.vs = r1.vas[r2.vi];
+            pst->push_back(res);
+        } else if (r1.t == STRING && r2.t == INT) {
+            if (r2.vi >= r1.vs.length() || r2.vi < 0) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "Index-out-of-range-on-string-index";
+                pst->push_back(err);
+                return;
+            }
+            res.t = STRING;
+            string cs{r1.vs[r2.vi]};
+            res.vs = cs;
+            pst->push_back(res);
+        } else {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Update requires array of type: INT, FLOAT, STRING, or BOOL and an Index of type INT, and a Value of same type as the array.";
+            pst->push_back(err);
+            return;
+        }
+        return;
+    }
+
+    void array_sum(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 1) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow sum";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom r1, res;
+        r1 = pst->back();
+        pst->pop_back();
+        if ((r1.t == INT_ARRAY || r1.t == FLOAT_ARRAY) && par_pool(array_size(r1))) {
+            IlAtom v;
+            v.t = ARRAY_VIEW;
+            v.vx = to_expr(r1);
+            r1 = v;
+        }
+        if (r1.t == ARRAY_VIEW) {
+            long long si;
+            double sf;
+            bool sb;
+            IlArrayExpr::Status status = r1.vx->sum(&si, &sf, &sb, par_pool(r1.vx->n));
+            if (status != IlArrayExpr::OK) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = IlArrayExpr::status_str(status);
+                pst->push_back(err);
+                return;
+            }
+            if (r1.vx->t == INT_ARRAY) {
+                res.t = INT;
+                res.vi = (int)si;
+                res.vs = std::to_string(res.vi);
+            } else if (r1.vx->t == FLOAT_ARRAY) {
+                res.t = FLOAT;
+                res.vf = sf;
+                res.vs = std::to_string(res.vf);
+            } else {
+                res.t = BOOL;
+                res.vb = sb;
+                res.vs = sb ? "true" : "false";
             }
+            pst->push_back(res);
+        } else if (r1.t == INT_ARRAY) {
+            res.t = INT;
+            res.vi = 0;
+            for (auto n : r1.vai)
+                res.vi += n;
+            res.vs = std::to_string(res.vi);
+            pst->push_back(res);
+        } else if (r1.t == FLOAT_ARRAY) {
+            res.t = FLOAT;
+            res.vf = 0.0;
+            for (auto f : r1.vaf)
+                res.vf += f;
+            res.vs = std::to_string(res.vf);
+            pst->push_back(res);
+        } else if (r1.t == BOOL_ARRAY) {
+            res.t = BOOL;
+            res.vb = true;
+            for (auto b : r1.vab)
+                if (!b) res.vb = false;
+            if (res.vb)
+                res.vs = "true";
+            else
+                res.vs = "false";
+            pst->push_back(res);
+        } else if (r1.t == STRING_ARRAY) {
+            res.t = STRING;
+            res.vs = "";
+            for (auto s : r1.vas)
+                res.vs += s;
+            pst->push_back(res);
+        } else {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Sum requires array of type: INT, FLOAT, STRING, or BOOL";
+            pst->push_back(err);
+            return;
         }
-        if (res.vb)
-            res.vs = "true";
-        else
-            res.vs = "false";
-        pst->push_back(res);
+        return;
     }
 
-    void bool_2ops(vector<IlAtom> *pst, string ops2) {
+    void array_or_string_len(vector<IlAtom> *pst) {
         size_t l = pst->size();
-        if (l < 2) {
+        if (l < 1) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Bool-Not-Enough-Operands";
+            err.vs = "Stack-Underflow sum";
             pst->push_back(err);
             return;
         }
-        ilAtomTypes t1, t2;
-        IlAtom res, op1, op2;
-        op2 = pst->back();
-        pst->pop_back();
-        op1 = pst->back();
+        IlAtom r1, res;
+        r1 = pst->back();
         pst->pop_back();
-        t2 = op2.t;
-        t1 = op1.t;
-
-        if ((t1 != INT && t1 != BOOL) || (t2 != INT && t2 != BOOL)) {
+        if (r1.t == ARRAY_VIEW) {
+            res.t = INT;
+            res.vi = r1.vx->n;
+            res.vs = std::to_string(res.vi);
+            pst->push_back(res);
+        } else if (r1.t == INT_ARRAY) {
+            res.t = INT;
+            res.vi = r1.vai.size();
+            res.vs = std::to_string(res.vi);
+            pst->push_back(res);
+        } else if (r1.t == FLOAT_ARRAY) {
+            res.t = INT;
+            res.vi = r1.vaf.size();
+            res.vs = std::to_string(res.vi);
+            pst->push_back(res);
+        } else if (r1.t == BOOL_ARRAY) {
+            res.t = INT;
+            res.vi = r1.vab.size();
+            res.vs = std::to_string(res.vi);
+            pst->push_back(res);
+        } else if (r1.t == STRING_ARRAY) {
+            res.t = INT;
+            res.vi = r1.vas.size();
+            res.vs = std::to_string(res.vi);
+            pst->push_back(res);
+        } else if (r1.t == STRING) {
+            res.t = INT;
+            res.vi = r1.vs.length();
+            res.vs = std::to_string(res.vi);
+            pst->push_back(res);
+        } else {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Bool-requires-int-or-bool-Operands";
+            err.vs = "Sum requires array of type: INT, FLOAT, STRING, or BOOL";
             pst->push_back(err);
             return;
         }
-        bool b1, b2;
-        if (t1 == BOOL)
-            b1 = op1.vb;
-        else {
-            if (op1.vi == 0)
-                b1 = false;
-            else
-                b1 = true;
+        return;
+    }
+    void to_int(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 1) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow to_int";
+            pst->push_back(err);
+            return;
         }
-        if (t2 == BOOL)
-            b2 = op2.vb;
-        else {
-            if (op2.vi == 0)
-                b2 = false;
+        IlAtom r1, res;
+        r1 = pst->back();
+        pst->pop_back();
+        if (r1.t == INT) {
+            res.t = INT;
+            res.vi = {r1.vi};
+            res.vs = std::to_string(res.vi);
+            pst->push_back(res);
+        } else if (r1.t == FLOAT) {
+            res.t = INT;
+            res.vi = (int)r1.vf;
+            res.vs = std::to_string(res.vi);
+            pst->push_back(res);
+        } else if (r1.t == BOOL) {
+            res.t = INT;
+            if (r1.t)
+                res.vi = 1;
             else
-                b2 = true;
+                res.vi = 0;
+            res.vs = std::to_string(res.vi);
+            pst->push_back(res);
+        } else if (r1.t == STRING) {
+            if (is_int(r1.vs)) {
+                res.t = INT;
+                res.vi = atoi(r1.vs.c_str());
+            } else {
+                res.t = ERROR;
+                res.vs = "Can't convert: " + r1.vs = " to int";
+            }
+            pst->push_back(res);
+        } else {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "to_int requires: INT, FLOAT, STRING, or BOOL";
+            pst->push_back(err);
+            return;
         }
-        res.t = BOOL;
-        if (ops2 == "and")
-            res.vb = (b1 && b2);
-        else if (ops2 == "or")
-            res.vb = (b1 || b2);
-        if (res.vb)
-            res.vs = "true";
-        else
-            res.vs = "false";
-        pst->push_back(res);
+        return;
     }
 
-    void dup(vector<IlAtom> *pst) {
+    void to_float(vector<IlAtom> *pst) {
         size_t l = pst->size();
         if (l < 1) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Stack-Underflow dup";
+            err.vs = "Stack-Underflow to_float";
             pst->push_back(err);
             return;
         }
-        IlAtom res = pst->back();
-        pst->push_back(res);
+        IlAtom r1, res;
+        r1 = pst->back();
+        pst->pop_back();
+        if (r1.t == INT) {
+            res.t = FLOAT;
+            res.vf = (double)r1.vi;
+            res.vs = std::to_string(res.vf);
+            pst->push_back(res);
+        } else if (r1.t == FLOAT) {
+            res.t = FLOAT;
+            res.vf = r1.vf;
+            res.vs = std::to_string(r1.vf);
+            pst->push_back(res);
+        } else if (r1.t == BOOL) {
+            res.t = FLOAT;
+            if (r1.t)
+                res.vf = 1.0;
+            else
+                res.vf = 0.0;
+            res.vs = std::to_string(res.vf);
+            pst->push_back(res);
+        } else if (r1.t == STRING) {
+            if (is_float(r1.vs)) {
+                res.t = FLOAT;
+                res.vf = atof(r1.vs.c_str());
+            } else {
+                res.t = ERROR;
+                res.vs = "Can't convert: " + r1.vs = " to float";
+            }
+            pst->push_back(res);
+        } else {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "to_float requires: INT, FLOAT, STRING, or BOOL";
+            pst->push_back(err);
+            return;
+        }
+        return;
     }
 
-    void dup2(vector<IlAtom> *pst) {
+    void to_bool(vector<IlAtom> *pst) {
         size_t l = pst->size();
-        if (l < 2) {
+        if (l < 1) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Stack-Underflow dup2";
+            err.vs = "Stack-Underflow to_bool";
             pst->push_back(err);
             return;
         }
-        IlAtom res2 = pst->back();
+        IlAtom r1, res;
+        r1 = pst->back();
         pst->pop_back();
-        IlAtom res = pst->back();
-        pst->push_back(res2);
-        pst->push_back(res);
-        pst->push_back(res2);
-    }
-
-    void swap(vector<IlAtom> *pst) {
-        size_t l = pst->size();
-        if (l < 2) {
+        if (r1.t == INT) {
+            res.t = BOOL;
+            if (r1.vi) {
+                res.vb = true;
+                res.vs = "true";
+            } else {
+                res.vb = false;
+                res.vs = "false";
+            }
+            pst->push_back(res);
+        } else if (r1.t == FLOAT) {
+            res.t = BOOL;
+            if (r1.vf != 0.0) {
+                res.vb = true;
+                res.vs = "true";
+            } else {
+                res.vb = false;
+                res.vs = "false";
+            }
+            pst->push_back(res);
+        } else if (r1.t == BOOL) {
+            res.t = BOOL;
+            res.vb = r1.vb;
+            if (r1.vb) {
+                res.vs = "true";
+            } else {
+                res.vs = "false";
+            }
+            pst->push_back(res);
+        } else if (r1.t == STRING) {
+            res.t = BOOL;
+            if (r1.vs == "true") {
+                res.vb = true;
+                res.vs = "true";
+            } else {
+                res.vb = false;
+                res.vs = "false";
+            }
+            pst->push_back(res);
+        } else {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Stack-Underflow swap";
+            err.vs = "to_bool requires: INT, FLOAT, STRING, or BOOL";
             pst->push_back(err);
             return;
         }
-        IlAtom res2 = pst->back();
-        pst->pop_back();
-        IlAtom res = pst->back();
-        pst->pop_back();
-        pst->push_back(res2);
-        pst->push_back(res);
+        return;
     }
 
-    void drop(vector<IlAtom> *pst) {
+    void to_string(vector<IlAtom> *pst) {
         size_t l = pst->size();
         if (l < 1) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Stack-Underflow drop";
-            pst->push_back(err);
-            return;
-        }
-        pst->pop_back();
-    }
-
-    void range(vector<IlAtom> *pst) {
-        size_t l = pst->size();
-        if (l < 2) {
-            IlAtom err;
-            err.t = ERROR;
-            err.vs = "Stack-Underflow range";
+            err.vs = "Stack-Underflow to_string";
             pst->push_back(err);
             return;
         }
-        IlAtom r1, r2;
-        r2 = pst->back();
-        pst->pop_back();
+        IlAtom r1, res;
         r1 = pst->back();
         pst->pop_back();
-        if (r1.t != INT || r2.t != INT) {
+        if (r1.t == INT) {
+            res.t = STRING;
+            res.vs = std::to_string(r1.vi);
+            pst->push_back(res);
+        } else if (r1.t == FLOAT) {
+            res.t = STRING;
+            res.vs = std::to_string(r1.vf);
+            pst->push_back(res);
+        } else if (r1.t == BOOL) {
+            res.t = STRING;
+            if (r1.vb) {
+                res.vs = "true";
+            } else {
+                res.vs = "false";
+            }
+            pst->push_back(res);
+        } else if (r1.t == STRING) {
+            res.t = STRING;
+            res.vs = r1.vs;
+            pst->push_back(res);
+        } else {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Range required 2 INT args";
+            err.vs = "to_string requires: INT, FLOAT, STRING, or BOOL";
             pst->push_back(err);
             return;
         }
-        IlAtom r;
-        r.t = INT_ARRAY;
-        if (r1.vi <= r2.vi) {
-            for (auto i = r1.vi; i <= r2.vi; i++)
-                r.vai.push_back(i);
-        } else {
-            for (auto i = r1.vi; i >= r2.vi; i--)
-                r.vai.push_back(i);
-        }
-        pst->push_back(r);
+        return;
     }
 
-    void array_append(vector<IlAtom> *pst) {
+    void to_array(vector<IlAtom> *pst) {
         size_t l = pst->size();
-        if (l < 2) {
+        if (l < 1) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Stack-Underflow append";
+            err.vs = "Stack-Underflow to_array";
             pst->push_back(err);
             return;
         }
-        IlAtom r1, r2;
-        r2 = pst->back();
-        pst->pop_back();
+        IlAtom r1, res;
         r1 = pst->back();
         pst->pop_back();
-        if (r1.t == INT_ARRAY && r2.t == INT) {
-            r1.vai.push_back(r2.vi);
-            pst->push_back(r1);
-        } else if (r1.t == FLOAT_ARRAY && r2.t == FLOAT) {
-            r1.vaf.push_back(r2.vf);
-            pst->push_back(r1);
-        } else if (r1.t == BOOL_ARRAY && r2.t == BOOL) {
-            r1.vab.push_back(r2.vb);
-            pst->push_back(r1);
-        } else if (r1.t == STRING_ARRAY && r2.t == STRING) {
-            r1.vas.push_back(r2.vs);
-            pst->push_back(r1);
+        if (r1.t == INT) {
+            res.t = INT_ARRAY;
+            res.vai = {r1.vi};
+            pst->push_back(res);
+        } else if (r1.t == FLOAT) {
+            res.t = FLOAT_ARRAY;
+            res.vaf = {r1.vf};
+            pst->push_back(res);
+        } else if (r1.t == BOOL) {
+            res.t = BOOL_ARRAY;
+            res.vab = {r1.vb};
+            pst->push_back(res);
+        } else if (r1.t == STRING) {
+            res.t = STRING_ARRAY;
+            res.vas = {r1.vs};
+            pst->push_back(res);
         } else {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Append requires array and element of same type: INT, FLOAT, STRING, or BOOL";
+            err.vs = "to_array requires: INT, FLOAT, STRING, or BOOL";
             pst->push_back(err);
             return;
         }
         return;
     }
 
-    void array_remove(vector<IlAtom> *pst) {
+    void string_split(vector<IlAtom> *pst) {
         size_t l = pst->size();
         if (l < 2) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Stack-Underflow remove";
+            err.vs = "Stack-Underflow string_split";
             pst->push_back(err);
             return;
         }
@@ -586,856 +4847,1613 @@ class IndraLink {
         pst->pop_back();
         r1 = pst->back();
         pst->pop_back();
-        if (r1.t == INT_ARRAY && r2.t == INT) {
-            if (r2.vi >= r1.vai.size() || r2.vi < 0) {
-                IlAtom err;
-                err.t = ERROR;
-                err.vs = "Index-out-of-range-on-remove";
-                pst->push_back(err);
-                return;
-            }
-            r1.vai.erase(r1.vai.begin() + r2.vi);
-            pst->push_back(r1);
-        } else if (r1.t == FLOAT_ARRAY && r2.t == INT) {
-            if (r2.vi >= r1.vaf.size() || r2.vi < 0) {
-                IlAtom err;
-                err.t = ERROR;
-                err.vs = "Index-out-of-range-on-remove";
-                pst->push_back(err);
-                return;
-            }
-            r1.vaf.erase(r1.vaf.begin() + r2.vi);
-            pst->push_back(r1);
-        } else if (r1.t == BOOL_ARRAY && r2.t == INT) {
-            if (r2.vi >= r1.vab.size() || r2.vi < 0) {
-                IlAtom err;
-                err.t = ERROR;
-                err.vs = "Index-out-of-range-on-remove";
-                pst->push_back(err);
-                return;
-            }
-            r1.vab.erase(r1.vab.begin() + r2.vi);
-            pst->push_back(r1);
-        } else if (r1.t == STRING_ARRAY && r2.t == INT) {
-            if (r2.vi >= r1.vas.size() || r2.vi < 0) {
-                IlAtom err;
-                err.t = ERROR;
-                err.vs = "Index-out-of-range-on-remove";
-                pst->push_back(err);
-                return;
+        if (r1.t == STRING && r2.t == STRING) {
+            string s = r1.vs;
+            string sp = r2.vs;
+            IlAtom r;
+            r.t = STRING_ARRAY;
+            if (sp == "") {
+                for (auto c : s) {
+                    string cs{c};
+                    r.vas.push_back(cs);
+                }
+            } else {
+                size_t start = 0;
+                size_t p = s.find(sp);
+                while (p != string::npos) {
+                    r.vas.push_back(s.substr(start, p - start));
+                    start = p + sp.length();
+                    p = s.find(sp, start);
+                }
+                if (start < s.length()) r.vas.push_back(s.substr(start));
             }
-            r1.vas.erase(r1.vas.begin() + r2.vi);
-            pst->push_back(r1);
+            pst->push_back(r);
         } else {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Remove requires array of type: INT, FLOAT, STRING, or BOOL and an Index of type INT";
+            err.vs = "string_split requires two STRING vars";
             pst->push_back(err);
             return;
         }
-        return;
     }
 
-    void array_erase(vector<IlAtom> *pst) {
+    bool is_array_type(ilAtomTypes t) {
+        return t == INT_ARRAY || t == FLOAT_ARRAY || t == BOOL_ARRAY || t == STRING_ARRAY;
+    }
+
+    size_t array_size(const IlAtom &arr) {
+        switch (arr.t) {
+        case INT_ARRAY:
+            return arr.vai.size();
+        case FLOAT_ARRAY:
+            return arr.vaf.size();
+        case BOOL_ARRAY:
+            return arr.vab.size();
+        case STRING_ARRAY:
+            return arr.vas.size();
+        default:
+            return 0;
+        }
+    }
+
+    IlAtom array_element(const IlAtom &arr, size_t i) {
+        IlAtom el;
+        switch (arr.t) {
+        case INT_ARRAY:
+            el.t = INT;
+            el.vi = arr.vai[i];
+            el.vs = std::to_string(el.vi);
+            break;
+        case FLOAT_ARRAY:
+            el.t = FLOAT;
+            el.vf = arr.vaf[i];
+            el.vs = std::to_string(el.vf);
+            break;
+        case BOOL_ARRAY:
+            el.t = BOOL;
+            el.vb = arr.vab[i];
+            if (el.vb)
+                el.vs = "true";
+            else
+                el.vs = "false";
+            break;
+        case STRING_ARRAY:
+            el.t = STRING;
+            el.vs = arr.vas[i];
+            break;
+        default:
+            el.t = ERROR;
+            el.vs = "Not-an-array";
+            break;
+        }
+        return el;
+    }
+
+    bool array_push(IlAtom *parr, const IlAtom &el, size_t reserve = 0) {
+        // Appends a scalar to an array, an UNDEFINED array takes the type of its first element.
+        if (parr->t == UNDEFINED) {
+            switch (el.t) {
+            case INT:
+                parr->t = INT_ARRAY;
+                parr->vai.reserve(reserve);
+                break;
+            case FLOAT:
+                parr->t = FLOAT_ARRAY;
+                parr->vaf.reserve(reserve);
+                break;
+            case BOOL:
+                parr->t = BOOL_ARRAY;
+                parr->vab.reserve(reserve);
+                break;
+            case STRING:
+                parr->t = STRING_ARRAY;
+                parr->vas.reserve(reserve);
+                break;
+            default:
+                return false;
+            }
+        }
+        if (parr->t == INT_ARRAY && el.t == INT)
+            parr->vai.push_back(el.vi);
+        else if (parr->t == FLOAT_ARRAY && el.t == FLOAT)
+            parr->vaf.push_back(el.vf);
+        else if (parr->t == BOOL_ARRAY && el.t == BOOL)
+            parr->vab.push_back(el.vb);
+        else if (parr->t == STRING_ARRAY && el.t == STRING)
+            parr->vas.push_back(el.vs);
+        else
+            return false;
+        return true;
+    }
+
+    void array_map(vector<IlAtom> *pst) {
         size_t l = pst->size();
-        if (l < 1) {
+        if (l < 2) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Stack-Underflow remove";
+            err.vs = "Stack-Underflow map";
             pst->push_back(err);
             return;
         }
-        IlAtom r1;
-        r1 = pst->back();
+        IlAtom q, arr, res;
+        q = pst->back();
         pst->pop_back();
-        if (r1.t == INT_ARRAY) {
-            r1.vai.clear();
-            pst->push_back(r1);
-        } else if (r1.t == FLOAT_ARRAY) {
-            r1.vaf.clear();
-            pst->push_back(r1);
-        } else if (r1.t == BOOL_ARRAY) {
-            r1.vab.clear();
-            pst->push_back(r1);
-        } else if (r1.t == STRING_ARRAY) {
-            r1.vas.clear();
-            pst->push_back(r1);
-        } else {
+        arr = pst->back();
+        pst->pop_back();
+        if (q.t != QUOTE || !is_array_type(arr.t)) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Erase requires array of type: INT, FLOAT, STRING, or BOOL";
+            err.vs = "Map requires array of type: INT, FLOAT, STRING, or BOOL and a quote";
             pst->push_back(err);
             return;
         }
-        return;
-    }
-
-    void array_update(vector<IlAtom> *pst) {
-        size_t l = pst->size();
-        if (l < 3) {
+        vector<IlAtom> code, qst;
+        IlLocals quote_symbols;
+        if (!compile(*q.vq, pst, &code)) return;
+        size_t n = array_size(arr);
+        res.t = UNDEFINED;
+        IlThreadPool *pool = par_pool(n);
+        if (pool && is_pure_code(code)) {
+            vector<IlAtom> results;
             IlAtom err;
-            err.t = ERROR;
-            err.vs = "Stack-Underflow update";
-            pst->push_back(err);
-            return;
-        }
-        IlAtom r1, r2, r3;
-        r3 = pst->back();
-        pst->pop_back();
-        r2 = pst->back();
-        pst->pop_back();
-        r1 = pst->back();
-        pst->pop_back();
-        if (r1.t == INT_ARRAY && r2.t == INT && r3.t == INT) {
-            if (r2.vi >= r1.vai.size() || r2.vi < 0) {
-                IlAtom err;
-                err.t = ERROR;
-                err.vs = "Index-out-of-range-on-update";
-                pst->push_back(err);
-                return;
-            }
-            r1.vai[r2.vi] = r3.vi;
-            pst->push_back(r1);
-        } else if (r1.t == FLOAT_ARRAY && r2.t == INT && r3.t == FLOAT) {
-            if (r2.vi >= r1.vaf.size() || r2.vi < 0) {
-                IlAtom err;
-                err.t = ERROR;
-                err.vs = "Index-out-of-range-on-update";
+            err.t = ERROR;
+            err.vs = "Map-quote-must-leave-one-value-of-same-type: INT, FLOAT, STRING, or BOOL";
+            if (!quote_results_par(code, arr, &results, &err, err.vs, pool)) {
                 pst->push_back(err);
                 return;
             }
-            r1.vaf[r2.vi] = r3.vf;
-            pst->push_back(r1);
-        } else if (r1.t == BOOL_ARRAY && r2.t == INT && r3.t == BOOL) {
-            if (r2.vi >= r1.vab.size() || r2.vi < 0) {
-                IlAtom err;
-                err.t = ERROR;
-                err.vs = "Index-out-of-range-on-update";
-                pst->push_back(err);
+            for (const auto &r : results) {
+                if (!array_push(&res, r, n)) {
+                    pst->push_back(err);
+                    return;
+                }
+            }
+            if (res.t == UNDEFINED) {  // empty, as in the serial path
+                res = arr;
+            }
+            pst->push_back(res);
+            return;
+        }
+        for (size_t i = 0; i < n; i++) {
+            qst.clear();
+            qst.push_back(array_element(arr, i));
+            if (!exec(code, &qst, quote_symbols)) {
+                if (qst.size() > 0) pst->push_back(qst.back());
                 return;
             }
-            r1.vab[r2.vi] = r3.vb;
-            pst->push_back(r1);
-        } else if (r1.t == STRING_ARRAY && r2.t == INT && r3.t == STRING) {
-            if (r2.vi >= r1.vas.size() || r2.vi < 0) {
+            if (qst.size() != 1 || !array_push(&res, qst.back(), n)) {
                 IlAtom err;
                 err.t = ERROR;
-                err.vs = "Index-out-of-range-on-update";
+                err.vs = "Map-quote-must-leave-one-value-of-same-type: INT, FLOAT, STRING, or BOOL";
                 pst->push_back(err);
                 return;
             }
-            r1.vas[r2.vi] = r3.vs;
-            pst->push_back(r1);
-        } else {
-            IlAtom err;
-            err.t = ERROR;
-            err.vs = "Update requires array of type: INT, FLOAT, STRING, or BOOL and an Index of type INT, and a Value of same type as the array.";
-            pst->push_back(err);
-            return;
         }
-        return;
+        if (res.t == UNDEFINED) {
+            res = arr;
+        }
+        pst->push_back(res);
     }
 
-    void array_index(vector<IlAtom> *pst) {
+    void array_filter(vector<IlAtom> *pst) {
         size_t l = pst->size();
         if (l < 2) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Stack-Underflow index";
+            err.vs = "Stack-Underflow filter";
             pst->push_back(err);
             return;
         }
-        IlAtom r1, r2, res;
-        r2 = pst->back();
+        IlAtom q, arr, res;
+        q = pst->back();
         pst->pop_back();
-        r1 = pst->back();
+        arr = pst->back();
         pst->pop_back();
-        if (r1.t == INT_ARRAY && r2.t == INT) {
-            if (r2.vi >= r1.vai.size() || r2.vi < 0) {
-                IlAtom err;
-                err.t = ERROR;
-                err.vs = "Index-out-of-range-on-index";
+        if (q.t != QUOTE || !is_array_type(arr.t)) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Filter requires array of type: INT, FLOAT, STRING, or BOOL and a quote";
+            pst->push_back(err);
+            return;
+        }
+        vector<IlAtom> code, qst;
+        IlLocals quote_symbols;
+        if (!compile(*q.vq, pst, &code)) return;
+        size_t n = array_size(arr);
+        res.t = arr.t;
+        IlThreadPool *pool = par_pool(n);
+        if (pool && is_pure_code(code)) {
+            vector<IlAtom> results;
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Filter-quote-must-leave-one-BOOL-or-INT";
+            if (!quote_results_par(code, arr, &results, &err, err.vs, pool)) {
                 pst->push_back(err);
                 return;
             }
-            res.t = INT;
-            res.vi = r1.vai[r2.vi];
-            res.vs = std::to_string(res.vi);
+            for (size_t i = 0; i < n; i++) {
+                const IlAtom &r = results[i];
+                if (r.t != BOOL && r.t != INT) {
+                    pst->push_back(err);
+                    return;
+                }
+                if ((r.t == BOOL && r.vb) || (r.t == INT && r.vi != 0))
+                    array_push(&res, array_element(arr, i));
+            }
             pst->push_back(res);
-        } else if (r1.t == FLOAT_ARRAY && r2.t == INT) {
-            if (r2.vi >= r1.vaf.size() || r2.vi < 0) {
-                IlAtom err;
-                err.t = ERROR;
-                err.vs = "Index-out-of-range-on-index";
-                pst->push_back(err);
+            return;
+        }
+        for (size_t i = 0; i < n; i++) {
+            IlAtom el = array_element(arr, i);
+            qst.clear();
+            qst.push_back(el);
+            if (!exec(code, &qst, quote_symbols)) {
+                if (qst.size() > 0) pst->push_back(qst.back());
                 return;
             }
-            res.t = FLOAT;
-            res.vf = r1.vaf[r2.vi];
-            res.vs = std::to_string(res.vf);
-            pst->push_back(res);
-        } else if (r1.t == BOOL_ARRAY && r2.t == INT) {
-            if (r2.vi >= r1.vab.size() || r2.vi < 0) {
+            if (qst.size() != 1 || (qst.back().t != BOOL && qst.back().t != INT)) {
                 IlAtom err;
                 err.t = ERROR;
-                err.vs = "Index-out-of-range-on-index";
+                err.vs = "Filter-quote-must-leave-one-BOOL-or-INT";
                 pst->push_back(err);
                 return;
             }
-            res.t = BOOL;
-            res.vb = r1.vab[r2.vi];
-            if (res.vb)
-                res.vs = "true";
-            else
-                res.vs = "false";
-            pst->push_back(res);
-        } else if (r1.t == STRING_ARRAY && r2.t == INT) {
-            if (r2.vi >= r1.vas.size() || r2.vi < 0) {
-                IlAtom err;
-                err.t = ERROR;
-                err.vs = "Index-out-of-range-on-index";
-                pst->push_back(err);
+            if ((qst.back().t == BOOL && qst.back().vb) || (qst.back().t == INT && qst.back().vi != 0))
+                array_push(&res, el);
+        }
+        pst->push_back(res);
+    }
+
+    void array_reduce(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 3) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow reduce";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom q, acc, arr;
+        q = pst->back();
+        pst->pop_back();
+        acc = pst->back();
+        pst->pop_back();
+        arr = pst->back();
+        pst->pop_back();
+        if (q.t != QUOTE || !is_array_type(arr.t)) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Reduce requires array of type: INT, FLOAT, STRING, or BOOL, an initial value and a quote";
+            pst->push_back(err);
+            return;
+        }
+        vector<IlAtom> code, qst;
+        IlLocals quote_symbols;
+        if (!compile(*q.vq, pst, &code)) return;
+        size_t n = array_size(arr);
+        for (size_t i = 0; i < n; i++) {
+            qst.clear();
+            qst.push_back(acc);
+            qst.push_back(array_element(arr, i));
+            if (!exec(code, &qst, quote_symbols)) {
+                if (qst.size() > 0) pst->push_back(qst.back());
                 return;
             }
-            res.t = STRING;
-            res.vs = r1.vas[r2.vi];
-            pst->push_back(res);
-        } else if (r1.t == STRING && r2.t == INT) {
-            if (r2.vi >= r1.vs.length() || r2.vi < 0) {
+            if (qst.size() != 1) {
                 IlAtom err;
                 err.t = ERROR;
-                err.vs = "Index-out-of-range-on-string-index";
+                err.vs = "Reduce-quote-must-leave-one-value";
                 pst->push_back(err);
                 return;
             }
-            res.t = STRING;
-            string cs{r1.vs[r2.vi]};
-            res.vs = cs;
-            pst->push_back(res);
-        } else {
+            acc = qst.back();
+        }
+        pst->push_back(acc);
+    }
+
+    void array_each(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        if (l < 2) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Update requires array of type: INT, FLOAT, STRING, or BOOL and an Index of type INT, and a Value of same type as the array.";
+            err.vs = "Stack-Underflow each";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom q, arr;
+        q = pst->back();
+        pst->pop_back();
+        arr = pst->back();
+        pst->pop_back();
+        if (q.t != QUOTE || !is_array_type(arr.t)) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Each requires array of type: INT, FLOAT, STRING, or BOOL and a quote";
             pst->push_back(err);
             return;
         }
-        return;
+        vector<IlAtom> code;
+        IlLocals quote_symbols;
+        if (!compile(*q.vq, pst, &code)) return;
+        size_t n = array_size(arr);
+        for (size_t i = 0; i < n; i++) {
+            pst->push_back(array_element(arr, i));
+            if (!exec(code, pst, quote_symbols)) return;
+        }
+    }
+
+    void print(vector<IlAtom> *pst) {
+        IlAtom res = pst->back();
+        if (res.t == STRING)
+            out << res.vs;
+        else
+            out << res.str();
+        pst->pop_back();
+    }
+
+    void flush_output(vector<IlAtom> *pst) {
+        out.flush();
+    }
+
+    void stack_size(vector<IlAtom> *pst) {
+        size_t l = pst->size();
+        IlAtom res;
+        res.t = INT;
+        res.vi = l;
+        res.vs = std::to_string(l);
+        pst->push_back(res);
+    }
+
+    void show_stack(vector<IlAtom> *pst) {
+        out << "⟦";
+        bool first = true;
+        for (auto il : *pst) {
+            if (first) {
+                first = false;
+            } else {
+                out << ", ";
+            }
+            out << il.str();
+        }
+        out << "⟧" << "\n";
+    }
+
+    void clear_stack(vector<IlAtom> *pst) {
+        pst->clear();
+    }
+
+    void list_vars(vector<IlAtom> *pst, IlLocals *local_symbols = nullptr) {
+        if (local_symbols) {
+            out << "--- Local ----------" << "\n";
+            for (const auto &symPair : *local_symbols) {
+                IlAtom il = symPair.second;
+                out << il.str() << " >" << symPair.first << "\n";
+            }
+        }
+        out << "--- Global ---------" << "\n";
+        for (const auto &symPair : globals()) {
+            IlAtom il = symPair.second;
+            out << il.str() << " >" << symPair.first << "\n";
+        }
+        out << "--------------------" << "\n";
+    }
+
+    void list_funcs(vector<IlAtom> *pst) {
+        std::set<string> names;
+        for (const auto &funcPair : funcs) names.insert(funcPair.first);
+        if (library) {
+            for (const auto &funcPair : library->funcs) names.insert(funcPair.first);
+        }
+        for (const auto &name : names) show_func(name);
+    }
+
+    void image_atom(IlImageWriter *pw, const IlAtom &a) {
+        // Appends the record of a (and of the body of a QUOTE) to the image.
+        if (a.t == ARRAY_VIEW) {
+            IlAtom m = a;
+            force_view(&m);
+            image_atom(pw, m);
+            return;
+        }
+        IlImageAtom r;
+        memset(&r, 0, sizeof(r));
+        r.t = a.t;
+        r.vs = pw->intern(a.vs);
+        r.name = pw->intern(a.name);
+        switch (a.t) {
+        case INT:
+            r.vi = a.vi;
+            break;
+        case FLOAT:
+            memcpy(&r.data, &a.vf, sizeof(r.data));
+            break;
+        case BOOL:
+            r.vb = a.vb;
+            break;
+        case INT_ARRAY:
+            r.n = a.vai.size();
+            r.data = pw->pool_add(a.vai.data(), a.vai.size() * sizeof(int));
+            break;
+        case FLOAT_ARRAY:
+            r.n = a.vaf.size();
+            r.data = pw->pool_add(a.vaf.data(), a.vaf.size() * sizeof(double));
+            break;
+        case BOOL_ARRAY: {
+            vector<uint8_t> b(a.vab.begin(), a.vab.end());
+            r.n = b.size();
+            r.data = pw->pool_add(b.data(), b.size());
+        } break;
+        case STRING_ARRAY: {
+            vector<uint32_t> idx;
+            idx.reserve(a.vas.size());
+            for (const auto &s : a.vas) idx.push_back(pw->intern(s));
+            r.n = idx.size();
+            r.data = pw->pool_add(idx.data(), idx.size() * sizeof(uint32_t));
+        } break;
+        case QUOTE:
+            r.n = a.vq ? a.vq->size() : 0;
+            pw->records.push_back(r);
+            if (a.vq)
+                for (const auto &qa : *a.vq) image_atom(pw, qa);
+            return;
+        default:
+            break;
+        }
+        pw->records.push_back(r);
+    }
+
+    typedef vector<const IlInbuilt *> IlBoundInbuilts;
+
+    bool read_image_atom(IlImageReader *pr, IlBoundInbuilts *pbound, IlAtom *pa, string *perr, int depth = 0) {
+        // Reads the next atom, IFUNCs are bound to the inbuilt of their name, resolved once per name.
+        IlImageAtom r;
+        const char *p;
+        if (!pr->read(&r) || r.t == UNDEFINED || r.t == ARRAY_VIEW || r.t > ERROR || depth > 1000) {
+            *perr = "Image-corrupt-records";
+            return false;
+        }
+        IlAtom &a = *pa;
+        a.t = (ilAtomTypes)r.t;
+        a.vs = pr->names[r.vs];
+        a.name = pr->names[r.name];
+        switch (a.t) {
+        case INT:
+            a.vi = r.vi;
+            return true;
+        case FLOAT:
+            memcpy(&a.vf, &r.data, sizeof(a.vf));
+            return true;
+        case BOOL:
+            a.vb = r.vb != 0;
+            return true;
+        case INT_ARRAY:
+            if (!(p = pr->pool_data(r, sizeof(int)))) break;
+            a.vai.resize(r.n);
+            if (r.n) memcpy(a.vai.data(), p, r.n * sizeof(int));
+            return true;
+        case FLOAT_ARRAY:
+            if (!(p = pr->pool_data(r, sizeof(double)))) break;
+            a.vaf.resize(r.n);
+            if (r.n) memcpy(a.vaf.data(), p, r.n * sizeof(double));
+            return true;
+        case BOOL_ARRAY:
+            if (!(p = pr->pool_data(r, 1))) break;
+            a.vab.assign(p, p + r.n);
+            return true;
+        case STRING_ARRAY:
+            if (!(p = pr->pool_data(r, sizeof(uint32_t)))) break;
+            a.vas.reserve(r.n);
+            for (uint32_t i = 0; i < r.n; i++) {
+                uint32_t idx;
+                memcpy(&idx, p + i * sizeof(idx), sizeof(idx));
+                if (idx >= pr->names.size()) {
+                    *perr = "Image-corrupt-records";
+                    return false;
+                }
+                a.vas.push_back(pr->names[idx]);
+            }
+            return true;
+        case QUOTE:
+            if (r.n > pr->n_records - pr->next) break;
+            a.vq = std::make_shared<vector<IlAtom>>(r.n);
+            for (auto &qa : *a.vq)
+                if (!read_image_atom(pr, pbound, &qa, perr, depth + 1)) return false;
+            return true;
+        case IFUNC:
+            if (!(*pbound)[r.vs]) {
+                (*pbound)[r.vs] = find_inbuilt(a.vs);
+                if (!(*pbound)[r.vs]) {
+                    *perr = "Image-unknown-inbuilt: " + a.vs;
+                    return false;
+                }
+            }
+            a.vif = *(*pbound)[r.vs];
+            return true;
+        default:
+            return true;
+        }
+        *perr = "Image-corrupt-records";
+        return false;
+    }
+
+    void image_func(IlImageWriter *pw, const string &name, const vector<IlAtom> &func) {
+        IlImageAtom r;
+        memset(&r, 0, sizeof(r));
+        r.t = DEF_WORD;
+        r.vs = pw->intern(":");
+        r.name = pw->intern(name);
+        r.n = func.size();
+        pw->records.push_back(r);
+        for (const auto &a : func) image_atom(pw, a);
+    }
+
+    void image_name(IlImageWriter *pw, ilAtomTypes t, const string &name) {
+        IlImageAtom r;
+        memset(&r, 0, sizeof(r));
+        r.t = t;
+        r.vs = pw->intern("");
+        r.name = pw->intern(name);
+        pw->records.push_back(r);
+    }
+
+    bool read_image(IlImageReader *prd, IlImageContents *pc, string *perr) {
+        // Reads all entries of an image that has been opened by prd.
+        IlBoundInbuilts bound(prd->names.size(), nullptr);
+        IlImageAtom r;
+        while (prd->next < prd->n_records) {
+            if (!prd->read(&r)) {
+                *perr = "Image-corrupt-records";
+                return false;
+            }
+            const string &name = prd->names[r.name];
+            switch (r.t) {
+            case DEF_WORD: {
+                if (r.n > prd->n_records - prd->next) {
+                    *perr = "Image-corrupt-records";
+                    return false;
+                }
+                vector<IlAtom> &func = pc->funcs[name];
+                func.resize(r.n);
+                for (auto &a : func)
+                    if (!read_image_atom(prd, &bound, &a, perr)) return false;
+            } break;
+            case STORE_SYMBOL:
+                if (!read_image_atom(prd, &bound, &pc->symbols[name], perr)) return false;
+                break;
+            case DELETE_FUNC:
+                pc->deleted_funcs.push_back(name);
+                break;
+            case DELETE_SYMBOL:
+                pc->deleted_symbols.push_back(name);
+                break;
+            default:
+                *perr = "Image-corrupt-records";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool save_image(const string &path, string *perr) {
+        // Writes all functions as a binary image: their parsed atoms, with names and strings interned
+        // and array literals in the constant pool.
+        IlImageWriter w;
+        for (const auto &funcPair : funcs) image_func(&w, funcPair.first, funcPair.second);
+        return w.write(path, perr);
+    }
+
+    bool load_image(const char *data, size_t size, string *perr) {
+        // Defines the functions of a binary image, nothing is defined if the image is invalid.
+        IlImageReader rd;
+        IlImageContents c;
+        if (!rd.open(data, size, perr)) return false;
+        if (rd.kind != il_image_library) return restore(data, size, perr);
+        if (!read_image(&rd, &c, perr)) return false;
+        for (auto &funcPair : c.funcs) funcs[funcPair.first].swap(funcPair.second);
+        clear_eval_cache();
+        return true;
+    }
+
+    bool load_image(const string &path, string *perr) {
+        IlMappedFile f;
+        if (!f.open(path)) {
+            *perr = "Cannot-open-image: " + path;
+            return false;
+        }
+        return load_image(f.data, f.size, perr);
+    }
+
+    bool snapshot(const string &path, bool incremental, string *perr) {
+        // Writes functions and globals as a snapshot image to path. Incremental snapshots only contain
+        // what has been changed or deleted since the previous snapshot, they are appended to path.
+        if (incremental && !track_changes) {
+            *perr = "Snapshotinc-without-snapshot";
+            return false;
+        }
+        IlImageWriter w;
+        w.kind = incremental ? il_image_delta : il_image_snapshot;
+        if (incremental) {
+            for (const auto &name : changed_funcs) {
+                auto it = funcs.find(name);
+                if (it != funcs.end())
+                    image_func(&w, name, it->second);
+                else
+                    image_name(&w, DELETE_FUNC, name);
+            }
+            for (const auto &name : changed_symbols) {
+                auto it = symbols.find(name);
+                if (it != symbols.end() && it->second.t < FILE_STREAM) {
+                    image_name(&w, STORE_SYMBOL, name);
+                    image_atom(&w, it->second);
+                } else {
+                    image_name(&w, DELETE_SYMBOL, name);
+                }
+            }
+        } else {
+            for (const auto &funcPair : funcs) image_func(&w, funcPair.first, funcPair.second);
+            for (const auto &symPair : symbols) {
+                if (symPair.second.t >= FILE_STREAM) continue;  // runtime handles (open files etc.) can't be restored
+                image_name(&w, STORE_SYMBOL, symPair.first);
+                image_atom(&w, symPair.second);
+            }
+        }
+        if (!w.write(path, perr, incremental)) return false;
+        changed_funcs.clear();
+        changed_symbols.clear();
+        track_changes = true;
+        return true;
+    }
+
+    bool restore(const char *data, size_t size, string *perr, size_t *pvalid = nullptr) {
+        // Restores a snapshot and the incremental snapshots appended to it. A snapshot replaces all functions
+        // and globals. An invalid first image fails the restore, an invalid later one (e.g. from an interrupted
+        // snapshotinc) ends it. pvalid receives the size of the valid images.
+        size_t off = 0;
+        int n_images = 0;
+        while (off < size) {
+            IlImageReader rd;
+            IlImageContents c;
+            string err;
+            if (!rd.open(data + off, size - off, &err) || (n_images == 0 && rd.kind != il_image_snapshot) ||
+                !read_image(&rd, &c, &err)) {
+                if (n_images == 0) {
+                    *perr = err != "" ? err : "Restore-requires-snapshot";
+                    return false;
+                }
+                break;
+            }
+            if (rd.kind == il_image_snapshot) {
+                funcs.swap(c.funcs);
+                symbols.swap(c.symbols);
+            } else {
+                for (const auto &name : c.deleted_funcs) funcs.erase(name);
+                for (const auto &name : c.deleted_symbols) symbols.erase(name);
+                for (auto &funcPair : c.funcs) funcs[funcPair.first].swap(funcPair.second);
+                for (auto &symPair : c.symbols) symbols[symPair.first] = symPair.second;
+            }
+            ++n_images;
+            off += rd.image_size;
+        }
+        if (pvalid) *pvalid = off;
+        changed_funcs.clear();
+        changed_symbols.clear();
+        track_changes = true;
+        clear_eval_cache();
+        globals_snapshot.reset();
+        return true;
     }
 
-    void array_sum(vector<IlAtom> *pst) {
+    bool restore(const string &path, string *perr) {
+        IlMappedFile f;
+        if (!f.open(path)) {
+            *perr = "Cannot-open-image: " + path;
+            return false;
+        }
+        size_t valid;
+        if (!restore(f.data, f.size, perr, &valid)) return false;
+        size_t size = f.size;
+        f.close();
+        if (valid < size && !IlImageWriter::truncate_file(path, valid)) {
+            // The torn tail would hide the increments appended after it.
+            *perr = "Cannot-remove-incomplete-increment: " + path;
+            return false;
+        }
+        return true;
+    }
+
+    void file_word(vector<IlAtom> *pst, const string &word, std::function<bool(const string &, string *)> fn) {
+        // Runs fn with the filename from the stack, errors are pushed onto the stack.
         size_t l = pst->size();
         if (l < 1) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Stack-Underflow sum";
+            err.vs = "Stack-Underflow-no-filename-on-" + word;
             pst->push_back(err);
             return;
         }
-        IlAtom r1, res;
-        r1 = pst->back();
+        IlAtom filedesc = pst->back();
         pst->pop_back();
-        if (r1.t == INT_ARRAY) {
-            res.t = INT;
-            res.vi = 0;
-            for (auto n : r1.vai)
-                res.vi += n;
-            res.vs = std::to_string(res.vi);
-            pst->push_back(res);
-        } else if (r1.t == FLOAT_ARRAY) {
-            res.t = FLOAT;
-            res.vf = 0.0;
-            for (auto f : r1.vaf)
-                res.vf += f;
-            res.vs = std::to_string(res.vf);
-            pst->push_back(res);
-        } else if (r1.t == BOOL_ARRAY) {
-            res.t = BOOL;
-            res.vb = true;
-            for (auto b : r1.vab)
-                if (!b) res.vb = false;
-            if (res.vb)
-                res.vs = "true";
-            else
-                res.vs = "false";
-            pst->push_back(res);
-        } else if (r1.t == STRING_ARRAY) {
-            res.t = STRING;
-            res.vs = "";
-            for (auto s : r1.vas)
-                res.vs += s;
-            pst->push_back(res);
+        string err_msg;
+        if (filedesc.t != STRING) {
+            err_msg = "filename-must-be-string-on-" + word;
         } else {
+            fn(filedesc.vs, &err_msg);
+        }
+        if (err_msg != "") {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Sum requires array of type: INT, FLOAT, STRING, or BOOL";
+            err.vs = err_msg;
             pst->push_back(err);
-            return;
         }
-        return;
     }
 
-    void array_or_string_len(vector<IlAtom> *pst) {
+    void save(vector<IlAtom> *pst) {
         size_t l = pst->size();
         if (l < 1) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Stack-Underflow sum";
+            err.vs = "Stack-Underflow-no-filename-on-save";
             pst->push_back(err);
             return;
         }
-        IlAtom r1, res;
-        r1 = pst->back();
+        IlAtom filedesc = pst->back();
         pst->pop_back();
-        if (r1.t == INT_ARRAY) {
-            res.t = INT;
-            res.vi = r1.vai.size();
-            res.vs = std::to_string(res.vi);
-            pst->push_back(res);
-        } else if (r1.t == FLOAT_ARRAY) {
-            res.t = INT;
-            res.vi = r1.vaf.size();
-            res.vs = std::to_string(res.vi);
-            pst->push_back(res);
-        } else if (r1.t == BOOL_ARRAY) {
-            res.t = INT;
-            res.vi = r1.vab.size();
-            res.vs = std::to_string(res.vi);
-            pst->push_back(res);
-        } else if (r1.t == STRING_ARRAY) {
-            res.t = INT;
-            res.vi = r1.vas.size();
-            res.vs = std::to_string(res.vi);
-            pst->push_back(res);
-        } else if (r1.t == STRING) {
-            res.t = INT;
-            res.vi = r1.vs.length();
-            res.vs = std::to_string(res.vi);
-            pst->push_back(res);
-        } else {
+        if (filedesc.t != STRING) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Sum requires array of type: INT, FLOAT, STRING, or BOOL";
+            err.vs = "filename-must-be-string-on-save";
             pst->push_back(err);
             return;
         }
-        return;
+        FILE *fp = fopen(filedesc.vs.c_str(), "w");
+        if (fp) {
+            for (const auto &funcPair : funcs) {
+                string name = funcPair.first;
+                vector<IlAtom> func = funcPair.second;
+                fprintf(fp, ": %s ", name.c_str());
+                for (auto il : func) {
+                    string enc_line = il.str();
+                    // replaceAll(enc_line, "\\", "\\\\");
+                    fprintf(fp, "%s ", enc_line.c_str());
+                }
+                fprintf(fp, ";\n");
+            }
+            fclose(fp);
+        }
     }
-    void to_int(vector<IlAtom> *pst) {
+
+    void load(vector<IlAtom> *pst) {
         size_t l = pst->size();
         if (l < 1) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Stack-Underflow to_int";
+            err.vs = "Stack-Underflow-no-filename-on-load";
             pst->push_back(err);
             return;
         }
-        IlAtom r1, res;
-        r1 = pst->back();
+        IlAtom filedesc = pst->back();
         pst->pop_back();
-        if (r1.t == INT) {
-            res.t = INT;
-            res.vi = {r1.vi};
-            res.vs = std::to_string(res.vi);
-            pst->push_back(res);
-        } else if (r1.t == FLOAT) {
-            res.t = INT;
-            res.vi = (int)r1.vf;
-            res.vs = std::to_string(res.vi);
-            pst->push_back(res);
-        } else if (r1.t == BOOL) {
-            res.t = INT;
-            if (r1.t)
-                res.vi = 1;
-            else
-                res.vi = 0;
-            res.vs = std::to_string(res.vi);
-            pst->push_back(res);
-        } else if (r1.t == STRING) {
-            if (is_int(r1.vs)) {
-                res.t = INT;
-                res.vi = atoi(r1.vs.c_str());
-            } else {
-                res.t = ERROR;
-                res.vs = "Can't convert: " + r1.vs = " to int";
-            }
-            pst->push_back(res);
-        } else {
+        if (filedesc.t != STRING) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "to_int requires: INT, FLOAT, STRING, or BOOL";
+            err.vs = "filename-must-be-string-on-load";
             pst->push_back(err);
             return;
         }
-        return;
+        load_file(filedesc.vs, pst);
     }
 
-    void to_float(vector<IlAtom> *pst) {
+    bool load_file(const string &path, vector<IlAtom> *pst, bool *pfound = nullptr) {
+        // Loads and evaluates a script, or loads a binary image. Returns false on errors (reported like
+        // the errors of eval, if the file doesn't exist, *pfound is set to false).
+        IlMappedFile f;
+        bool found = f.open(path);
+        if (pfound) *pfound = found;
+        if (!found) return false;
+        if (IlImageReader::is_image(f.data, f.size)) {
+            string err_msg;
+            if (!load_image(f.data, f.size, &err_msg)) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = err_msg;
+                pst->push_back(err);
+                return false;
+            }
+            return true;
+        }
+        string cmd(f.data, f.size);
+        replaceAll(cmd, "\\n", "\n");
+        vector<IlAtom> ps = parse(cmd);
+        return eval(ps, pst);
+    }
+
+    void file_open(vector<IlAtom> *pst, bool chunks) {
+        // "file" openlines, "file" size openchunks -> FILE_STREAM for 'for'
         size_t l = pst->size();
-        if (l < 1) {
+        if (l < (chunks ? 2 : 1)) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Stack-Underflow to_float";
+            err.vs = chunks ? "Stack-Underflow openchunks" : "Stack-Underflow openlines";
             pst->push_back(err);
             return;
         }
-        IlAtom r1, res;
-        r1 = pst->back();
+        IlAtom rs, rf, res;
+        rs.t = INT;
+        rs.vi = 0;
+        if (chunks) {
+            rs = pst->back();
+            pst->pop_back();
+        }
+        rf = pst->back();
         pst->pop_back();
-        if (r1.t == INT) {
-            res.t = FLOAT;
-            res.vf = (double)r1.vi;
-            res.vs = std::to_string(res.vf);
-            pst->push_back(res);
-        } else if (r1.t == FLOAT) {
-            res.t = FLOAT;
-            res.vf = r1.vf;
-            res.vs = std::to_string(r1.vf);
-            pst->push_back(res);
-        } else if (r1.t == BOOL) {
-            res.t = FLOAT;
-            if (r1.t)
-                res.vf = 1.0;
-            else
-                res.vf = 0.0;
-            res.vs = std::to_string(res.vf);
-            pst->push_back(res);
-        } else if (r1.t == STRING) {
-            if (is_float(r1.vs)) {
-                res.t = FLOAT;
-                res.vf = atof(r1.vs.c_str());
-            } else {
-                res.t = ERROR;
-                res.vs = "Can't convert: " + r1.vs = " to float";
-            }
-            pst->push_back(res);
+        string err_msg;
+        if (rf.t != STRING || rs.t != INT || (chunks && rs.vi < 1)) {
+            err_msg = chunks ? "Openchunks requires STRING filename and INT size > 0" : "Openlines requires STRING filename";
         } else {
-            IlAtom err;
-            err.t = ERROR;
-            err.vs = "to_float requires: INT, FLOAT, STRING, or BOOL";
-            pst->push_back(err);
-            return;
+            res.t = FILE_STREAM;
+            res.vs = rf.vs;
+            res.vfs = std::make_shared<IlFileStream>();
+            if (res.vfs->open(rf.vs, rs.vi)) {
+                pst->push_back(res);
+                return;
+            }
+            err_msg = "Cannot-open-file: " + rf.vs;
         }
-        return;
+        IlAtom err;
+        err.t = ERROR;
+        err.vs = err_msg;
+        pst->push_back(err);
     }
 
-    void to_bool(vector<IlAtom> *pst) {
+    void push_csv(IlCsvReader *prd, vector<IlAtom> *pst) {
+        // Column arrays in file order, then the column names as STRING array.
+        for (auto &col : prd->cols) pst->push_back(std::move(col));
+        IlAtom names;
+        names.t = STRING_ARRAY;
+        names.vas = prd->names;
+        pst->push_back(names);
+    }
+
+    bool csv_next(IlFileStream *fs, IlCsvReader *prd, string *perr) {
+        // Reads the next chunk of a CSV stream into prd, the first call reads the header. False at the end.
+        string text;
+        if (fs->csv_names.empty()) {
+            const char *p;
+            if (fs->next_records(1, &text)) {
+                p = text.data();
+                if (!prd->read_header(&p, text.data() + text.size())) {
+                    *perr = prd->err;
+                    return false;
+                }
+                fs->csv_names = prd->names;
+            }
+        }
+        if (!fs->next_records(fs->csv_rows, &text)) return false;
+        prd->names = fs->csv_names;
+        if (!prd->read(text.data(), text.data() + text.size())) {
+            *perr = prd->err;
+            return false;
+        }
+        return true;
+    }
+
+    void csv_read(vector<IlAtom> *pst, bool from_file) {
+        // "file" "," readcsv, "text" "," parsecsv -> column arrays... names
         size_t l = pst->size();
-        if (l < 1) {
+        if (l < 2) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Stack-Underflow to_bool";
+            err.vs = from_file ? "Stack-Underflow readcsv" : "Stack-Underflow parsecsv";
             pst->push_back(err);
             return;
         }
-        IlAtom r1, res;
-        r1 = pst->back();
+        IlAtom rd, rs;
+        rd = pst->back();
         pst->pop_back();
-        if (r1.t == INT) {
-            res.t = BOOL;
-            if (r1.vi) {
-                res.vb = true;
-                res.vs = "true";
-            } else {
-                res.vb = false;
-                res.vs = "false";
-            }
-            pst->push_back(res);
-        } else if (r1.t == FLOAT) {
-            res.t = BOOL;
-            if (r1.vf != 0.0) {
-                res.vb = true;
-                res.vs = "true";
-            } else {
-                res.vb = false;
-                res.vs = "false";
-            }
-            pst->push_back(res);
-        } else if (r1.t == BOOL) {
-            res.t = BOOL;
-            res.vb = r1.vb;
-            if (r1.vb) {
-                res.vs = "true";
-            } else {
-                res.vs = "false";
+        rs = pst->back();
+        pst->pop_back();
+        string err_msg;
+        if (rs.t != STRING || rd.t != STRING || rd.vs.length() != 1) {
+            err_msg = from_file ? "Readcsv requires STRING filename and one char delimiter" : "Parsecsv requires STRING text and one char delimiter";
+        } else {
+            IlMappedFile f;
+            const char *p = rs.vs.data(), *end = p + rs.vs.size();
+            if (from_file) {
+                if (!f.open(rs.vs)) {
+                    err_msg = "Cannot-open-file: " + rs.vs;
+                } else {
+                    p = f.data;
+                    end = p + f.size;
+                }
             }
-            pst->push_back(res);
-        } else if (r1.t == STRING) {
-            res.t = BOOL;
-            if (r1.vs == "true") {
-                res.vb = true;
-                res.vs = "true";
-            } else {
-                res.vb = false;
-                res.vs = "false";
+            IlCsvReader csv(rd.vs[0]);
+            if (err_msg == "") {
+                if (csv.read_header(&p, end) && csv.read(p, end)) {
+                    push_csv(&csv, pst);
+                    return;
+                }
+                err_msg = csv.err;
             }
-            pst->push_back(res);
-        } else {
+        }
+        IlAtom err;
+        err.t = ERROR;
+        err.vs = err_msg;
+        pst->push_back(err);
+    }
+
+    void csv_open(vector<IlAtom> *pst) {
+        // "file" "," rows opencsv -> FILE_STREAM, for yields column arrays... names per chunk of rows
+        size_t l = pst->size();
+        if (l < 3) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "to_bool requires: INT, FLOAT, STRING, or BOOL";
+            err.vs = "Stack-Underflow opencsv";
             pst->push_back(err);
             return;
         }
-        return;
+        IlAtom rn, rd, rf, res;
+        rn = pst->back();
+        pst->pop_back();
+        rd = pst->back();
+        pst->pop_back();
+        rf = pst->back();
+        pst->pop_back();
+        string err_msg;
+        if (rf.t != STRING || rd.t != STRING || rd.vs.length() != 1 || rn.t != INT || rn.vi < 1) {
+            err_msg = "Opencsv requires STRING filename, one char delimiter and INT rows > 0";
+        } else {
+            res.t = FILE_STREAM;
+            res.vs = rf.vs;
+            res.vfs = std::make_shared<IlFileStream>();
+            if (res.vfs->open(rf.vs, 0)) {
+                res.vfs->csv_rows = rn.vi;
+                res.vfs->csv_delim = rd.vs[0];
+                pst->push_back(res);
+                return;
+            }
+            err_msg = "Cannot-open-file: " + rf.vs;
+        }
+        IlAtom err;
+        err.t = ERROR;
+        err.vs = err_msg;
+        pst->push_back(err);
     }
 
-    void to_string(vector<IlAtom> *pst) {
+    void string_eval(vector<IlAtom> *pst) {
         size_t l = pst->size();
         if (l < 1) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Stack-Underflow to_string";
+            err.vs = "Stack-Underflow-no-filename-on-dyn-eval";
             pst->push_back(err);
             return;
         }
-        IlAtom r1, res;
-        r1 = pst->back();
+        IlAtom ila = pst->back();
         pst->pop_back();
-        if (r1.t == INT) {
-            res.t = STRING;
-            res.vs = std::to_string(r1.vi);
-            pst->push_back(res);
-        } else if (r1.t == FLOAT) {
-            res.t = STRING;
-            res.vs = std::to_string(r1.vf);
-            pst->push_back(res);
-        } else if (r1.t == BOOL) {
-            res.t = STRING;
-            if (r1.vb) {
-                res.vs = "true";
-            } else {
-                res.vs = "false";
-            }
-            pst->push_back(res);
-        } else if (r1.t == STRING) {
-            res.t = STRING;
-            res.vs = r1.vs;
-            pst->push_back(res);
-        } else {
+        if (ila.t == QUOTE) {
+            eval(*ila.vq, pst);
+            return;
+        }
+        if (ila.t != STRING) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "to_string requires: INT, FLOAT, STRING, or BOOL";
+            err.vs = "Dyn-eval-requires-string-or-quote-argument";
             pst->push_back(err);
             return;
         }
-        return;
+        eval_string(ila.vs, pst);
     }
 
-    void to_array(vector<IlAtom> *pst) {
+    void task_yield(vector<IlAtom> *pst) {
+        if (cooperative) suspend_request = il_suspend_yield;
+    }
+
+    void task_sleep(vector<IlAtom> *pst) {
         size_t l = pst->size();
         if (l < 1) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Stack-Underflow to_array";
+            err.vs = "Stack-Underflow sleep";
             pst->push_back(err);
             return;
         }
-        IlAtom r1, res;
-        r1 = pst->back();
+        IlAtom r1 = pst->back();
         pst->pop_back();
-        if (r1.t == INT) {
-            res.t = INT_ARRAY;
-            res.vai = {r1.vi};
-            pst->push_back(res);
-        } else if (r1.t == FLOAT) {
-            res.t = FLOAT_ARRAY;
-            res.vaf = {r1.vf};
-            pst->push_back(res);
-        } else if (r1.t == BOOL) {
-            res.t = BOOL_ARRAY;
-            res.vab = {r1.vb};
-            pst->push_back(res);
-        } else if (r1.t == STRING) {
-            res.t = STRING_ARRAY;
-            res.vas = {r1.vs};
-            pst->push_back(res);
-        } else {
+        if ((r1.t != INT && r1.t != FLOAT) || (r1.t == INT ? r1.vi < 0 : !(r1.vf >= 0.0))) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "to_array requires: INT, FLOAT, STRING, or BOOL";
+            err.vs = "sleep requires INT or FLOAT milliseconds >= 0";
             pst->push_back(err);
             return;
         }
-        return;
+        auto dt = std::chrono::microseconds((int64_t)((r1.t == INT ? r1.vi : r1.vf) * 1000.0));
+        if (!cooperative) {
+            out.flush();
+            std::this_thread::sleep_for(dt);
+            return;
+        }
+        wake_at = std::chrono::steady_clock::now() + dt;
+        suspend_request = il_suspend_sleep;
     }
 
-    void string_split(vector<IlAtom> *pst) {
+    void task_wait(vector<IlAtom> *pst) {
+        if (!cooperative) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "wait-requires-scheduler-task";
+            pst->push_back(err);
+            return;
+        }
+        suspend_request = il_suspend_wait;
+    }
+
+    const map<string, IlAtom> &globals() {
+        return global_view ? *global_view : symbols;
+    }
+
+    std::unique_ptr<IndraLink> task_context(const map<string, IlAtom> *pglobals, std::shared_ptr<IlStringSink> psink) {
+        // Context for a spawned task or a pfor chunk: functions of this context, read-only globals, output
+        // into psink. Parallel words within it run serially.
+        if (!task_library) task_library = make_library();
+        std::unique_ptr<IndraLink> ctx(new IndraLink(task_library));
+        ctx->global_view = pglobals;
+        ctx->lazy_arrays = lazy_arrays;
+        ctx->out.set_sink(psink);
+        return ctx;
+    }
+
+    void spawn_task(vector<IlAtom> *pst) {
+        // x { quote } spawn, x "func" spawn -> FUTURE: runs the quote or function with x on its own stack, on
+        // the thread pool, or in the first join (or a send or recv that waits) if threads < 2. Globals are a
+        // read-only snapshot.
         size_t l = pst->size();
         if (l < 2) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Stack-Underflow string_split";
+            err.vs = "Stack-Underflow spawn";
             pst->push_back(err);
             return;
         }
-        IlAtom r1, r2;
-        r2 = pst->back();
+        IlAtom q, x, res;
+        q = pst->back();
         pst->pop_back();
-        r1 = pst->back();
+        x = pst->back();
         pst->pop_back();
-        if (r1.t == STRING && r2.t == STRING) {
-            string s = r1.vs;
-            string sp = r2.vs;
-            IlAtom r;
-            r.t = STRING_ARRAY;
-            if (sp == "") {
-                for (auto c : s) {
-                    string cs{c};
-                    r.vas.push_back(cs);
-                }
-            } else {
-                size_t p = s.find(sp);
-                while (p != string::npos) {
-                    r.vas.push_back(s.substr(0, p));
-                    s = s.substr(p + sp.length());
-                    p = s.find(sp);
-                }
-                if (s.length() > 0) r.vas.push_back(s);
-            }
-            pst->push_back(r);
+        if ((q.t != QUOTE && q.t != STRING) || x.t == FILE_STREAM) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Spawn requires a value (not a file stream) and a quote or function name";
+            pst->push_back(err);
+            return;
+        }
+        if (!force_view(&x)) {
+            pst->push_back(x);
+            return;
+        }
+        std::shared_ptr<const vector<IlAtom>> code;
+        if (q.t == QUOTE) {
+            code = quote_code(q, pst);
+        } else if (const vector<IlAtom> *pf = find_func(q.vs)) {
+            code = func_code(q.vs, *pf, pst);
         } else {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "string_split requires two STRING vars";
+            err.vs = "Func-does-not-exist: " + q.vs;
             pst->push_back(err);
             return;
         }
+        if (!code) return;
+        if (!globals_snapshot) {
+            auto snap = std::make_shared<map<string, IlAtom>>();
+            for (const auto &symPair : globals()) {
+                if (symPair.second.t != FILE_STREAM) (*snap)[symPair.first] = symPair.second;
+            }
+            globals_snapshot = snap;
+        }
+        std::shared_ptr<const map<string, IlAtom>> snap = globals_snapshot;
+        auto sink = std::make_shared<IlStringSink>();
+        std::shared_ptr<IndraLink> ctx(task_context(snap.get(), sink));
+        res.t = FUTURE;
+        res.vfu = std::make_shared<IlFuture>();
+        res.vfu->body = [ctx, sink, snap, code, x](IlFuture *pf) {
+            pf->stack.push_back(x);
+            IlContinuation k;
+            k.frames.push_back(IlFrame(code));
+            pf->ok = ctx->run_to_end(&k, &pf->stack, nullptr, 0);
+            if (!pf->ok) pf->stack.erase(pf->stack.begin(), pf->stack.end() - 1);  // keep the error
+            ctx->out.flush();
+            pf->set_output(&sink->text);
+        };
+        if (IlThreadPool *tp = task_pool()) {
+            std::shared_ptr<IlFuture> f = res.vfu;
+            tp->submit([f]() { f->run(); });
+        } else {
+            deferred_tasks.push_back(res.vfu);
+        }
+        pst->push_back(res);
+    }
+
+    bool run_deferred_task() {
+        // Runs the oldest spawned task that is still deferred (threads < 2), so that a send or recv that would
+        // wait for it can go on. False if there is none.
+        while (!deferred_tasks.empty()) {
+            std::shared_ptr<IlFuture> f = deferred_tasks.front().lock();
+            deferred_tasks.pop_front();
+            if (f) {
+                f->run();  // nothing if a join ran it already
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool suspend_for_retry(vector<IlAtom> *pst, std::initializer_list<IlAtom> args) {
+        // A send or recv of a scheduler task that would wait suspends the task instead of blocking its worker:
+        // the arguments are put back and the word runs again when the task resumes.
+        if (!cooperative || !retry_run) return false;
+        pst->insert(pst->end(), args);
+        suspend_request = il_suspend_yield;
+        retry_run->retry = true;
+        return true;
     }
 
-    void string_substring(vector<IlAtom> *pst) {
+    void join_task(vector<IlAtom> *pst) {
+        // f join -> the values the task of FUTURE f left on its stack, in order. Waits for the task, or runs it
+        // if it hasn't started yet. What the task printed is output by the first join.
         size_t l = pst->size();
-        if (l < 3) {
+        if (l < 1) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Stack-Underflow string_substring";
+            err.vs = "Stack-Underflow join";
             pst->push_back(err);
             return;
         }
-        IlAtom r1, r2, r3;
-        r3 = pst->back();
+        IlAtom f = pst->back();
         pst->pop_back();
-        r2 = pst->back();
-        pst->pop_back();
-        r1 = pst->back();
-        pst->pop_back();
-        if (r1.t == STRING && r2.t == INT && r3.t == INT) {
-            IlAtom r;
-            r.t = STRING;
-            if (r2.vi < 0 || r3.vi < 0 || r2.vi + r3.vi > r1.vs.length()) {
-                IlAtom err;
-                err.t = ERROR;
-                err.vs = "string_substring index out-of-range";
-                pst->push_back(err);
-                return;
-            }
-            r.vs = r1.vs.substr(r2.vi, r3.vi);
-            pst->push_back(r);
-        } else {
+        if (f.t != FUTURE) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "string_substring requires STRING, INT, INT";
+            err.vs = "Join requires a FUTURE";
             pst->push_back(err);
             return;
         }
+        f.vfu->wait();
+        out << f.vfu->take_output();
+        if (!f.vfu->ok) {
+            pst->push_back(f.vfu->stack.back());
+            return;
+        }
+        pst->insert(pst->end(), f.vfu->stack.begin(), f.vfu->stack.end());
     }
 
-    void print(vector<IlAtom> *pst) {
-        IlAtom res = pst->back();
-        if (res.t == STRING)
-            cout << res.vs;
-        else
-            cout << res.str();
-        pst->pop_back();
+    bool pop_channel(vector<IlAtom> *pst, size_t n_args, const string &word, IlAtom *pch) {
+        // Pops the CHANNEL below n_args arguments into pch, else pushes an error.
+        size_t l = pst->size();
+        if (l < n_args + 1) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow " + word;
+            pst->push_back(err);
+            return false;
+        }
+        *pch = (*pst)[l - n_args - 1];
+        if (pch->t != CHANNEL) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "'" + word + "' requires a CHANNEL";
+            pst->push_back(err);
+            return false;
+        }
+        pst->erase(pst->end() - n_args - 1);
+        return true;
     }
 
-    void stack_size(vector<IlAtom> *pst) {
+    void make_channel(vector<IlAtom> *pst) {
+        // capacity channel -> CHANNEL, the capacity is rounded up to a power of two.
         size_t l = pst->size();
-        IlAtom res;
-        res.t = INT;
-        res.vi = l;
-        res.vs = std::to_string(l);
-        pst->push_back(res);
+        if (l < 1) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow channel";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom r1 = pst->back();
+        pst->pop_back();
+        if (r1.t != INT || r1.vi < 1) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Channel requires a capacity INT > 0";
+            pst->push_back(err);
+            return;
+        }
+        pst->push_back(channel_atom(std::make_shared<IlChannel>(r1.vi)));
     }
 
-    void show_stack(vector<IlAtom> *pst) {
-        cout << "⟦";
-        bool first = true;
-        for (auto il : *pst) {
-            if (first) {
-                first = false;
-            } else {
-                cout << ", ";
+    void channel_send(vector<IlAtom> *pst) {
+        // x ch send: queues x, waits while ch is full.
+        size_t l = pst->size();
+        if (l < 2) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Stack-Underflow send";
+            pst->push_back(err);
+            return;
+        }
+        IlAtom ch;
+        if (!pop_channel(pst, 0, "send", &ch)) return;
+        IlAtom x = pst->back();
+        pst->pop_back();
+        if (!force_view(&x)) {
+            pst->push_back(x);
+            return;
+        }
+        if (x.t == FILE_STREAM || x.t == ERROR) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Channel can't send a file stream or error";
+            pst->push_back(err);
+            return;
+        }
+        bool sent = ch.vch->try_send(x);
+        if (!sent && !ch.vch->closed()) {
+            if (suspend_for_retry(pst, {x, ch})) return;
+            while (!(sent = ch.vch->try_send(x)) && run_deferred_task()) {
             }
-            cout << il.str();
         }
-        cout << "⟧" << endl;
-    }
-
-    void clear_stack(vector<IlAtom> *pst) {
-        pst->clear();
+        if (!sent && !ch.vch->send(x)) {
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Channel-closed";
+            pst->push_back(err);
+        }
     }
 
-    void list_vars(vector<IlAtom> *pst, map<string, IlAtom> *local_symbols = nullptr) {
-        if (local_symbols) {
-            cout << "--- Local ----------" << endl;
-            for (const auto &symPair : *local_symbols) {
-                IlAtom il = symPair.second;
-                cout << il.str() << " >" << symPair.first << endl;
+    void channel_recv(vector<IlAtom> *pst) {
+        // ch recv -> x: waits while ch is empty, an error if it is closed.
+        IlAtom ch, x;
+        if (!pop_channel(pst, 0, "recv", &ch)) return;
+        bool got = ch.vch->try_recv(&x);
+        if (!got && !ch.vch->closed()) {
+            if (suspend_for_retry(pst, {ch})) return;
+            while (!(got = ch.vch->try_recv(&x)) && run_deferred_task()) {
             }
         }
-        cout << "--- Global ---------" << endl;
-        for (const auto &symPair : symbols) {
-            IlAtom il = symPair.second;
-            cout << il.str() << " >" << symPair.first << endl;
+        if (!got && !ch.vch->recv(&x)) {
+            x.t = ERROR;
+            x.vs = "Channel-closed";
         }
-        cout << "--------------------" << endl;
+        pst->push_back(x);
     }
 
-    void list_funcs(vector<IlAtom> *pst) {
-        for (const auto &funcPair : funcs) {
-            show_func(funcPair.first);
-        }
+    void channel_try_recv(vector<IlAtom> *pst) {
+        // ch try-recv -> x true, or false if ch is empty.
+        IlAtom ch, x, res;
+        if (!pop_channel(pst, 0, "try-recv", &ch)) return;
+        res.t = BOOL;
+        res.vb = ch.vch->try_recv(&x);
+        res.vs = res.vb ? "true" : "false";
+        if (res.vb) pst->push_back(x);
+        pst->push_back(res);
     }
 
-    void save(vector<IlAtom> *pst) {
-        size_t l = pst->size();
-        if (l < 1) {
-            IlAtom err;
-            err.t = ERROR;
-            err.vs = "Stack-Underflow-no-filename-on-save";
-            pst->push_back(err);
-            return;
-        }
-        IlAtom filedesc = pst->back();
+    void channel_recv_batch(vector<IlAtom> *pst) {
+        // ch n recvn -> x1 ... xk k: waits for one value, then takes up to n queued ones. k is 0 once ch is
+        // closed and empty.
+        IlAtom ch, res;
+        if (!pop_channel(pst, 1, "recvn", &ch)) return;
+        IlAtom r1 = pst->back();
         pst->pop_back();
-        if (filedesc.t != STRING) {
+        if (r1.t != INT || r1.vi < 0) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "filename-must-be-string-on-save";
+            err.vs = "Recvn requires a CHANNEL and a count INT >= 0";
             pst->push_back(err);
             return;
         }
-        FILE *fp = fopen(filedesc.vs.c_str(), "w");
-        if (fp) {
-            for (const auto &funcPair : funcs) {
-                string name = funcPair.first;
-                vector<IlAtom> func = funcPair.second;
-                fprintf(fp, ": %s ", name.c_str());
-                for (auto il : func) {
-                    string enc_line = il.str();
-                    // replaceAll(enc_line, "\\", "\\\\");
-                    fprintf(fp, "%s ", enc_line.c_str());
-                }
-                fprintf(fp, ";\n");
+        size_t n = 0;
+        IlAtom x;
+        bool got = r1.vi > 0 && ch.vch->try_recv(&x);
+        if (r1.vi > 0 && !got && !ch.vch->closed()) {
+            if (suspend_for_retry(pst, {ch, r1})) return;
+            while (!(got = ch.vch->try_recv(&x)) && run_deferred_task()) {
             }
-            fclose(fp);
         }
+        if (got) {
+            pst->push_back(std::move(x));
+            for (n = 1; n < (size_t)r1.vi && ch.vch->try_recv(&x); n++) pst->push_back(std::move(x));
+        } else {
+            n = ch.vch->recv_batch(pst, r1.vi);
+        }
+        res.t = INT;
+        res.vi = (int)n;
+        res.vs = std::to_string(res.vi);
+        pst->push_back(res);
     }
 
-    void load(vector<IlAtom> *pst) {
-        size_t l = pst->size();
-        if (l < 1) {
+    void channel_close(vector<IlAtom> *pst) {
+        IlAtom ch;
+        if (!pop_channel(pst, 0, "close", &ch)) return;
+        ch.vch->close();
+    }
+
+    bool par_for(IlFrame *pfr, size_t end, vector<IlAtom> *pst) {
+        // arr pfor ... next: runs the loop body (pfr->pc + 1 up to end) for each element of arr on its own
+        // stack, concurrently over chunks of arr. The values the iterations leave are pushed in element order.
+        // Each iteration starts with a copy of the locals, globals are read-only.
+        if (pst->size() == 0) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Stack-Underflow-no-filename-on-load";
+            err.vs = "Stack-underflow-on-pfor";
             pst->push_back(err);
-            return;
+            return false;
         }
-        IlAtom filedesc = pst->back();
+        IlAtom arr = pst->back();
         pst->pop_back();
-        if (filedesc.t != STRING) {
+        if (!force_view(&arr)) {
+            pst->push_back(arr);
+            return false;
+        }
+        if (!is_array_type(arr.t)) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "filename-must-be-string-on-load";
+            err.vs = "'pfor' requires an INT, STRING, FLOAT, or BOOL array on stack";
             pst->push_back(err);
-            return;
+            return false;
         }
-        char buf[129];
-        int nb;
-        string cmd = "";
-        FILE *fp = fopen(filedesc.vs.c_str(), "r");
-        if (fp) {
-            while (!feof(fp)) {
-                nb = fread(buf, 1, 128, fp);
-                buf[nb] = 0;
-                cmd += buf;
+        size_t n = array_size(arr);
+        IlThreadPool *tp = task_pool();
+        size_t n_chunks = tp ? (tp->size() + 1) * 4 : 1;
+        if (n_chunks > n) n_chunks = n;
+        vector<vector<IlAtom>> results(n_chunks);
+        vector<IlAtom> errs(n_chunks);
+        vector<unsigned char> failed(n_chunks, 0);
+        vector<std::shared_ptr<IlStringSink>> sinks(n_chunks);
+        vector<std::unique_ptr<IndraLink>> ctxs;
+        for (size_t c = 0; c < n_chunks; c++) {
+            sinks[c] = std::make_shared<IlStringSink>();
+            ctxs.push_back(task_context(&globals(), sinks[c]));
+        }
+        const IlLocals &locals = pfr->symbols();
+        size_t begin = pfr->pc + 1;
+        auto run_chunk = [&](size_t c) {
+            IndraLink *ctx = ctxs[c].get();
+            for (size_t i = c * n / n_chunks; i < (c + 1) * n / n_chunks; i++) {
+                vector<IlAtom> st;
+                st.push_back(array_element(arr, i));
+                IlContinuation k;
+                k.frames.push_back(IlFrame(pfr->code, nullptr));
+                IlFrame &fr = k.frames.back();
+                fr.locals = locals;
+                fr.pc = begin;
+                fr.end = end;
+                fr.last_loop = "pfor";
+                if (!ctx->run_to_end(&k, &st, nullptr, 0)) {
+                    errs[c] = st.back();
+                    failed[c] = 1;
+                    break;
+                }
+                results[c].insert(results[c].end(), st.begin(), st.end());
+            }
+            ctx->out.flush();
+        };
+        if (tp)
+            tp->parallel_for(n_chunks, run_chunk);
+        else if (n_chunks)
+            run_chunk(0);
+        for (size_t c = 0; c < n_chunks; c++) {
+            out << sinks[c]->text;
+            if (failed[c]) {
+                pst->push_back(errs[c]);
+                return false;
             }
         }
-        replaceAll(cmd, "\\n", "\n");
-        vector<IlAtom> ps = parse(cmd);
-        eval(ps, pst);
+        for (size_t c = 0; c < n_chunks; c++) pst->insert(pst->end(), results[c].begin(), results[c].end());
+        return true;
     }
 
-    void string_eval(vector<IlAtom> *pst) {
+    void set_eval_cache(vector<IlAtom> *pst) {
         size_t l = pst->size();
         if (l < 1) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Stack-Underflow-no-filename-on-dyn-eval";
+            err.vs = "Stack-Underflow evalcache";
             pst->push_back(err);
             return;
         }
-        IlAtom ila = pst->back();
+        IlAtom r1 = pst->back();
         pst->pop_back();
-        if (ila.t != STRING) {
+        if (r1.t != INT || r1.vi < 0) {
             IlAtom err;
             err.t = ERROR;
-            err.vs = "Dyn-eval-requires-string-argument";
+            err.vs = "evalcache requires INT >= 0 (0: no caching)";
             pst->push_back(err);
             return;
         }
-        string cmd = ila.vs;
-        // replaceAll(cmd, "\\n", "\n");
-        vector<IlAtom> ps = parse(cmd);
-        eval(ps, pst);
+        eval_cache_capacity = r1.vi;
+        trim_eval_cache();
+    }
+
+    void eval_cache_stats(vector<IlAtom> *pst) {
+        IlAtom hits, misses;
+        hits.t = INT;
+        hits.vi = (int)eval_cache_hits;
+        hits.vs = std::to_string(hits.vi);
+        misses.t = INT;
+        misses.vi = (int)eval_cache_misses;
+        misses.vs = std::to_string(misses.vi);
+        pst->push_back(hits);
+        pst->push_back(misses);
+    }
+
+    void trim_eval_cache() {
+        while (eval_cache.size() > eval_cache_capacity) {
+            eval_cache_index.erase(eval_cache.back().first);
+            eval_cache.pop_back();
+        }
+    }
+
+    void clear_eval_cache() {
+        // Compiled code binds function names, it's invalidated when functions (or inbuilts) change. This
+        // includes the compiled function bodies.
+        eval_cache.clear();
+        eval_cache_index.clear();
+        compiled_funcs.clear();
+        task_library.reset();
     }
 
     IndraLink() {
+        register_inbuilts(&inbuilts);
+        init_state();
+    }
+
+    explicit IndraLink(std::shared_ptr<const IlLibrary> lib) {
+        // Lightweight execution context for a shared library: no inbuilts are registered, functions and
+        // inbuilts are looked up in lib. Stack, globals, settings and own definitions belong to the context.
+        library = lib;
+        init_state();
+    }
+
+    static void register_inbuilts(map<string, IlInbuilt> *pinbuilts) {
+        map<string, IlInbuilt> &inbuilts = *pinbuilts;
         for (auto cm_op : "+-*/%") {
             if (cm_op == 0) continue;
             string m_op{cm_op};
-            inbuilts[m_op] = [this, m_op](vector<IlAtom> *pst) { math_2ops(pst, m_op); };
+            inbuilts[m_op] = [m_op](IndraLink *il, vector<IlAtom> *pst) { il->math_2ops(pst, m_op); };
         }
         for (auto cmp_op : {"==", "!=", ">=", "<=", "<", ">"}) {
             string m_op{cmp_op};
-            inbuilts[m_op] = [this, m_op](vector<IlAtom> *pst) { cmp_2ops(pst, m_op); };
+            inbuilts[m_op] = [m_op](IndraLink *il, vector<IlAtom> *pst) { il->cmp_2ops(pst, m_op); };
         }
         for (auto bool_op : {"and", "or"}) {
             string m_op{bool_op};
-            inbuilts[m_op] = [this, m_op](vector<IlAtom> *pst) { bool_2ops(pst, m_op); };
-        }
-        inbuilts["ss"] = [&](vector<IlAtom> *pst) { stack_size(pst); };
-        inbuilts["cs"] = [&](vector<IlAtom> *pst) { clear_stack(pst); };
-        inbuilts["dup"] = [&](vector<IlAtom> *pst) { dup(pst); };
-        inbuilts["drop"] = [&](vector<IlAtom> *pst) { drop(pst); };
-        inbuilts["dup2"] = [&](vector<IlAtom> *pst) { dup2(pst); };
-        inbuilts["swap"] = [&](vector<IlAtom> *pst) { swap(pst); };
-        inbuilts["."] = [&](vector<IlAtom> *pst) { print(pst); };
-        inbuilts["print"] = [&](vector<IlAtom> *pst) { print(pst); };
-        inbuilts["printstack"] = [&](vector<IlAtom> *pst) { show_stack(pst); };
-        inbuilts["ps"] = [&](vector<IlAtom> *pst) { show_stack(pst); };
-        inbuilts["listvars"] = [&](vector<IlAtom> *pst) { list_vars(pst); };
-        inbuilts["listfuncs"] = [&](vector<IlAtom> *pst) { list_funcs(pst); };
-        inbuilts["save"] = [&](vector<IlAtom> *pst) { save(pst); };
-        inbuilts["load"] = [&](vector<IlAtom> *pst) { load(pst); };
-        inbuilts["eval"] = [&](vector<IlAtom> *pst) { string_eval(pst); };
-        inbuilts["range"] = [&](vector<IlAtom> *pst) { range(pst); };
-        inbuilts["remove"] = [&](vector<IlAtom> *pst) { array_remove(pst); };
-        inbuilts["append"] = [&](vector<IlAtom> *pst) { array_append(pst); };
-        inbuilts["update"] = [&](vector<IlAtom> *pst) { array_update(pst); };
-        inbuilts["index"] = [&](vector<IlAtom> *pst) { array_index(pst); };
-        inbuilts["len"] = [&](vector<IlAtom> *pst) { array_or_string_len(pst); };
-        inbuilts["erase"] = [&](vector<IlAtom> *pst) { array_erase(pst); };
-        inbuilts["array"] = [&](vector<IlAtom> *pst) { to_array(pst); };
-        inbuilts["int"] = [&](vector<IlAtom> *pst) { to_int(pst); };
-        inbuilts["float"] = [&](vector<IlAtom> *pst) { to_float(pst); };
-        inbuilts["bool"] = [&](vector<IlAtom> *pst) { to_bool(pst); };
-        inbuilts["string"] = [&](vector<IlAtom> *pst) { to_string(pst); };
-        inbuilts["split"] = [&](vector<IlAtom> *pst) { string_split(pst); };
-        inbuilts["substring"] = [&](vector<IlAtom> *pst) { string_substring(pst); };
-        inbuilts["sum"] = [&](vector<IlAtom> *pst) { array_sum(pst); };
-        flow_control_words = {"for", "next", "if", "else", "endif", "while", "loop", "break", "return"};
+            inbuilts[m_op] = [m_op](IndraLink *il, vector<IlAtom> *pst) { il->bool_2ops(pst, m_op); };
+        }
+        for (auto fn_op : {"sqrt", "isqrt", "abs", "floor", "ceil", "round", "exp", "log", "sin", "cos"}) {
+            string m_op{fn_op};
+            inbuilts[m_op] = [m_op](IndraLink *il, vector<IlAtom> *pst) { il->math_1ops(pst, m_op); };
+        }
+        for (auto fn_op : {"pow", "atan2", "min2", "max2"}) {
+            string m_op{fn_op};
+            inbuilts[m_op] = [m_op](IndraLink *il, vector<IlAtom> *pst) { il->math_2fns(pst, m_op); };
+        }
+        inbuilts["ss"] = [](IndraLink *il, vector<IlAtom> *pst) { il->stack_size(pst); };
+        inbuilts["cs"] = [](IndraLink *il, vector<IlAtom> *pst) { il->clear_stack(pst); };
+        inbuilts["dup"] = [](IndraLink *il, vector<IlAtom> *pst) { il->dup(pst); };
+        inbuilts["drop"] = [](IndraLink *il, vector<IlAtom> *pst) { il->drop(pst); };
+        inbuilts["dup2"] = [](IndraLink *il, vector<IlAtom> *pst) { il->dup2(pst); };
+        inbuilts["swap"] = [](IndraLink *il, vector<IlAtom> *pst) { il->swap(pst); };
+        inbuilts["."] = [](IndraLink *il, vector<IlAtom> *pst) { il->print(pst); };
+        inbuilts["print"] = [](IndraLink *il, vector<IlAtom> *pst) { il->print(pst); };
+        inbuilts["flush"] = [](IndraLink *il, vector<IlAtom> *pst) { il->flush_output(pst); };
+        inbuilts["printstack"] = [](IndraLink *il, vector<IlAtom> *pst) { il->show_stack(pst); };
+        inbuilts["ps"] = [](IndraLink *il, vector<IlAtom> *pst) { il->show_stack(pst); };
+        inbuilts["listvars"] = [](IndraLink *il, vector<IlAtom> *pst) { il->list_vars(pst); };
+        inbuilts["listfuncs"] = [](IndraLink *il, vector<IlAtom> *pst) { il->list_funcs(pst); };
+        inbuilts["save"] = [](IndraLink *il, vector<IlAtom> *pst) { il->save(pst); };
+        inbuilts["load"] = [](IndraLink *il, vector<IlAtom> *pst) { il->load(pst); };
+        inbuilts["saveimage"] = [](IndraLink *il, vector<IlAtom> *pst) {
+            il->file_word(pst, "saveimage", [il](const string &path, string *perr) { return il->save_image(path, perr); });
+        };
+        inbuilts["loadimage"] = [](IndraLink *il, vector<IlAtom> *pst) {
+            il->file_word(pst, "loadimage", [il](const string &path, string *perr) { return il->load_image(path, perr); });
+        };
+        inbuilts["snapshot"] = [](IndraLink *il, vector<IlAtom> *pst) {
+            il->file_word(pst, "snapshot", [il](const string &path, string *perr) { return il->snapshot(path, false, perr); });
+        };
+        inbuilts["snapshotinc"] = [](IndraLink *il, vector<IlAtom> *pst) {
+            il->file_word(pst, "snapshotinc", [il](const string &path, string *perr) { return il->snapshot(path, true, perr); });
+        };
+        inbuilts["restore"] = [](IndraLink *il, vector<IlAtom> *pst) {
+            il->file_word(pst, "restore", [il](const string &path, string *perr) { return il->restore(path, perr); });
+        };
+        inbuilts["eval"] = [](IndraLink *il, vector<IlAtom> *pst) { il->string_eval(pst); };
+        inbuilts["yield"] = [](IndraLink *il, vector<IlAtom> *pst) { il->task_yield(pst); };
+        inbuilts["sleep"] = [](IndraLink *il, vector<IlAtom> *pst) { il->task_sleep(pst); };
+        inbuilts["wait"] = [](IndraLink *il, vector<IlAtom> *pst) { il->task_wait(pst); };
+        inbuilts["spawn"] = [](IndraLink *il, vector<IlAtom> *pst) { il->spawn_task(pst); };
+        inbuilts["join"] = [](IndraLink *il, vector<IlAtom> *pst) { il->join_task(pst); };
+        inbuilts["await"] = [](IndraLink *il, vector<IlAtom> *pst) { il->join_task(pst); };
+        inbuilts["channel"] = [](IndraLink *il, vector<IlAtom> *pst) { il->make_channel(pst); };
+        inbuilts["send"] = [](IndraLink *il, vector<IlAtom> *pst) { il->channel_send(pst); };
+        inbuilts["recv"] = [](IndraLink *il, vector<IlAtom> *pst) { il->channel_recv(pst); };
+        inbuilts["try-recv"] = [](IndraLink *il, vector<IlAtom> *pst) { il->channel_try_recv(pst); };
+        inbuilts["recvn"] = [](IndraLink *il, vector<IlAtom> *pst) { il->channel_recv_batch(pst); };
+        inbuilts["close"] = [](IndraLink *il, vector<IlAtom> *pst) { il->channel_close(pst); };
+        inbuilts["evalcache"] = [](IndraLink *il, vector<IlAtom> *pst) { il->set_eval_cache(pst); };
+        inbuilts["evalcachestats"] = [](IndraLink *il, vector<IlAtom> *pst) { il->eval_cache_stats(pst); };
+        inbuilts["openlines"] = [](IndraLink *il, vector<IlAtom> *pst) { il->file_open(pst, false); };
+        inbuilts["openchunks"] = [](IndraLink *il, vector<IlAtom> *pst) { il->file_open(pst, true); };
+        inbuilts["readcsv"] = [](IndraLink *il, vector<IlAtom> *pst) { il->csv_read(pst, true); };
+        inbuilts["parsecsv"] = [](IndraLink *il, vector<IlAtom> *pst) { il->csv_read(pst, false); };
+        inbuilts["opencsv"] = [](IndraLink *il, vector<IlAtom> *pst) { il->csv_open(pst); };
+        inbuilts["range"] = [](IndraLink *il, vector<IlAtom> *pst) { il->range(pst); };
+        inbuilts["remove"] = [](IndraLink *il, vector<IlAtom> *pst) { il->array_remove(pst); };
+        inbuilts["append"] = [](IndraLink *il, vector<IlAtom> *pst) { il->array_append(pst); };
+        inbuilts["update"] = [](IndraLink *il, vector<IlAtom> *pst) { il->array_update(pst); };
+        inbuilts["index"] = [](IndraLink *il, vector<IlAtom> *pst) { il->array_index(pst); };
+        inbuilts["len"] = [](IndraLink *il, vector<IlAtom> *pst) { il->array_or_string_len(pst); };
+        inbuilts["erase"] = [](IndraLink *il, vector<IlAtom> *pst) { il->array_erase(pst); };
+        inbuilts["array"] = [](IndraLink *il, vector<IlAtom> *pst) { il->to_array(pst); };
+        inbuilts["int"] = [](IndraLink *il, vector<IlAtom> *pst) { il->to_int(pst); };
+        inbuilts["float"] = [](IndraLink *il, vector<IlAtom> *pst) { il->to_float(pst); };
+        inbuilts["bool"] = [](IndraLink *il, vector<IlAtom> *pst) { il->to_bool(pst); };
+        inbuilts["string"] = [](IndraLink *il, vector<IlAtom> *pst) { il->to_string(pst); };
+        inbuilts["split"] = [](IndraLink *il, vector<IlAtom> *pst) { il->string_split(pst); };
+        inbuilts["substring"] = il_inbuilt("substring", [](string str, int pos, int len) {
+            if (pos < 0 || len < 0 || (size_t)pos + len > str.length()) {
+                IlAtom err;
+                err.t = ERROR;
+                err.vs = "string_substring index out-of-range";
+                return err;
+            }
+            str.erase(0, pos);
+            str.resize(len);
+            return IlRet<string>::make(std::move(str));
+        });
+        inbuilts["sum"] = [](IndraLink *il, vector<IlAtom> *pst) { il->array_sum(pst); };
+        inbuilts["map"] = [](IndraLink *il, vector<IlAtom> *pst) { il->array_map(pst); };
+        inbuilts["filter"] = [](IndraLink *il, vector<IlAtom> *pst) { il->array_filter(pst); };
+        inbuilts["reduce"] = [](IndraLink *il, vector<IlAtom> *pst) { il->array_reduce(pst); };
+        inbuilts["each"] = [](IndraLink *il, vector<IlAtom> *pst) { il->array_each(pst); };
+        inbuilts["clamp"] = [](IndraLink *il, vector<IlAtom> *pst) { il->clamp(pst); };
+        inbuilts["lazy"] = [](IndraLink *il, vector<IlAtom> *pst) { il->lazy_mode(pst); };
+        inbuilts["matmul"] = [](IndraLink *il, vector<IlAtom> *pst) { il->array_matmul(pst); };
+        inbuilts["transpose"] = [](IndraLink *il, vector<IlAtom> *pst) { il->array_transpose(pst); };
+        inbuilts["matvec"] = [](IndraLink *il, vector<IlAtom> *pst) { il->array_matvec(pst); };
+        inbuilts["outer"] = [](IndraLink *il, vector<IlAtom> *pst) { il->array_outer(pst); };
+        inbuilts["mapfile"] = [](IndraLink *il, vector<IlAtom> *pst) { il->array_mapfile(pst, false); };
+        inbuilts["mapraw"] = [](IndraLink *il, vector<IlAtom> *pst) { il->array_mapfile(pst, true); };
+        inbuilts["savearray"] = [](IndraLink *il, vector<IlAtom> *pst) { il->array_save(pst); };
+        inbuilts["threads"] = [](IndraLink *il, vector<IlAtom> *pst) { il->set_threads(pst); };
+        inbuilts["parthreshold"] = [](IndraLink *il, vector<IlAtom> *pst) { il->set_par_threshold(pst); };
+    }
+
+    void init_state() {
+        flow_control_words = {"for", "pfor", "next", "if", "else", "endif", "while", "loop", "break", "return"};
         def_words = {":", ";"};
+        view_inbuilts = {"+", "-", "*", "/", "%", "==", "!=", ">=", "<=", "<", ">", "and", "or", "clamp", "sum", "index", "len",
+                         "print", ".", "printstack", "ps", "ss", "cs", "dup", "drop", "dup2", "swap", "lazy", "sqrt", "isqrt",
+                         "abs", "floor", "ceil", "round", "exp", "log", "sin", "cos", "pow", "atan2", "min2", "max2", "savearray",
+                         "update"};
+        lazy_arrays = true;
+        host_arrays = false;
+        pure_inbuilts = {"+", "-", "*", "/", "%", "==", "!=", ">=", "<=", "<", ">", "and", "or", "clamp", "dup", "drop", "dup2", "swap",
+                         "ss", "range", "remove", "append", "update", "index", "len", "erase", "array", "int", "float", "bool",
+                         "string", "split", "substring", "sum", "matmul", "transpose", "matvec", "outer", "sqrt", "isqrt", "abs",
+                         "floor", "ceil", "round", "exp", "log", "sin", "cos", "pow", "atan2", "min2", "max2"};
+        threads = 1;
+        par_threshold = 65536;
+        track_changes = false;
+        eval_depth = 0;
+        eval_cache_capacity = 256;
+        eval_cache_hits = 0;
+        eval_cache_misses = 0;
+        parse_reads_globals = false;
+        cooperative = false;
+        suspend_request = il_no_suspend;
+        retry_run = nullptr;
+        global_view = nullptr;
     }
 
     bool is_white_space(char c) {
@@ -1443,207 +6461,259 @@ class IndraLink {
         return false;
     }
 
-    vector<string> split(const string &str) {
-        vector<string> tokens;
-        string tok;
-        enum SplitState { START,
-                          TOKEN,
+    vector<IlToken> tokenize(const char *src, size_t n, bool *pcomplete = nullptr) {
+        // Single pass over the source, tokens are views into src. Quote bodies are kept verbatim, strings
+        // with their escapes, array literals with their elements: they are split again on parse.
+        // *pcomplete is set to false if src ends within a string, array, quote or ( comment.
+        vector<IlToken> tokens;
+        enum SplitState { TOKEN,
                           WHITE_SPACE,
                           STRING,
                           STRING_ESC,
-                          // STRING_END,
                           ARRAY,
+                          QUOTE,
                           COMMENT1,
                           COMMENT2 };
-        SplitState state = START;
-        for (auto c : str + " ") {
+        SplitState state = WHITE_SPACE;
+        size_t start = 0;
+        int quote_depth = 0;
+        bool quote_str = false, quote_esc = false;
+        auto emit = [&](size_t end) {
+            IlToken tok;
+            tok.p = src + start;
+            tok.len = end - start;
+            tok.num = UNDEFINED;
+            char c0 = *tok.p;
+            if ((c0 >= '0' && c0 <= '9') || c0 == '-' || c0 == '.') tok.num = parse_number(tok.p, tok.p + tok.len, &tok.vi, &tok.vf);
+            tokens.push_back(tok);
+            state = WHITE_SPACE;
+        };
+        for (size_t i = 0; i < n; i++) {
+            char c = src[i];
             switch (state) {
             case WHITE_SPACE:
-                if (is_white_space(c)) {
-                    continue;
-                }
-                // fall through:
-            case START: {
+                if (is_white_space(c)) continue;
+                start = i;
                 switch (c) {
                 case '"':
                     state = STRING;
-                    tok = c;
-                    continue;
+                    break;
                 case '(':
                     state = COMMENT1;
-                    tok = c;
-                    continue;
+                    break;
                 case '\\':
                     state = COMMENT2;
-                    tok = c;
-                    continue;
+                    break;
                 case '[':
                     state = ARRAY;
-                    tok = c;
-                    continue;
+                    break;
+                case '{':
+                    state = QUOTE;
+                    quote_depth = 1;
+                    quote_str = false;
+                    quote_esc = false;
+                    break;
                 default:
                     state = TOKEN;
-                    tok = c;
-                    continue;
+                    break;
                 }
+                break;
             case TOKEN:
-                if (is_white_space(c)) {
-                    if (tok.length() > 0) {
-                        tokens.push_back(tok);
-                        tok = "";
-                    }
-                    state = WHITE_SPACE;
-                    continue;
-                } else {
-                    tok += c;
-                    continue;
-                }
+                if (is_white_space(c)) emit(i);
+                break;
             case ARRAY:
-                if (c == ']') {
-                    tok += c;
-                    tokens.push_back(tok);
-                    tok = "";
-                    state = WHITE_SPACE;
-                    continue;
-                } else {
-                    tok += c;
-                    continue;
+                if (c == ']') emit(i + 1);
+                break;
+            case QUOTE:
+                if (quote_str) {
+                    if (quote_esc)
+                        quote_esc = false;
+                    else if (c == '\\')
+                        quote_esc = true;
+                    else if (c == '"')
+                        quote_str = false;
+                } else if (c == '"') {
+                    quote_str = true;
+                } else if (c == '{') {
+                    ++quote_depth;
+                } else if (c == '}') {
+                    if (--quote_depth == 0) emit(i + 1);
                 }
+                break;
             case STRING_ESC:
-                if (c == 'n') {  // XXX other escs?
-                    string sc = {10};
-                    tok += sc;
-                } else {
-                    tok += c;
-                }
                 state = STRING;
-                continue;
+                break;
             case STRING:
-                if (c == '\\') {
+                if (c == '\\')
                     state = STRING_ESC;
-                    continue;
-                }
-                if (c == '"') {
-                    tok += c;
-                    tokens.push_back(tok);
-                    tok = "";
-                    state = WHITE_SPACE;
-                    continue;
-                } else {
-                    tok += c;
-                    continue;
-                }
+                else if (c == '"')
+                    emit(i + 1);
+                break;
             case COMMENT1:
-                if (c == ')') {
-                    tok += c;
-                    tokens.push_back(tok);
-                    tok = "";
-                    state = WHITE_SPACE;
-                    continue;
-                } else {
-                    tok += c;
-                    continue;
-                }
+                if (c == ')') emit(i + 1);
+                break;
             case COMMENT2:
-                if (c == '\n' || c == '\r') {
-                    tokens.push_back(tok);
-                    tok = "";
-                    state = WHITE_SPACE;
-                    continue;
-                } else {
-                    tok += c;
-                    continue;
-                }
-            }
+                if (c == '\n' || c == '\r') emit(i);
+                break;
             }
         }
+        if (pcomplete) *pcomplete = state == WHITE_SPACE || state == TOKEN || state == COMMENT2;
+        if (state == TOKEN) emit(n);  // unterminated strings, arrays, quotes and comments are dropped
         return tokens;
     }
 
-    bool is_int(string token, bool nat = false) {
-        if (!nat) {
-            if (token.length() && token[0] == '-')
-                token = token.substr(1);
-        }
-        if (token.length() == 0)
-            return false;
-        string isn = "0123456789";
-        for (unsigned int i = 0; i < token.length(); i++) {
-            if (isn.find(token[i]) == string::npos) {
-                return false;
-            }
+    bool is_complete(const string &src) {
+        // True if src can be evaluated on its own: no unterminated string, array, quote, comment or definition.
+        bool complete;
+        vector<IlToken> tokens = tokenize(src.data(), src.size(), &complete);
+        if (!complete) return false;
+        bool in_def = false;
+        for (const auto &tok : tokens) {
+            if (tok.len == 1 && *tok.p == ':') in_def = true;
+            if (tok.len == 1 && *tok.p == ';') in_def = false;
         }
-        return true;
+        return !in_def;
     }
 
-    bool is_float(string token) {
-        size_t pos = token.find('.');
-        if (pos == string::npos) return false;
-        string s1 = token.substr(0, pos);
-        if (s1.length() > 0 && !is_int(s1)) return false;
-        string s2 = token.substr(pos + 1);
-        if (s1.length() == 0 && s2.length() == 0) return false;
-        pos = s2.find('e');
-        if (pos == string::npos) pos = s2.find('E');
-        if (pos == string::npos) {
-            if (!is_int(s2, true) && s2.length() > 0) return false;
-            return true;
-        } else {
-            string s1 = s2.substr(0, pos);
-            if (!is_int(s1, true) && s1.length() > 0) return false;
-            string s3 = s2.substr(pos + 1);
-            if (!is_int(s3)) return false;
-            return true;
-        }
+    bool is_int(const string &token) {
+        int vi;
+        double vf;
+        return parse_number(token.data(), token.data() + token.size(), &vi, &vf) == INT;
+    }
+
+    bool is_float(const string &token) {
+        int vi;
+        double vf;
+        return parse_number(token.data(), token.data() + token.size(), &vi, &vf) == FLOAT;
     }
 
-    bool is_comment(string token) {
+    bool is_comment(const string &token) {
         if (token.length() > 0 && (token[0] == '\\' || token[0] == '('))
             return true;
         else
             return false;
     }
 
-    bool is_bool(string token) {
+    bool is_bool(const string &token) {
         if (token == "false" || token == "true")
             return true;
         else
             return false;
     }
 
-    bool is_string(string token) {
+    bool is_string(const string &token) {
         if (token.length() > 1 && token[0] == '"' && token[token.length() - 1] == '"')
             return true;
         else
             return false;
     }
 
-    bool is_array(string token) {
+    bool is_array(const string &token) {
         if (token.length() > 1 && token[0] == '[' && token[token.length() - 1] == ']')
             return true;
         else
             return false;
     }
 
-    IlAtom parse_tok(string token) {
+    bool is_quote(const string &token) {
+        if (token.length() > 1 && token[0] == '{' && token[token.length() - 1] == '}')
+            return true;
+        else
+            return false;
+    }
+
+    bool parse_number_array(const char *p, size_t n, IlAtom *pm) {
+        // Fast path for array literals of INT or FLOAT numbers, optionally preceded by the type word int or float:
+        // the elements are parsed straight into a preallocated typed buffer. Returns false for anything else
+        // (bools, strings, symbols, comments, bad elements), those take the general path that reports errors.
+        const char *end = p + n;
+        size_t count = 0;
+        bool in_el = false;
+        for (const char *c = p; c < end; c++) {
+            bool ws = is_white_space(*c);
+            count += !ws & !in_el;  // branch-free, element starts are unpredictable
+            in_el = !ws;
+        }
+        ilAtomTypes t = UNDEFINED;
+        const char *c = p;
+        while (c < end && is_white_space(*c)) c++;
+        const char *e = c;
+        while (e < end && !is_white_space(*e)) e++;
+        if (e - c == 3 && !strncmp(c, "int", 3)) {
+            t = INT;
+        } else if (e - c == 5 && !strncmp(c, "float", 5)) {
+            t = FLOAT;
+        }
+        bool typed = t != UNDEFINED;  // under float, INT elements are converted
+        if (typed) {
+            c = e;
+            --count;
+        }
+        vector<int> vi;
+        vector<double> vf;
+        if (t == INT) vi.reserve(count);
+        if (t == FLOAT) vf.reserve(count);
+        while (c < end) {
+            while (c < end && is_white_space(*c)) c++;
+            if (c == end) break;
+            e = c;
+            while (e < end && !is_white_space(*e)) e++;
+            int i;
+            double f;
+            ilAtomTypes ti = parse_number(c, e, &i, &f);
+            if (ti == UNDEFINED) return false;
+            if (t == UNDEFINED) {
+                t = ti;
+                if (t == INT)
+                    vi.reserve(count);
+                else
+                    vf.reserve(count);
+            } else if (ti != t && !(typed && t == FLOAT && ti == INT)) {
+                return false;
+            }
+            if (t == INT)
+                vi.push_back(i);
+            else
+                vf.push_back(ti == INT ? i : f);
+            c = e;
+        }
+        if (t == INT) {
+            pm->t = INT_ARRAY;
+            pm->vai.swap(vi);
+        } else if (t == FLOAT) {
+            pm->t = FLOAT_ARRAY;
+            pm->vaf.swap(vf);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    IlAtom parse_tok(const IlToken &tok) {
         IlAtom m;
         m.t = ERROR;
         m.vs = "Parse";
 
+        if (tok.num == INT) {
+            m.t = INT;
+            m.vi = tok.vi;
+            m.vs = tok.str();
+            return m;
+        }
+        if (tok.num == FLOAT) {
+            m.t = FLOAT;
+            m.vf = tok.vf;
+            m.vs = tok.str();
+            return m;
+        }
+        if (tok.len > 1 && tok.p[0] == '[' && tok.p[tok.len - 1] == ']' && parse_number_array(tok.p + 1, tok.len - 2, &m)) return m;
+        string token = tok.str();
         if (is_comment(token)) {
             m.t = COMMENT;
             m.vs = token;
         } else if (is_def_word(token)) {
             m.t = DEF_WORD;
             m.vs = token;
-        } else if (is_int(token)) {
-            m.t = INT;
-            m.vi = atoi(token.c_str());
-            m.vs = token;
-        } else if (is_float(token)) {
-            m.t = FLOAT;
-            m.vf = atof(token.c_str());
-            m.vs = token;
         } else if (is_bool(token)) {
             m.t = BOOL;
             m.vs = token;
@@ -1653,30 +6723,30 @@ class IndraLink {
                 m.vb = true;
         } else if (is_string(token)) {
             m.t = STRING;
-            m.vs = token.substr(1, token.length() - 2);
+            m.vs = unescape(token.data() + 1, token.length() - 2);
         } else if (is_array(token)) {
-            string arr = token.substr(1, token.length() - 2);
-            vector<string> arr_els = split(arr);
+            vector<IlToken> arr_els = tokenize(token.data() + 1, token.length() - 2);
             ilAtomTypes t = UNDEFINED;
             ilAtomTypes ti;
             SYMBOL_TYPE syty;
-            for (auto el : arr_els) {
-                ti = UNDEFINED;
+            bool typed_float = false;  // starts with float: INT elements are converted
+            for (const auto &elt : arr_els) {
+                ti = elt.num;
+                string el = elt.str();
                 if (is_comment(el)) continue;
-                if (is_int(el))
-                    ti = INT;
-                else if (is_float(el))
-                    ti = FLOAT;
-                else if (is_bool(el))
-                    ti = BOOL;
-                else if (is_string(el))
-                    ti = STRING;
+                if (ti == UNDEFINED) {
+                    if (is_bool(el))
+                        ti = BOOL;
+                    else if (is_string(el))
+                        ti = STRING;
+                }
                 if (ti == UNDEFINED) {
                     if (el == "int") {
                         t = INT;
                         m.t = INT_ARRAY;
                         continue;
                     } else if (el == "float") {
+                        typed_float = t == UNDEFINED;
                         t = FLOAT;
                         m.t = FLOAT_ARRAY;
                         continue;
@@ -1697,10 +6767,8 @@ class IndraLink {
                             //    sm = local_symbols[el];
                             //    break;
                             case SYMBOL_TYPE::GLOBAL:
-                                if (el[0] == '$')
-                                    sm = symbols[el.substr(1)];
-                                else
-                                    sm = symbols[el];
+                                parse_reads_globals = true;
+                                sm = globals().at(el[0] == '$' ? el.substr(1) : el);
                                 if (sm.t == INT || sm.t == FLOAT || sm.t == BOOL || sm.t == STRING) {
                                     ti = sm.t;
                                     el = sm.str();
@@ -1714,6 +6782,11 @@ class IndraLink {
                     }
                 }
                 if (t == UNDEFINED && ti != UNDEFINED) t = ti;
+                if (typed_float && ti == INT) {
+                    m.vaf.push_back(elt.vi);
+                    m.t = FLOAT_ARRAY;
+                    continue;
+                }
                 if (t != ti || t == UNDEFINED) {
                     m.t = ERROR;
                     m.vs = "Bad-array-el: " + el;
@@ -1721,11 +6794,11 @@ class IndraLink {
                 }
                 switch (t) {
                 case INT:
-                    m.vai.push_back(atoi(el.c_str()));
+                    m.vai.push_back(elt.vi);
                     m.t = INT_ARRAY;
                     break;
                 case FLOAT:
-                    m.vaf.push_back(atof(el.c_str()));
+                    m.vaf.push_back(elt.vf);
                     m.t = FLOAT_ARRAY;
                     break;
                 case BOOL:
@@ -1737,7 +6810,7 @@ class IndraLink {
                     break;
                 case STRING:
                     if (el.length() > 1)
-                        el = el.substr(1, el.length() - 2);
+                        el = unescape(el.data() + 1, el.length() - 2);
                     else
                         el = "INV_STR";
                     m.vas.push_back(el);
@@ -1750,13 +6823,17 @@ class IndraLink {
                     break;
                 }
             }
+        } else if (is_quote(token)) {
+            m.t = QUOTE;
+            m.vs = token;
+            m.vq = std::make_shared<vector<IlAtom>>(parse(token.data() + 1, token.length() - 2));
         } else if (is_flow_control(token)) {
             m.t = FLOW_CONTROL;
             m.vs = token;
             m.name = token;
         } else if (is_inbuilt(token)) {
             m.t = IFUNC;
-            m.vif = inbuilts[token];
+            m.vif = *find_inbuilt(token);
             m.vs = token;
         } else if (is_func(token)) {
             m.t = FUNC;
@@ -1786,62 +6863,149 @@ class IndraLink {
         return m;
     }
 
-    vector<IlAtom> parse(string &input) {
+    vector<IlAtom> parse(const char *src, size_t n) {
         vector<IlAtom> ps;
-        vector<string> tokens = split(input);
-        for (auto tok : tokens) {
+        vector<IlToken> tokens = tokenize(src, n);
+        ps.reserve(tokens.size());
+        for (const auto &tok : tokens) {
             ps.push_back(parse_tok(tok));
         }
         return ps;
     }
 
-    bool is_inbuilt(string funcName) {
-        if (inbuilts.find(funcName) == inbuilts.end()) return false;
-        return true;
+    vector<IlAtom> parse(const string &input) {
+        return parse(input.data(), input.size());
     }
 
-    bool is_func(string funcName) {
-        if (funcs.find(funcName) == funcs.end()) return false;
-        return true;
+    bool is_inbuilt(const string &funcName) {
+        return find_inbuilt(funcName) != nullptr;
+    }
+
+    bool is_func(const string &funcName) {
+        return find_func(funcName) != nullptr;
+    }
+
+    const IlInbuilt *find_inbuilt(const string &name) {
+        auto it = inbuilts.find(name);
+        if (it != inbuilts.end()) return &it->second;
+        if (library) {
+            auto lt = library->inbuilts.find(name);
+            if (lt != library->inbuilts.end()) return &lt->second;
+        }
+        return nullptr;
+    }
+
+    const vector<IlAtom> *find_func(const string &name) {
+        // Own definitions shadow those of the library.
+        auto it = funcs.find(name);
+        if (it != funcs.end()) return &it->second;
+        if (library) {
+            auto lt = library->funcs.find(name);
+            if (lt != library->funcs.end()) return &lt->second;
+        }
+        return nullptr;
+    }
+
+    std::shared_ptr<const IlLibrary> make_library() {
+        // An immutable copy of all functions and inbuilts (including those of the library in use) for
+        // IlLibrarySlot::publish or IndraLink(lib).
+        auto lib = std::make_shared<IlLibrary>();
+        if (library) {
+            lib->funcs = library->funcs;
+            lib->inbuilts = library->inbuilts;
+            lib->late_bound = library->late_bound;
+        }
+        lib->late_bound.insert(late_bound.begin(), late_bound.end());
+        for (const auto &funcPair : funcs) lib->funcs[funcPair.first] = funcPair.second;
+        for (const auto &inbuiltPair : inbuilts) lib->inbuilts[inbuiltPair.first] = inbuiltPair.second;
+        return lib;
+    }
+
+    template <typename F>
+    void def(const string &name, F f) {
+        // Binds the typed host function f as word name, see il_inbuilt: il.def("clamp", [](double x, double lo,
+        // double hi) { ... }). Further defs of name add overloads, the first whose parameter types match the
+        // stack is called. An inbuilt that name had before is called if none matches.
+        auto ns = std::make_shared<IlNativeSet>();
+        auto it = natives.find(name);
+        if (it != natives.end()) {
+            *ns = *it->second;
+        } else if (const IlInbuilt *pi = find_inbuilt(name)) {
+            ns->fallback = *pi;
+        }
+        ns->overloads.push_back(il_native_overload(f));
+        natives[name] = ns;
+        inbuilts[name] = il_native_inbuilt(name, ns);
+        late_bound.insert(name);
+        clear_eval_cache();
+    }
+
+    template <typename T>
+    std::shared_ptr<IlHostBuffer> bind_array(const string &name, T *data, size_t n, bool writable = false, const vector<int> &shape = vector<int>(), std::shared_ptr<void> owner = nullptr) {
+        // Binds n elements of T (float, double, int32_t, int16_t, uint16_t, int8_t, uint8_t) at data as global
+        // array name, an ARRAY_VIEW on the host memory, nothing is copied. Writable memory receives stores into
+        // the global and updates of it. The memory must stay valid until the returned guard is released.
+        auto buf = std::make_shared<IlHostBuffer>(writable && !std::is_const<T>::value, owner);
+        string gname = name[0] == '$' ? name.substr(1) : name;
+        symbols[gname] = host_array_atom(buf, data, n, IlDType<typename std::remove_const<T>::type>::value, shape);
+        host_arrays = true;
+        globals_snapshot.reset();
+        if (track_changes) changed_symbols.insert(gname);
+        return buf;
+    }
+
+    template <typename T>
+    std::shared_ptr<IlHostBuffer> bind_array(const string &name, std::shared_ptr<vector<T>> v, bool writable = false, const vector<int> &shape = vector<int>()) {
+        // Binds the elements of v, the view keeps v alive. v must not be resized while it is bound.
+        return bind_array(name, v->data(), v->size(), writable, shape, v);
+    }
+
+    void use_library(std::shared_ptr<const IlLibrary> lib) {
+        // Switches to another library (version), e.g. IlLibrarySlot::get() before handling a request.
+        if (lib == library) return;
+        library = lib;
+        clear_eval_cache();
     }
 
     enum SYMBOL_TYPE { NONE,
                        LOCAL,
                        GLOBAL };
 
-    SYMBOL_TYPE symbol_type(string symName, map<string, IlAtom> *local_symbols) {
+    SYMBOL_TYPE symbol_type(const string &symName, IlLocals *local_symbols) {
         if (symName.length() < 1) return SYMBOL_TYPE::NONE;
         if (symName[0] != '$') {
-            if ((local_symbols) && (local_symbols->find(symName) != local_symbols->end())) return SYMBOL_TYPE::LOCAL;
+            if ((local_symbols) && local_symbols->find(symName)) return SYMBOL_TYPE::LOCAL;
         }
+        const map<string, IlAtom> &gs = globals();
         if (symName[0] == '$') {
-            if (symbols.find(symName.substr(1)) != symbols.end()) return SYMBOL_TYPE::GLOBAL;
+            if (gs.find(symName.substr(1)) != gs.end()) return SYMBOL_TYPE::GLOBAL;
         } else {
-            if (symbols.find(symName) != symbols.end()) return SYMBOL_TYPE::GLOBAL;
+            if (gs.find(symName) != gs.end()) return SYMBOL_TYPE::GLOBAL;
         }
         return SYMBOL_TYPE::NONE;
     }
 
-    bool is_flow_control(string symName) {
+    bool is_flow_control(const string &symName) {
         // if (flow_control_words.find(symName) == flow_control_words.end()) return false;
         if (std::find(flow_control_words.begin(), flow_control_words.end(), symName) == flow_control_words.end()) return false;
         return true;
     }
 
-    bool is_def_word(string symName) {
+    bool is_def_word(const string &symName) {
         if (std::find(def_words.begin(), def_words.end(), symName) == def_words.end()) return false;
         return true;
     }
 
-    bool is_reserved(string name) {
-        return is_inbuilt(name) || is_flow_control(name) || is_def_word(name);
+    bool is_reserved(const string &name) {
+        // Names that can't be redefined. Functions and variables may shadow inbuilts, see bind_names.
+        return is_flow_control(name) || is_def_word(name);
     }
 
     string store_def(vector<IlAtom> funcDef) {
         if (funcDef.size() < 2) {
             return "Func-Def-Too-Short: " + std::to_string(funcDef.size());
         }
-        if (funcDef[0].t != SYMBOL && funcDef[0].t != FUNC) {
+        if (funcDef[0].t != SYMBOL && funcDef[0].t != FUNC && funcDef[0].t != IFUNC) {
             return "Func-Def-First-Element-Must-be-Symbol";
         }
         string name = funcDef[0].vs;
@@ -1852,32 +7016,34 @@ class IndraLink {
             return "Illegal-Func-Def-name-first-char";
         }
         funcDef.erase(funcDef.begin());
+        if (is_inbuilt(name)) late_bound.insert(name);
         funcs[name] = funcDef;
+        clear_eval_cache();
+        if (track_changes) changed_funcs.insert(name);
         return "";
     }
 
     void show_func(string name) {
-        vector<IlAtom> func = funcs[name];
-        cout << ": " << name << " ";
+        const vector<IlAtom> *pf = find_func(name);
+        if (!pf) return;
+        const vector<IlAtom> &func = *pf;
+        out << ": " << name << " ";
         for (auto il : func) {
-            cout << il.str() << " ";
+            out << il.str() << " ";
         }
-        cout << ";" << endl;
+        out << ";" << "\n";
     }
 
-    bool eval(vector<IlAtom> func, vector<IlAtom> *pst, int *used_cycles = nullptr, int max_cycles = 0) {
+    bool compile(const vector<IlAtom> &func, vector<IlAtom> *pst, vector<IlAtom> *pcode) {
+        // Extracts function definitions from func and stores the remaining code with resolved jump targets in pcode.
         IlAtom res;
         bool abort = false;
-        int pc = 0;
-        vector<int> fc_stack;
         IlAtom ila;
         bool is_def = false;
         vector<IlAtom> funcDef;
-        vector<IlAtom> newFunc;
-        map<string, IlAtom> local_symbols;
+        vector<IlAtom> &newFunc = *pcode;
         string err;
         vector<int> for_level, else_level, while_level, if_level;
-        int cycles = 0;
         string last_loop = "";
         // Exctract function definitions:
         for (int pc = 0; pc < func.size(); pc++) {
@@ -1932,9 +7098,9 @@ class IndraLink {
             for (int pc = 0; pc < newFunc.size(); pc++) {
                 ila = newFunc[pc];
                 if (ila.t == FLOW_CONTROL) {
-                    if (ila.name == "for") {
+                    if (ila.name == "for" || ila.name == "pfor") {
                         for_level.push_back(pc);
-                        last_loop = "for";
+                        last_loop = ila.name;
                     } else if (ila.name == "next") {
                         if (for_level.size() == 0) {
                             res.t = ERROR;
@@ -2014,7 +7180,7 @@ class IndraLink {
                             }
                             int while_address = while_level.back();
                             newFunc[pc].jump_address = while_address;
-                        } else if (last_loop == "for") {
+                        } else if (last_loop == "for" || last_loop == "pfor") {
                             if (for_level.size() == 0) {
                                 res.t = ERROR;
                                 res.vs = "'break' without 'for'";
@@ -2049,436 +7215,1124 @@ class IndraLink {
                 pst->push_back(res);
             }
         }
-        if (!abort) {
-            // Eval:
-            last_loop = "";
-            SYMBOL_TYPE syty;
-            IlAtom sym;
-            while (!abort && pc < newFunc.size()) {
-                ++cycles;
-                if (max_cycles && cycles > max_cycles) {
-                    cout << endl
-                         << "ABORT PROGRAM RUNTIME EXCEEDED" << endl;
-                    abort = true;
-                    sym.t = ERROR;
-                    sym.vs = "Calculation exceeded max_cycles " + std::to_string(max_cycles) + ", aborted.";
-                    pst->push_back(sym);
-                    continue;
+        if (!abort) bind_names(&newFunc);
+        return !abort;
+    }
+
+    void bind_names(vector<IlAtom> *pcode) {
+        // Inbuilts are bound when code is parsed. Here, a variable stored by the code shadows an inbuilt of the
+        // same name within that code, a function shadows an inbuilt everywhere, and a name defined with def after
+        // parsing calls the new definition.
+        vector<string> stored;
+        for (const auto &a : *pcode)
+            if (a.t == STORE_SYMBOL && is_inbuilt(a.name)) stored.push_back(a.name);
+        if (stored.empty() && late_bound.empty() && !(library && !library->late_bound.empty())) return;
+        for (auto &a : *pcode) {
+            if (a.t != IFUNC) continue;
+            if (std::find(stored.begin(), stored.end(), a.vs) != stored.end()) {
+                a.t = SYMBOL;
+                a.name = a.vs;
+                a.vif = nullptr;
+            } else if (late_bound.count(a.vs) || (library && library->late_bound.count(a.vs))) {
+                if (is_func(a.vs)) {
+                    a.t = FUNC;
+                    a.name = a.vs;
+                    a.vif = nullptr;
+                } else if (const IlInbuilt *pi = find_inbuilt(a.vs)) {
+                    a.vif = *pi;
                 }
+            }
+        }
+    }
 
-                ila = newFunc[pc];
-                // for (auto ila : func) {
-                switch (ila.t) {
-                case INT:
-                case FLOAT:
-                case BOOL:
-                case STRING:
+    bool exec(const vector<IlAtom> &code, vector<IlAtom> *pst, IlLocals &local_symbols, int *used_cycles = nullptr, int max_cycles = 0) {
+        // Runs compiled code with the given locals, on abort the error is left on the stack.
+        IlContinuation k;
+        k.frames.push_back(IlFrame(&code, &local_symbols));
+        return run_to_end(&k, pst, used_cycles, max_cycles);
+    }
+
+    bool run_to_end(IlContinuation *pk, vector<IlAtom> *pst, int *used_cycles, int max_cycles) {
+        // Runs pk to its end, exceeding max_cycles (> 0) aborts with an error.
+        IlRunStatus status = run(pk, pst, max_cycles, used_cycles);
+        if (status == il_run_suspended) {
+            out << "\nABORT PROGRAM RUNTIME EXCEEDED\n";
+            IlAtom err;
+            err.t = ERROR;
+            err.vs = "Calculation exceeded max_cycles " + std::to_string(max_cycles) + ", aborted.";
+            pst->push_back(err);
+        }
+        return status == il_run_done;
+    }
+
+    std::shared_ptr<const vector<IlAtom>> func_code(const string &name, const vector<IlAtom> &func, vector<IlAtom> *pst) {
+        // Compiled code of a function, compiled once until functions change. nullptr (error on stack) if it doesn't compile.
+        auto it = compiled_funcs.find(name);
+        if (it != compiled_funcs.end()) return it->second;
+        auto code = std::make_shared<vector<IlAtom>>();
+        if (!compile(func, pst, code.get())) return nullptr;
+        compiled_funcs[name] = code;
+        return code;
+    }
+
+    std::shared_ptr<const vector<IlAtom>> quote_code(const IlAtom &q, vector<IlAtom> *pst) {
+        auto code = std::make_shared<vector<IlAtom>>();
+        if (!compile(*q.vq, pst, code.get())) return nullptr;
+        return code;
+    }
+
+    bool is_generator_call(const vector<IlAtom> &code, int pc, const vector<IlAtom> &func) {
+        // A call directly before 'for' of a function that contains yield starts a generator.
+        if (pc + 1 >= (int)code.size() || code[pc + 1].t != FLOW_CONTROL || code[pc + 1].name != "for") return false;
+        for (const auto &ila : func) {
+            if (ila.t == IFUNC && ila.vs == "yield") return true;
+        }
+        return false;
+    }
+
+    bool start_generator(std::shared_ptr<const vector<IlAtom>> code, vector<IlAtom> *pst) {
+        // Pushes a GENERATOR for the function code. It runs on pst up to its first yield, what it takes from
+        // pst until then (including the yielded value) are its arguments. The values above those move to the
+        // stack of the generator, on which 'for' resumes it.
+        IlAtom ga;
+        ga.t = GENERATOR;
+        ga.vs = "generator";
+        ga.vgen = std::make_shared<IlGenerator>();
+        IlGenerator &g = *ga.vgen;
+        g.k.push(code);
+        g.k.stack_low = pst->size();
+        IlRunStatus status = run(&g.k, pst);
+        if (status == il_run_error) return false;
+        size_t low = g.k.stack_low;
+        if (status == il_run_suspended && pst->size() - 1 < low) low = pst->size() - 1;
+        g.stack.assign(std::make_move_iterator(pst->begin() + low), std::make_move_iterator(pst->end()));
+        pst->erase(pst->begin() + low, pst->end());
+        g.ready = status == il_run_suspended;
+        if (!g.ready) g.stack.clear();
+        pst->push_back(ga);
+        return true;
+    }
+
+    IlRunStatus generator_next(IlGenerator *pg, IlAtom *pa) {
+        // Resumes pg up to its next yield: il_run_suspended with the value in pa, il_run_done at its end, or
+        // il_run_error with the error in pa.
+        if (!pg->ready) {
+            if (pg->k.done()) return il_run_done;
+            IlRunStatus status = run(&pg->k, &pg->stack);
+            if (status == il_run_error) {
+                *pa = pg->stack.back();
+                pg->stack.clear();
+                return status;
+            }
+            if (status == il_run_done) {
+                pg->stack.clear();
+                return status;
+            }
+        }
+        pg->ready = false;
+        *pa = pg->stack.back();
+        pg->stack.pop_back();
+        return il_run_suspended;
+    }
+
+    IlRunStatus run(IlContinuation *pk, vector<IlAtom> *pst, int budget = 0, int *used_cycles = nullptr) {
+        // Runs the frames of pk until they are done, an error occurs in the outermost frame (it is left on the
+        // stack), or budget (> 0) instructions have been executed. Function calls and eval of quotes and strings
+        // push frames instead of recursing, so a suspended run keeps its complete state in pk.
+        IlAtom res;
+        int cycles = 0;
+        SYMBOL_TYPE syty;
+        IlRunStatus status = il_run_done;
+        while (!pk->frames.empty()) {
+            IlFrame *pfr = &pk->frames.back();
+            if (pfr->pc >= pfr->end) {
+                pk->pop();
+                continue;
+            }
+            if (budget && cycles >= budget) {
+                status = il_run_suspended;
+                break;
+            }
+            ++cycles;
+            const vector<IlAtom> &newFunc = *pfr->code;
+            int pc = (int)pfr->pc;
+            IlLocals &local_symbols = pfr->symbols();
+            string &last_loop = pfr->last_loop;
+            std::shared_ptr<const vector<IlAtom>> call;  // code of a function call or eval, run in a new frame
+            bool yielded = false;
+            bool abort = false;
+            const IlAtom &ila = newFunc[pc];
+            switch (ila.t) {
+            case INT:
+            case FLOAT:
+            case BOOL:
+            case STRING:
+            case QUOTE:
+                pst->push_back(ila);
+                break;
+            case INT_ARRAY:
+            case FLOAT_ARRAY:
+            case BOOL_ARRAY:
+            case STRING_ARRAY:
+                if (ila.t == ERROR) {
+                    abort = true;
+                } else {
                     pst->push_back(ila);
+                }
+                break;
+            case IFUNC:
+                if (ila.vs == "eval" && pst->size() > 0 && (pst->back().t == QUOTE || pst->back().t == STRING)) {
+                    // Run in a frame instead of by the inbuilt, so that a budget can suspend within it.
+                    IlAtom q = pst->back();
+                    pst->pop_back();
+                    call = q.t == QUOTE ? quote_code(q, pst) : string_code(q.vs, pst);
+                    if (!call) report_error(pst);
                     break;
-                case INT_ARRAY:
-                case FLOAT_ARRAY:
-                case BOOL_ARRAY:
-                case STRING_ARRAY:
-                    if (ila.t == ERROR) {
+                }
+                if (ila.vs == "yield" && pk->generator) {  // else the yield of a scheduler task
+                    if (pst->size() == 0) {
+                        res.t = ERROR;
+                        res.vs = "Stack-underflow-on-yield";
+                        pst->push_back(res);
                         abort = true;
-                    } else {
-                        pst->push_back(ila);
                     }
+                    yielded = true;
                     break;
-                case IFUNC:
-                    ila.vif(pst);
-                    if (pst->size() > 0) {
-                        if ((*pst)[pst->size() - 1].t == ERROR) {
-                            abort = true;
-                        }
-                    }
+                }
+                if (has_views(pst) && !is_view_inbuilt(ila.vs) && !force_views(pst)) {
+                    abort = true;
+                    break;
+                }
+                if (budget || retry_run) {  // nested runs without a budget only hide the run of a task
+                    IlContinuation *outer = retry_run;
+                    retry_run = budget ? pk : nullptr;
+                    ila.vif(this, pst);
+                    retry_run = outer;
+                } else {
+                    ila.vif(this, pst);  // pure quote runs on the task pool don't write members
+                }
+                if (pk->retry) {  // suspended, runs again when resumed
+                    pk->retry = false;
+                    --pc;
                     break;
-                case FLOW_CONTROL:
-                    if (ila.name == "if") {
-                        if (pst->size() == 0) {
+                }
+                if (pst->size() > 0) {
+                    if ((*pst)[pst->size() - 1].t == ERROR) {
+                        abort = true;
+                    }
+                }
+                break;
+            case FLOW_CONTROL:
+                if (ila.name == "if") {
+                    if (pst->size() == 0) {
+                        res.t = ERROR;
+                        res.vs = "Stack-underflow-on-if";
+                        pst->push_back(res);
+                        abort = true;
+                    } else {
+                        IlAtom b = pst->back();
+                        pst->pop_back();
+                        if (b.t != BOOL && b.t != INT) {
                             res.t = ERROR;
-                            res.vs = "Stack-underflow-on-if";
+                            res.vs = "No-int-or-bool-for-if";
                             pst->push_back(res);
                             abort = true;
                         } else {
-                            IlAtom b = pst->back();
-                            pst->pop_back();
-                            if (b.t != BOOL && b.t != INT) {
-                                res.t = ERROR;
-                                res.vs = "No-int-or-bool-for-if";
-                                pst->push_back(res);
-                                abort = true;
-                            } else {
-                                if (b.t == BOOL) {
-                                    if (b.vb) {
-                                        break;
-                                    } else {
-                                        pc = ila.jump_address;
-                                    }
-                                } else if (b.t == INT) {
-                                    if (b.vi != 0) {
-                                        break;
-                                    } else {
-                                        pc = ila.jump_address;
-                                    }
+                            if (b.t == BOOL) {
+                                if (b.vb) {
+                                    break;
+                                } else {
+                                    pc = ila.jump_address;
+                                }
+                            } else if (b.t == INT) {
+                                if (b.vi != 0) {
+                                    break;
+                                } else {
+                                    pc = ila.jump_address;
                                 }
                             }
                         }
-                    } else if (ila.name == "else") {
-                        pc = ila.jump_address;
-                    } else if (ila.name == "endif") {
-                    } else if (ila.name == "while") {
-                        if (pst->size() == 0) {
+                    }
+                } else if (ila.name == "else") {
+                    pc = ila.jump_address;
+                } else if (ila.name == "endif") {
+                } else if (ila.name == "while") {
+                    if (pst->size() == 0) {
+                        res.t = ERROR;
+                        res.vs = "Stack-underflow-on-while";
+                        pst->push_back(res);
+                        abort = true;
+                    } else {
+                        last_loop = "while";
+                        IlAtom b = pst->back();
+                        pst->pop_back();
+                        if (b.t != BOOL && b.t != INT) {
                             res.t = ERROR;
-                            res.vs = "Stack-underflow-on-while";
+                            res.vs = "No-int-or-bool-for-while";
                             pst->push_back(res);
                             abort = true;
                         } else {
-                            last_loop = "while";
-                            IlAtom b = pst->back();
-                            pst->pop_back();
-                            if (b.t != BOOL && b.t != INT) {
-                                res.t = ERROR;
-                                res.vs = "No-int-or-bool-for-while";
-                                pst->push_back(res);
-                                abort = true;
-                            } else {
-                                if (b.t == BOOL) {
-                                    if (b.vb) {
-                                        break;
-                                    } else {
-                                        pc = ila.jump_address;
-                                    }
-                                } else if (b.t == INT) {
-                                    if (b.vi != 0) {
-                                        break;
-                                    } else {
-                                        pc = ila.jump_address;
-                                    }
+                            if (b.t == BOOL) {
+                                if (b.vb) {
+                                    break;
+                                } else {
+                                    pc = ila.jump_address;
+                                }
+                            } else if (b.t == INT) {
+                                if (b.vi != 0) {
+                                    break;
+                                } else {
+                                    pc = ila.jump_address;
                                 }
                             }
                         }
-                    } else if (ila.name == "loop") {
-                        pc = ila.jump_address - 1;
-                    } else if (ila.name == "for") {
-                        if (pst->size() == 0) {
-                            res.t = ERROR;
-                            res.vs = "Stack-underflow-on-for";
-                            pst->push_back(res);
-                            abort = true;
-                        } else {
-                            IlAtom b = pst->back();
-                            pst->pop_back();
-                            if (b.t != INT_ARRAY && b.t != STRING_ARRAY && b.t != FLOAT_ARRAY && b.t != BOOL_ARRAY) {
+                    }
+                } else if (ila.name == "loop") {
+                    pc = ila.jump_address - 1;
+                } else if (ila.name == "for") {
+                    if (pst->size() == 0) {
+                        res.t = ERROR;
+                        res.vs = "Stack-underflow-on-for";
+                        pst->push_back(res);
+                        abort = true;
+                    } else {
+                        IlAtom b = std::move(pst->back());
+                        pst->pop_back();
+                        if (b.t == FILE_STREAM && b.vfs->csv_rows) {
+                            last_loop = "for";
+                            IlCsvReader csv(b.vfs->csv_delim);
+                            string err;
+                            if (csv_next(b.vfs.get(), &csv, &err)) {
+                                pst->push_back(std::move(b));
+                                push_csv(&csv, pst);
+                            } else if (err != "") {
                                 res.t = ERROR;
-                                res.vs = "'for' requires an INT, STRING, FLOAT, or BOOL array stack";
+                                res.vs = err;
                                 pst->push_back(res);
                                 abort = true;
                             } else {
-                                last_loop = "for";
-                                switch (b.t) {
-                                case INT_ARRAY:
-                                    if (b.vai.size() == 0) {
-                                        pc = ila.jump_address;
-                                    } else {
-                                        IlAtom fi;
-                                        fi.t = INT;
-                                        fi.vi = b.vai[0];
-                                        fi.vs = std::to_string(fi.vi);
-                                        b.vai.erase(b.vai.begin());
-                                        pst->push_back(b);
-                                        pst->push_back(fi);
-                                    }
-                                    break;
-                                case FLOAT_ARRAY:
-                                    if (b.vaf.size() == 0) {
-                                        pc = ila.jump_address;
-                                    } else {
-                                        IlAtom fi;
-                                        fi.t = FLOAT;
-                                        fi.vf = b.vaf[0];
-                                        fi.vs = std::to_string(fi.vf);
-                                        b.vaf.erase(b.vaf.begin());
-                                        pst->push_back(b);
-                                        pst->push_back(fi);
-                                    }
-                                    break;
-                                case BOOL_ARRAY:
-                                    if (b.vab.size() == 0) {
-                                        pc = ila.jump_address;
-                                    } else {
-                                        IlAtom fi;
-                                        fi.t = BOOL;
-                                        fi.vb = b.vab[0];
-                                        if (fi.vb)
-                                            fi.vs = "true";
-                                        else
-                                            fi.vs = "false";
-                                        b.vab.erase(b.vab.begin());
-                                        pst->push_back(b);
-                                        pst->push_back(fi);
-                                    }
-                                    break;
-                                case STRING_ARRAY:
-                                    if (b.vas.size() == 0) {
-                                        pc = ila.jump_address;
-                                    } else {
-                                        IlAtom fi;
-                                        fi.t = STRING;
-                                        fi.vs = b.vas[0];
-                                        b.vas.erase(b.vas.begin());
-                                        pst->push_back(b);
-                                        pst->push_back(fi);
-                                    }
-                                    break;
-                                default:
-                                    res.t = ERROR;
-                                    res.vs = "'for' encounter illegal array type";
-                                    pst->push_back(res);
-                                    abort = true;
-                                    break;
-                                }
+                                pc = ila.jump_address;
                             }
+                            break;
                         }
-                    } else if (ila.name == "next") {
-                        pc = ila.jump_address - 1;
-                    } else if (ila.name == "break") {
-                        if (last_loop == "while") {
-                            res.t = BOOL;
-                            res.vb = false;
+                        if (b.t == GENERATOR) {
+                            last_loop = "for";
+                            IlAtom fi;
+                            IlRunStatus gs = generator_next(b.vgen.get(), &fi);
+                            if (gs == il_run_suspended) {
+                                pst->push_back(std::move(b));
+                                pst->push_back(fi);
+                            } else if (gs == il_run_error) {
+                                pst->push_back(fi);
+                                abort = true;
+                            } else {
+                                pc = ila.jump_address;
+                            }
+                            break;
+                        }
+                        if (b.t == FILE_STREAM) {
+                            last_loop = "for";
+                            IlAtom fi;
+                            bool more;
+                            if (b.vfs->chunk_size) {
+                                fi.t = INT_ARRAY;
+                                more = b.vfs->next_chunk(&fi.vai);
+                            } else {
+                                fi.t = STRING;
+                                more = b.vfs->next_line(&fi.vs);
+                            }
+                            if (more) {
+                                pst->push_back(std::move(b));
+                                pst->push_back(fi);
+                            } else {
+                                pc = ila.jump_address;
+                            }
+                            break;
+                        }
+                        if (!force_view(&b)) {
+                            pst->push_back(std::move(b));
+                            abort = true;
+                            break;
+                        }
+                        if (b.t != INT_ARRAY && b.t != STRING_ARRAY && b.t != FLOAT_ARRAY && b.t != BOOL_ARRAY) {
+                            res.t = ERROR;
+                            res.vs = "'for' requires an INT, STRING, FLOAT, or BOOL array or a file stream on stack";
                             pst->push_back(res);
-                        } else if (last_loop == "for") {
-                            IlAtom for_array = pst->back();
-                            pst->pop_back();
-                            switch (for_array.t) {
+                            abort = true;
+                        } else {
+                            last_loop = "for";
+                            switch (b.t) {
                             case INT_ARRAY:
-                                for_array.vai.clear();
-                                pst->push_back(for_array);
+                                if (b.vai.size() == 0) {
+                                    pc = ila.jump_address;
+                                } else {
+                                    IlAtom fi;
+                                    fi.t = INT;
+                                    fi.vi = b.vai[0];
+                                    fi.vs = std::to_string(fi.vi);
+                                    b.vai.erase(b.vai.begin());
+                                    pst->push_back(std::move(b));
+                                    pst->push_back(fi);
+                                }
                                 break;
                             case FLOAT_ARRAY:
-                                for_array.vaf.clear();
-                                pst->push_back(for_array);
+                                if (b.vaf.size() == 0) {
+                                    pc = ila.jump_address;
+                                } else {
+                                    IlAtom fi;
+                                    fi.t = FLOAT;
+                                    fi.vf = b.vaf[0];
+                                    fi.vs = std::to_string(fi.vf);
+                                    b.vaf.erase(b.vaf.begin());
+                                    pst->push_back(std::move(b));
+                                    pst->push_back(fi);
+                                }
                                 break;
                             case BOOL_ARRAY:
-                                for_array.vab.clear();
-                                pst->push_back(for_array);
+                                if (b.vab.size() == 0) {
+                                    pc = ila.jump_address;
+                                } else {
+                                    IlAtom fi;
+                                    fi.t = BOOL;
+                                    fi.vb = b.vab[0];
+                                    if (fi.vb)
+                                        fi.vs = "true";
+                                    else
+                                        fi.vs = "false";
+                                    b.vab.erase(b.vab.begin());
+                                    pst->push_back(std::move(b));
+                                    pst->push_back(fi);
+                                }
                                 break;
                             case STRING_ARRAY:
-                                for_array.vas.clear();
-                                pst->push_back(for_array);
+                                if (b.vas.size() == 0) {
+                                    pc = ila.jump_address;
+                                } else {
+                                    IlAtom fi;
+                                    fi.t = STRING;
+                                    fi.vs = b.vas[0];
+                                    b.vas.erase(b.vas.begin());
+                                    pst->push_back(std::move(b));
+                                    pst->push_back(fi);
+                                }
                                 break;
                             default:
                                 res.t = ERROR;
-                                res.vs = "Illegal array-type on for-break";
-                                abort = 1;
+                                res.vs = "'for' encounter illegal array type";
                                 pst->push_back(res);
+                                abort = true;
+                                break;
                             }
                         }
-                        // cout << "break";
-                        pc = ila.jump_address - 1;
-                    } else if (ila.name == "return") {
-                        pc = newFunc.size();
-                    }
-                    break;
-                case FUNC:
-                    if (is_func(ila.name)) {
-                        eval(funcs[ila.name], pst, used_cycles, max_cycles);
-                    } else {
-                        res.t = ERROR;
-                        res.vs = "Func-does-not-exist: " + ila.name;
-                        abort = true;
-                        break;
                     }
-                    break;
-                case SHOW_FUNC:
-                    if (is_func(ila.name)) {
-                        show_func(ila.name);
-                    } else {
-                        res.t = ERROR;
-                        res.vs = "Func-does-not-exist: " + ila.name;
-                        abort = true;
-                        break;
-                    }
-                    break;
-                case DELETE_FUNC:
-                    if (is_func(ila.name)) {
-                        funcs.erase(ila.name);
-                    } else {
-                        res.t = ERROR;
-                        res.vs = "Func-does-not-exist: " + ila.name;
-                        abort = true;
+                } else if (ila.name == "pfor") {
+                    if (!par_for(pfr, ila.jump_address, pst)) abort = true;
+                    pc = ila.jump_address;
+                } else if (ila.name == "next") {
+                    pc = ila.jump_address - 1;
+                } else if (ila.name == "break") {
+                    if (last_loop == "pfor") {  // ends the iteration
+                        pc = pfr->end - 1;
                         break;
                     }
-                    break;
-                case SYMBOL:
-                    syty = symbol_type(ila.name, &local_symbols);
-                    sym.t = ERROR;
-                    sym.vs = "Bad symbol type";
-                    if (syty != SYMBOL_TYPE::NONE) {
-                        if (syty == SYMBOL_TYPE::LOCAL)
-                            sym = local_symbols[ila.name];
-                        else if (syty == SYMBOL_TYPE::GLOBAL) {
-                            if (ila.name[0] == '$') {
-                                sym = symbols[ila.name.substr(1)];
-
-                            } else {
-                                sym = symbols[ila.name];
-                            }
-                        }
-                        switch (sym.t) {
-                        case INT:
-                            res.t = INT;
-                            res.vi = sym.vi;
-                            res.vs = std::to_string(sym.vi);
-                            break;
-                        case FLOAT:
-                            res.t = FLOAT;
-                            res.vf = sym.vf;
-                            res.vs = std::to_string(sym.vf);
-                            break;
-                        case BOOL:
-                            res.t = BOOL;
-                            res.vb = sym.vb;
-                            if (res.vb)
-                                res.vs = "true";
-                            else
-                                res.vb = "false";
-                            break;
-                        case STRING:
-                            res.t = STRING;
-                            res.vs = sym.vs;
-                            break;
+                    if (last_loop == "while") {
+                        res.t = BOOL;
+                        res.vb = false;
+                        pst->push_back(res);
+                    } else if (last_loop == "for") {
+                        IlAtom for_array = std::move(pst->back());
+                        pst->pop_back();
+                        switch (for_array.t) {
                         case INT_ARRAY:
-                            res.t = INT_ARRAY;
-                            res.vai = sym.vai;
-                            res.vs = sym.str();
+                            for_array.vai.clear();
+                            pst->push_back(std::move(for_array));
                             break;
                         case FLOAT_ARRAY:
-                            res.t = FLOAT_ARRAY;
-                            res.vaf = sym.vaf;
-                            res.vs = sym.str();
+                            for_array.vaf.clear();
+                            pst->push_back(std::move(for_array));
                             break;
                         case BOOL_ARRAY:
-                            res.t = BOOL_ARRAY;
-                            res.vab = sym.vab;
-                            res.vs = sym.str();
+                            for_array.vab.clear();
+                            pst->push_back(std::move(for_array));
                             break;
                         case STRING_ARRAY:
-                            res.t = STRING_ARRAY;
-                            res.vas = sym.vas;
-                            res.vs = sym.str();
+                            for_array.vas.clear();
+                            pst->push_back(std::move(for_array));
                             break;
-                        case ERROR:
-                            res = sym;
+                        case FILE_STREAM:
+                            for_array.vfs->close();
+                            pst->push_back(std::move(for_array));
                             break;
-                        default:
-                            res.t = ERROR;
-                            res.vs = "Illegal-Symbol-content-type";
-                            abort = true;
+                        case GENERATOR:
+                            for_array.vgen->k.frames.clear();
+                            for_array.vgen->stack.clear();
+                            for_array.vgen->ready = false;
+                            pst->push_back(std::move(for_array));
                             break;
-                        }
-                        pst->push_back(res);
-                    } else {
-                        if (is_func(ila.name)) {  // If a function gets defined during current command, it might have been parsed at unknown symbol
-                            eval(funcs[ila.name], pst);
-                        } else {
+                        default:
                             res.t = ERROR;
-                            res.vs = "Undefined-symbol-reference: <" + ila.name + ">";
+                            res.vs = "Illegal array-type on for-break";
+                            abort = 1;
                             pst->push_back(res);
-                            abort = true;
                         }
                     }
+                    // cout << "break";
+                    pc = ila.jump_address - 1;
+                } else if (ila.name == "return") {
+                    pc = newFunc.size();
+                }
+                break;
+            case FUNC:
+                if (const vector<IlAtom> *pf = find_func(ila.name)) {
+                    call = func_code(ila.name, *pf, pst);
+                    if (!call) {
+                        report_error(pst);
+                    } else if (is_generator_call(newFunc, pc, *call)) {
+                        abort = !start_generator(call, pst);
+                        call = nullptr;
+                    }
+                } else {
+                    res.t = ERROR;
+                    res.vs = "Func-does-not-exist: " + ila.name;
+                    abort = true;
                     break;
-                case STORE_SYMBOL:
-                    if (is_reserved(ila.name) || is_func(ila.name)) {
-                        res.t = ERROR;
-                        res.vs = "Name-in-use-by-func";
+                }
+                break;
+            case SHOW_FUNC:
+                if (is_func(ila.name)) {
+                    show_func(ila.name);
+                } else {
+                    res.t = ERROR;
+                    res.vs = "Func-does-not-exist: " + ila.name;
+                    abort = true;
+                    break;
+                }
+                break;
+            case DELETE_FUNC:
+                if (funcs.find(ila.name) == funcs.end() && is_func(ila.name)) {
+                    res.t = ERROR;
+                    res.vs = "Library-func-is-immutable: " + ila.name;
+                    pst->push_back(res);
+                    abort = true;
+                    break;
+                }
+                if (is_func(ila.name)) {
+                    funcs.erase(ila.name);
+                    clear_eval_cache();
+                    if (track_changes) changed_funcs.insert(ila.name);
+                } else {
+                    res.t = ERROR;
+                    res.vs = "Func-does-not-exist: " + ila.name;
+                    abort = true;
+                    break;
+                }
+                break;
+            case SYMBOL:
+                syty = symbol_type(ila.name, &local_symbols);
+                if (syty != SYMBOL_TYPE::NONE) {
+                    const IlAtom &sym = syty == SYMBOL_TYPE::LOCAL ? *local_symbols.find(ila.name) : globals().at(ila.name[0] == '$' ? ila.name.substr(1) : ila.name);
+                    switch (sym.t) {
+                    case INT:
+                    case FLOAT:
+                    case BOOL:
+                    case STRING:
+                    case QUOTE:
+                    case ARRAY_VIEW:
+                    case FILE_STREAM:
+                    case FUTURE:
+                    case CHANNEL:
+                    case GENERATOR:
+                    case ERROR:
+                        pst->push_back(sym);
+                        break;
+                    case INT_ARRAY:
+                        res.t = INT_ARRAY;
+                        res.vai = sym.vai;
+                        res.vs = sym.str();
                         pst->push_back(res);
-                        abort = true;
                         break;
-                    }
-                    if (pst->size() < 1) {
-                        res.t = ERROR;
-                        res.vs = "Symdef-stack-underflow";
+                    case FLOAT_ARRAY:
+                        res.t = FLOAT_ARRAY;
+                        res.vaf = sym.vaf;
+                        res.vs = sym.str();
                         pst->push_back(res);
-                        abort = true;
                         break;
-                    }
-                    res = pst->back();
-                    pst->pop_back();
-                    if (res.t != INT && res.t != FLOAT && res.t != BOOL && res.t != STRING && res.t != INT_ARRAY && res.t != FLOAT_ARRAY && res.t != BOOL_ARRAY && res.t != STRING_ARRAY) {
-                        res.t = ERROR;
-                        res.vs = "Symdef-invalid-type";
+                    case BOOL_ARRAY:
+                        res.t = BOOL_ARRAY;
+                        res.vab = sym.vab;
+                        res.vs = sym.str();
                         pst->push_back(res);
-                        abort = true;
                         break;
-                    }
-                    if (ila.name[0] == '>' || ila.name[0] == '!') {
+                    case STRING_ARRAY:
+                        res.t = STRING_ARRAY;
+                        res.vas = sym.vas;
+                        res.vs = sym.str();
+                        pst->push_back(res);
+                        break;
+                    default:
                         res.t = ERROR;
-                        res.vs = "Symdef-invalid-name";
+                        res.vs = "Illegal-Symbol-content-type";
                         pst->push_back(res);
                         abort = true;
                         break;
                     }
-                    syty = symbol_type(ila.name, &local_symbols);
-                    if (syty == SYMBOL_TYPE::GLOBAL)
-                        if (ila.name[0] == '$') {
-                            symbols[ila.name.substr(1)] = res;
-                        } else {
-                            symbols[ila.name] = res;
+                } else {
+                    if (const vector<IlAtom> *pf = find_func(ila.name)) {  // If a function gets defined during current command, it might have been parsed at unknown symbol
+                        call = func_code(ila.name, *pf, pst);
+                        if (!call) {
+                            report_error(pst);
+                        } else if (is_generator_call(newFunc, pc, *call)) {
+                            abort = !start_generator(call, pst);
+                            call = nullptr;
                         }
-                    else if (ila.name[0] == '$') {
-                        symbols[ila.name.substr(1)] = res;
                     } else {
-                        local_symbols[ila.name] = res;
-                    }
-                    break;
-                case DELETE_SYMBOL:
-                    syty = symbol_type(ila.name, &local_symbols);
-                    switch (syty) {
-                    case SYMBOL_TYPE::NONE:
                         res.t = ERROR;
-                        res.vs = "Symdelete-non-existant";
+                        res.vs = "Undefined-symbol-reference: <" + ila.name + ">";
                         pst->push_back(res);
                         abort = true;
-                        break;
-                    case SYMBOL_TYPE::LOCAL:
-                        local_symbols.erase(ila.name);
-                        break;
-                    case SYMBOL_TYPE::GLOBAL:
-                        if (ila.name[0] == '$') {
-                            symbols.erase(ila.name.substr(1));
-                        } else {
-                            symbols.erase(ila.name);
+                    }
+                }
+                break;
+            case STORE_SYMBOL:
+                if (is_reserved(ila.name) || is_func(ila.name)) {
+                    res.t = ERROR;
+                    res.vs = "Name-in-use-by-func";
+                    pst->push_back(res);
+                    abort = true;
+                    break;
+                }
+                if (pst->size() < 1) {
+                    res.t = ERROR;
+                    res.vs = "Symdef-stack-underflow";
+                    pst->push_back(res);
+                    abort = true;
+                    break;
+                }
+                res = std::move(pst->back());
+                pst->pop_back();
+                if (host_arrays && !global_view && (ila.name[0] == '$' || symbol_type(ila.name, &local_symbols) == SYMBOL_TYPE::GLOBAL)) {
+                    // Stores into a global bound to writable host memory are evaluated into the memory.
+                    auto it = symbols.find(ila.name[0] == '$' ? ila.name.substr(1) : ila.name);
+                    if (it != symbols.end() && is_host_target(it->second)) {
+                        if (!store_host_array(it->second, &res)) {
+                            pst->push_back(res);
+                            abort = true;
                         }
                         break;
                     }
+                }
+                // Views without pending steps (e.g. mapped files) are immutable and stored without copying.
+                if ((res.t != ARRAY_VIEW || !res.vx->steps.empty()) && !force_view(&res)) {
+                    pst->push_back(res);
+                    abort = true;
                     break;
-                case COMMENT:
+                }
+                if (res.t != INT && res.t != FLOAT && res.t != BOOL && res.t != STRING && res.t != INT_ARRAY && res.t != FLOAT_ARRAY && res.t != BOOL_ARRAY && res.t != STRING_ARRAY && res.t != QUOTE && res.t != ARRAY_VIEW && res.t != FILE_STREAM && res.t != FUTURE && res.t != CHANNEL && res.t != GENERATOR) {
+                    res.t = ERROR;
+                    res.vs = "Symdef-invalid-type";
+                    pst->push_back(res);
+                    abort = true;
                     break;
-                default:
+                }
+                if (ila.name[0] == '>' || ila.name[0] == '!') {
+                    res.t = ERROR;
+                    res.vs = "Symdef-invalid-name";
+                    pst->push_back(res);
+                    abort = true;
+                    break;
+                }
+                syty = symbol_type(ila.name, &local_symbols);
+                if (syty == SYMBOL_TYPE::GLOBAL || ila.name[0] == '$') {
+                    if (global_view) {
+                        res.t = ERROR;
+                        res.vs = "Globals-are-read-only-in-parallel-code";
+                        pst->push_back(res);
+                        abort = true;
+                        break;
+                    }
+                    string gname = ila.name[0] == '$' ? ila.name.substr(1) : ila.name;
+                    symbols[gname] = std::move(res);
+                    globals_snapshot.reset();
+                    if (track_changes) changed_symbols.insert(gname);
+                } else {
+                    local_symbols[ila.name] = std::move(res);
+                }
+                break;
+            case DELETE_SYMBOL:
+                syty = symbol_type(ila.name, &local_symbols);
+                switch (syty) {
+                case SYMBOL_TYPE::NONE:
                     res.t = ERROR;
-                    res.vs = "Not-implemented";
+                    res.vs = "Symdelete-non-existant";
                     pst->push_back(res);
                     abort = true;
                     break;
+                case SYMBOL_TYPE::LOCAL:
+                    local_symbols.erase(ila.name);
+                    break;
+                case SYMBOL_TYPE::GLOBAL: {
+                    if (global_view) {
+                        res.t = ERROR;
+                        res.vs = "Globals-are-read-only-in-parallel-code";
+                        pst->push_back(res);
+                        abort = true;
+                        break;
+                    }
+                    string gname = ila.name[0] == '$' ? ila.name.substr(1) : ila.name;
+                    symbols.erase(gname);
+                    globals_snapshot.reset();
+                    if (track_changes) changed_symbols.insert(gname);
+                } break;
                 }
-                ++pc;
+                break;
+            case COMMENT:
+                break;
+            default:
+                res.t = ERROR;
+                res.vs = "Not-implemented";
+                pst->push_back(res);
+                abort = true;
+                break;
             }
-        }
-        if (abort) {
-            if (pst->size() > 0 && (*pst)[pst->size() - 1].t == ERROR) {
-                IlAtom err = pst->back();
-                cout << err.str() << endl;
-                pst->pop_back();
-            } else {
-                cout << endl
-                     << "Terminated with error condition, but no error on stack!" << endl;
+            ++pc;
+            pfr->pc = pc;
+            if (abort) {
+                if (pk->frames.size() == 1) {
+                    pk->clear();
+                    status = il_run_error;
+                    break;
+                }
+                report_error(pst);  // like a failed nested eval: reported, and the caller continues
+                pk->pop();
+            } else if (call) {
+                pk->push(call);
+            } else if (yielded) {  // the value is passed on top of the generator's stack
+                status = il_run_suspended;
+                break;
+            }
+            if (pk->generator && pst->size() < pk->stack_low) pk->stack_low = pst->size();
+            if (suspend_request != il_no_suspend && budget) {  // nested runs (e.g. of map) leave it to the outermost
+                status = il_run_suspended;
+                break;
             }
         }
         if (used_cycles) *used_cycles += cycles;
+        return status;
+    }
+
+    bool eval(const vector<IlAtom> &func, vector<IlAtom> *pst, int *used_cycles = nullptr, int max_cycles = 0) {
+        ++eval_depth;
+        std::shared_ptr<vector<IlAtom>> code;
+        if (eval_depth == 1 && eval_buf && eval_buf.use_count() == 1) {  // keeps its capacity
+            code = eval_buf;
+            code->clear();
+        } else {
+            code = std::make_shared<vector<IlAtom>>();
+            if (eval_depth == 1) eval_buf = code;
+        }
+        if (!compile(func, pst, code.get())) return eval_done(true, pst);
+        return eval_done(!eval_code(code, pst, used_cycles, max_cycles), pst);
+    }
+
+    bool eval_code(std::shared_ptr<const vector<IlAtom>> code, vector<IlAtom> *pst, int *used_cycles, int max_cycles) {
+        // Runs code to its end, the outermost eval in the frames of eval_k, which keep their storage.
+        IlContinuation nested_k;
+        IlContinuation &k = eval_depth == 1 ? eval_k : nested_k;
+        k.push(code);
+        bool ok = run_to_end(&k, pst, used_cycles, max_cycles);
+        k.clear();
+        return ok;
+    }
+
+    bool call(const IlFunction &f, IlExecContext *ctx) {
+        // Runs f on ctx->stack in the frames of ctx. Errors are reported and removed as by eval.
+        if (!f) return false;
+        ++eval_depth;
+        ctx->k.push(f.code);
+        bool ok = run_to_end(&ctx->k, &ctx->stack, nullptr, 0);
+        ctx->k.clear();
+        return eval_done(!ok, &ctx->stack);
+    }
+
+    IlRunStatus eval_start(const vector<IlAtom> &func, vector<IlAtom> *pst, IlContinuation *pk, int budget, int *used_cycles = nullptr) {
+        // Like eval, but when budget (> 0) instructions have been executed, the evaluation is suspended (status
+        // il_run_suspended) and can be continued with eval_resume(pk, ...) with the same stack.
+        pk->frames.clear();
+        auto code = std::make_shared<vector<IlAtom>>();
+        if (!compile(func, pst, code.get())) {
+            ++eval_depth;
+            eval_done(true, pst);
+            return il_run_error;
+        }
+        pk->frames.push_back(IlFrame(code));
+        return eval_resume(pk, pst, budget, used_cycles);
+    }
+
+    IlRunStatus eval_resume(IlContinuation *pk, vector<IlAtom> *pst, int budget, int *used_cycles = nullptr) {
+        // Continues a suspended evaluation for up to budget (> 0) instructions. Errors are reported as by eval.
+        ++eval_depth;
+        IlRunStatus status = run(pk, pst, budget, used_cycles);
+        eval_done(status == il_run_error, pst);
+        return status;
+    }
+
+    std::shared_ptr<const vector<IlAtom>> string_code(const string &src, vector<IlAtom> *pst) {
+        // Compiled code of src from an LRU cache keyed by src. Sources that define functions or read globals
+        // while parsing are compiled every time. nullptr (error on stack) if src doesn't compile.
+        auto it = eval_cache_index.find(src);
+        if (it != eval_cache_index.end()) {
+            ++eval_cache_hits;
+            eval_cache.splice(eval_cache.begin(), eval_cache, it->second);
+            return it->second->second;
+        }
+        ++eval_cache_misses;
+        parse_reads_globals = false;
+        vector<IlAtom> ps = parse(src);
+        auto code = std::make_shared<vector<IlAtom>>();
+        if (!compile(ps, pst, code.get())) return nullptr;
+        bool defines = false;
+        for (const auto &ila : ps) {
+            if (ila.t == DEF_WORD) defines = true;
+        }
+        if (eval_cache_capacity && !defines && !parse_reads_globals) {
+            eval_cache.emplace_front(src, code);
+            eval_cache_index[src] = eval_cache.begin();
+            trim_eval_cache();
+        }
+        return code;
+    }
+
+    bool eval_string(const string &src, vector<IlAtom> *pst) {
+        // eval(parse(src), pst), with the compiled code cached by string_code.
+        ++eval_depth;
+        auto code = string_code(src, pst);
+        if (!code) return eval_done(true, pst);
+        return eval_done(!eval_code(code, pst, nullptr, 0), pst);
+    }
+
+    IlFunction function(const string &name) {
+        // Handle of the compiled function name for call_batch. Empty if there is none, or if it doesn't compile
+        // (the error is reported).
+        IlFunction f;
+        const vector<IlAtom> *pf = find_func(name);
+        if (!pf) return f;
+        vector<IlAtom> st;
+        f.code = func_code(name, *pf, &st);
+        if (!f.code) report_error(&st);
+        f.name = name;
+        return f;
+    }
+
+    bool call_batch(const IlFunction &f, vector<vector<IlAtom>> *stacks, bool parallel = false) {
+        // Calls f once for each stack of stacks: each holds the arguments of its call and receives the results.
+        // The frame, locals and stacks are reused across the batch, errors are left on top of their stack (not
+        // reported). With parallel and threads > 1, the batch is split over the task pool, globals are read-only
+        // then. false if a call failed.
+        if (!f) return false;
+        size_t n = stacks->size();
+        IlThreadPool *tp = parallel ? task_pool() : nullptr;
+        if (!tp) {
+            ++eval_depth;
+            bool ok = run_batch(f.code.get(), stacks, 0, n);
+            return eval_done(false, nullptr) && ok;
+        }
+        size_t n_chunks = (tp->size() + 1) * 4;
+        if (n_chunks > n) n_chunks = n;
+        vector<std::shared_ptr<IlStringSink>> sinks(n_chunks);
+        vector<std::unique_ptr<IndraLink>> ctxs;
+        for (size_t c = 0; c < n_chunks; c++) {
+            sinks[c] = std::make_shared<IlStringSink>();
+            ctxs.push_back(task_context(&globals(), sinks[c]));
+        }
+        std::atomic<bool> ok(true);
+        tp->parallel_for(n_chunks, [&](size_t c) {
+            if (!ctxs[c]->run_batch(f.code.get(), stacks, c * n / n_chunks, (c + 1) * n / n_chunks)) ok = false;
+            ctxs[c]->out.flush();
+        });
+        for (size_t c = 0; c < n_chunks; c++) out << sinks[c]->text;
+        out.flush();
+        return ok;
+    }
+
+    bool run_batch(const vector<IlAtom> *code, vector<vector<IlAtom>> *stacks, size_t begin, size_t end) {
+        // Runs code on the stacks [begin, end) of a batch with one continuation and one map of locals.
+        bool ok = true;
+        IlContinuation k;
+        IlLocals locals;
+        for (size_t i = begin; i < end; i++) {
+            locals.clear();
+            k.frames.push_back(IlFrame(code, &locals));
+            if (!run_to_end(&k, &(*stacks)[i], nullptr, 0)) {
+                k.frames.clear();
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    void report_error(vector<IlAtom> *pst) {
+        // Prints and removes the error of an aborted evaluation.
+        if (pst->size() > 0 && (*pst)[pst->size() - 1].t == ERROR) {
+            IlAtom err = pst->back();
+            out << err.str() << "\n";
+            pst->pop_back();
+        } else {
+            out << "\nTerminated with error condition, but no error on stack!\n";
+        }
+    }
+
+    bool eval_done(bool abort, vector<IlAtom> *pst) {
+        // Reports the error of an aborted eval, flushes the output when the outermost eval is done.
+        if (abort) report_error(pst);
+        if (--eval_depth == 0) {
+            out.flush();
+            globals_snapshot.reset();  // the host may change symbols between evals
+        }
         return !abort;
     }
 };
 
+inline bool il_force_views(IndraLink *il, vector<IlAtom> *pst, size_t depth) {
+    // Materializes the ARRAY_VIEWs within the topmost depth stack entries, false with the error on top.
+    return !il->has_views(pst, depth) || il->force_views(pst, depth);
+}
+
+enum IlTaskState {
+    il_task_ready,
+    il_task_running,
+    il_task_sleeping,
+    il_task_waiting,
+    il_task_done,
+    il_task_error,
+};
+
+struct IlTaskStats {
+    IlTaskState state;
+    uint64_t slices;  // number of times the task was run
+    uint64_t cycles;  // executed instructions
+    double run_ms;    // time spent running
+    size_t stack_size;
+};
+
+struct IlTask {
+    // A script task of an IlScheduler: data stack, frames and globals, a few hundred bytes when idle.
+    int id;
+    unsigned worker;  // tasks stay on the worker they were assigned to
+    IlTaskState state;
+    bool wake_pending;  // woken while not waiting, the next wait returns at once
+    vector<IlAtom> stack;
+    IlContinuation k;
+    map<string, IlAtom> globals;
+    std::chrono::steady_clock::time_point wake_at;
+    uint64_t slices, cycles, run_ns;
+};
+
+class IlScheduler {
+    // Runs many script tasks on a few worker threads (green threads): each worker has an IndraLink context of
+    // the shared library and runs its ready tasks in turn, each for a slice of up to slice_cycles instructions
+    // or until it yields, sleeps or waits. A task's globals are swapped into the context while it runs.
+    struct Worker {
+        std::unique_ptr<IndraLink> il;
+        std::deque<IlTask *> ready;
+        std::multimap<std::chrono::steady_clock::time_point, IlTask *> sleeping;
+        std::condition_variable cv;
+        std::thread thread;
+    };
+    std::shared_ptr<const IlLibrary> lib;
+    IndraLink compiler;  // parses and compiles spawned code
+    vector<std::unique_ptr<Worker>> workers;
+    map<int, std::unique_ptr<IlTask>> tasks;
+    std::mutex m;  // guards tasks, the queues of all workers and compiler
+    std::condition_variable idle_cv;
+    size_t n_active;  // tasks that are ready, running or sleeping
+    int next_id;
+    unsigned next_worker;
+    bool stop;
+
+  public:
+    int slice_cycles;
+
+    explicit IlScheduler(std::shared_ptr<const IlLibrary> lib, unsigned n_workers = 1, int slice_cycles = 1000)
+        : lib(lib), compiler(lib), n_active(0), next_id(1), next_worker(0), stop(false), slice_cycles(slice_cycles) {
+        auto sink = std::make_shared<IlLockedSink>(std::make_shared<IlStreamSink>(cout));
+        if (n_workers < 1) n_workers = 1;
+        for (unsigned i = 0; i < n_workers; i++) {
+            std::unique_ptr<Worker> w(new Worker());
+            w->il.reset(new IndraLink(lib));
+            w->il->cooperative = true;
+            w->il->out.set_sink(sink);
+            workers.push_back(std::move(w));
+        }
+        for (unsigned i = 0; i < n_workers; i++) workers[i]->thread = std::thread([this, i]() { work(i); });
+    }
+
+    ~IlScheduler() {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            stop = true;
+        }
+        for (auto &w : workers) {
+            w->cv.notify_all();
+            w->thread.join();
+        }
+    }
+
+    void set_sink(std::shared_ptr<IlOutputSink> sink) {
+        // Output of all tasks, serialized. Call before spawning tasks.
+        auto locked = std::make_shared<IlLockedSink>(sink ? sink : std::make_shared<IlStreamSink>(cout));
+        std::lock_guard<std::mutex> lk(m);
+        for (auto &w : workers) w->il->out.set_sink(locked);
+    }
+
+    int spawn(const string &src, const vector<IlAtom> &stack = vector<IlAtom>(), string *perr = nullptr) {
+        // Starts a task that runs src (which can't define functions, they belong into the library) on the
+        // given stack. Returns the task id, or -1 if src doesn't compile.
+        std::lock_guard<std::mutex> lk(m);
+        vector<IlAtom> st;
+        for (const auto &ila : compiler.parse(src)) {
+            if (ila.t == DEF_WORD) {
+                if (perr) *perr = "Task-code-can't-define-functions";
+                return -1;
+            }
+        }
+        auto code = compiler.string_code(src, &st);
+        if (!code) {
+            if (perr) *perr = st.size() && st.back().t == ERROR ? st.back().vs : "Task-code-does-not-compile";
+            return -1;
+        }
+        std::unique_ptr<IlTask> t(new IlTask());
+        t->stack = stack;
+        t->k.frames.push_back(IlFrame(code));
+        t->id = next_id++;
+        t->worker = next_worker++ % workers.size();
+        t->state = il_task_sleeping;  // not counted as active yet, see make_ready
+        t->wake_pending = false;
+        t->slices = t->cycles = t->run_ns = 0;
+        IlTask *pt = t.get();
+        tasks[pt->id] = std::move(t);
+        ++n_active;
+        make_ready(pt);
+        return pt->id;
+    }
+
+    bool wake(int id) {
+        // Makes a waiting task ready. A task that isn't waiting (yet) returns from its next wait at once.
+        std::lock_guard<std::mutex> lk(m);
+        auto it = tasks.find(id);
+        if (it == tasks.end()) return false;
+        IlTask *t = it->second.get();
+        if (t->state == il_task_done || t->state == il_task_error) return false;
+        if (t->state == il_task_waiting) {
+            make_ready(t);
+        } else {
+            t->wake_pending = true;
+        }
+        return true;
+    }
+
+    bool task_stats(int id, IlTaskStats *ps) {
+        std::lock_guard<std::mutex> lk(m);
+        auto it = tasks.find(id);
+        if (it == tasks.end()) return false;
+        const IlTask *t = it->second.get();
+        ps->state = t->state;
+        ps->slices = t->slices;
+        ps->cycles = t->cycles;
+        ps->run_ms = t->run_ns / 1e6;
+        ps->stack_size = t->state == il_task_running ? 0 : t->stack.size();
+        return true;
+    }
+
+    bool task_result(int id, vector<IlAtom> *pst) {
+        // The stack of a finished task.
+        std::lock_guard<std::mutex> lk(m);
+        auto it = tasks.find(id);
+        if (it == tasks.end() || (it->second->state != il_task_done && it->second->state != il_task_error)) return false;
+        *pst = it->second->stack;
+        return true;
+    }
+
+    bool remove(int id) {
+        // Frees a finished task.
+        std::lock_guard<std::mutex> lk(m);
+        auto it = tasks.find(id);
+        if (it == tasks.end() || (it->second->state != il_task_done && it->second->state != il_task_error)) return false;
+        tasks.erase(it);
+        return true;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lk(m);
+        return tasks.size();
+    }
+
+    void wait_idle() {
+        // Blocks until no task is ready, running or sleeping (all are finished or waiting).
+        std::unique_lock<std::mutex> lk(m);
+        idle_cv.wait(lk, [this]() { return n_active == 0; });
+    }
+
+  private:
+    void make_ready(IlTask *t) {
+        if (t->state != il_task_sleeping) ++n_active;
+        t->state = il_task_ready;
+        workers[t->worker]->ready.push_back(t);
+        workers[t->worker]->cv.notify_one();
+    }
+
+    void work(unsigned wi) {
+        Worker &w = *workers[wi];
+        IndraLink &il = *w.il;
+        std::unique_lock<std::mutex> lk(m);
+        while (!stop) {
+            auto now = std::chrono::steady_clock::now();
+            while (!w.sleeping.empty() && w.sleeping.begin()->first <= now) {
+                IlTask *t = w.sleeping.begin()->second;
+                w.sleeping.erase(w.sleeping.begin());
+                make_ready(t);
+            }
+            if (w.ready.empty()) {
+                if (w.sleeping.empty())
+                    w.cv.wait(lk);
+                else
+                    w.cv.wait_until(lk, w.sleeping.begin()->first);
+                continue;
+            }
+            IlTask *t = w.ready.front();
+            w.ready.pop_front();
+            t->state = il_task_running;
+            lk.unlock();
+            il.symbols.swap(t->globals);
+            int cycles = 0;
+            auto t0 = std::chrono::steady_clock::now();
+            IlRunStatus status = il.eval_resume(&t->k, &t->stack, slice_cycles, &cycles);
+            auto t1 = std::chrono::steady_clock::now();
+            il.symbols.swap(t->globals);
+            IlSuspendRequest req = il.suspend_request;
+            il.suspend_request = il_no_suspend;
+            lk.lock();
+            ++t->slices;
+            t->cycles += cycles;
+            t->run_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+            if (req == il_suspend_sleep || req == il_suspend_wait) t->stack.shrink_to_fit();  // idle tasks stay small
+            if (status != il_run_suspended) {
+                t->state = status == il_run_done ? il_task_done : il_task_error;
+            } else if (req == il_suspend_sleep) {
+                t->state = il_task_sleeping;
+                t->wake_at = il.wake_at;
+                w.sleeping.insert(std::make_pair(t->wake_at, t));
+                continue;
+            } else if (req == il_suspend_wait && !t->wake_pending) {
+                t->state = il_task_waiting;
+            } else {
+                if (req == il_suspend_wait) t->wake_pending = false;
+                t->state = il_task_ready;
+                w.ready.push_back(t);
+                continue;
+            }
+            if (--n_active == 0) idle_cv.notify_all();
+        }
+    }
+};
+
 }  // namespace inlnk
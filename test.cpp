@@ -1,3 +1,125 @@
-int main(int argc, char *argv[]) {
-    return 0;
-}
\ No newline at end of file
+#include "indralink.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+// Counts heap allocations, so that the test can check that steady-state calls don't allocate.
+static std::atomic<size_t> n_allocs(0);
+
+static void *counted_alloc(size_t n) {
+    ++n_allocs;
+    void *p = malloc(n ? n : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void *operator new(size_t n) {
+    return counted_alloc(n);
+}
+void *operator new[](size_t n) {
+    return counted_alloc(n);
+}
+void operator delete(void *p) noexcept {
+    free(p);
+}
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+void operator delete[](void *p, size_t) noexcept {
+    free(p);
+}
+
+using namespace inlnk;
+
+static bool check(const char *what, bool ok, const vector<IlAtom> &st, size_t allocs, int rep) {
+    // 3 4.5 score: 2 sqrt(3^2 + 4.5^2) + 1 (a > 0) + 45 (0 + ... + 9) + 5 ($g)
+    const double expected = 2.0 * std::sqrt(3.0 * 3.0 + 4.5 * 4.5) + 1.0 + 45.0 + 5.0;
+    if (!ok || st.size() != 1 || st.back().t != FLOAT || std::fabs(st.back().vf - expected) > 1e-9) {
+        printf("%s: wrong result %s, expected %f\n", what, st.empty() ? "(none)" : st.back().str().c_str(), expected);
+        return false;
+    }
+    if (rep > 0 && allocs != 0) {
+        printf("%s: %zu allocations in steady state\n", what, allocs);
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    IndraLink il;
+    vector<IlAtom> st;
+    // Locals, arithmetic, if, while, a nested call and a global read.
+    il.eval(il.parse(": sq dup * ; : score >b >a a sq b sq + sqrt 2.0 * >r a 0 > if r 1.0 + >r endif "
+                     "0 >i 0 >s i 10 < while s i + >s i 1 + >i i 10 < loop r s + $g + ; 5 >$g"),
+            &st);
+    IlFunction f = il.function("score");
+    if (!f.code) {
+        printf("score doesn't compile\n");
+        return 1;
+    }
+    bool ok = true;
+
+    IlExecContext ctx;
+    for (int rep = 0; rep < 4; rep++) {
+        ctx.stack.clear();
+        ctx.stack.push_back(IlRet<int>::make(3));
+        ctx.stack.push_back(IlRet<double>::make(4.5));
+        size_t a0 = n_allocs;
+        bool res = il.call(f, &ctx);
+        size_t d = n_allocs - a0;
+        ok = check("call", res, ctx.stack, d, rep) && ok;
+    }
+
+    vector<IlAtom> s2;
+    s2.reserve(16);
+    for (int rep = 0; rep < 4; rep++) {
+        s2.clear();
+        size_t a0 = n_allocs;
+        bool res = il.eval_string("3 4.5 score", &s2);
+        size_t d = n_allocs - a0;
+        ok = check("eval_string", res, s2, d, rep) && ok;
+    }
+
+    vector<IlAtom> code = il.parse("3 4.5 score");
+    for (int rep = 0; rep < 4; rep++) {
+        s2.clear();
+        size_t a0 = n_allocs;
+        bool res = il.eval(code, &s2);
+        size_t d = n_allocs - a0;
+        ok = check("eval", res, s2, d, rep) && ok;
+    }
+    if (ok) printf("allocations: ok\n");
+
+    // map of a pure quote on the task pool, its runs share the interpreter.
+    IndraLink ilm;
+    vector<IlAtom> s3;
+    bool res = ilm.eval_string("4 threads 0 parthreshold 1 5000 range { 2 * 1 + } map dup len swap sum", &s3);
+    if (!res || s3.size() != 2 || s3[0].t != INT || s3[0].vi != 5000 || s3[1].t != INT || s3[1].vi != 25010000) {
+        printf("threaded map: wrong result %s\n", s3.empty() ? "(none)" : s3.back().str().c_str());
+        ok = false;
+    } else {
+        printf("threaded map: ok\n");
+    }
+
+    // INT elements of array literals are converted only under the float type word, in either order.
+    bool lit_ok = true;
+    for (const char *src : {"[float 1.5 2]", "[float 2 1.5]", "[1.5 2]", "[2 1.5]"}) {
+        bool typed = src[1] == 'f';
+        vector<IlAtom> s4;
+        ilm.eval_string(src, &s4);
+        bool is_float = s4.size() == 1 && s4[0].t == FLOAT_ARRAY && s4[0].vaf.size() == 2;
+        if (is_float != typed || (is_float && s4[0].vaf[0] + s4[0].vaf[1] != 3.5)) {
+            printf("%s: wrong result %s\n", src, s4.empty() ? "(none)" : s4.back().str().c_str());
+            lit_ok = false;
+        }
+    }
+    if (lit_ok) printf("float literals: ok\n");
+    ok = lit_ok && ok;
+    return ok ? 0 : 1;
+}